@@ -72,6 +72,13 @@ public:
         if(pitch < -89.0f) {
           pitch = -89.0f;
         }
+        setPose(position, yaw, pitch);
+    }
+    // Places the camera directly, e.g. along a scripted path.
+    void setPose(glm::vec3 iPosition, float iYaw, float iPitch) {
+        position = iPosition;
+        yaw = iYaw;
+        pitch = glm::clamp(iPitch, -89.0f, 89.0f);
         front = glm::normalize(glm::vec3(
                           cos(glm::radians(yaw)) * cos(glm::radians(pitch)),
                           sin(glm::radians(pitch)),
@@ -0,0 +1,109 @@
+#ifndef contenthash_hpp
+#define contenthash_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// XXH64 (Yann Collet's xxHash, 64-bit variant): a fast non-cryptographic
+// hash, used to spot byte-identical asset files under different names.
+
+const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t xxhRotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+inline uint64_t xxhRead64(const unsigned char *p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+inline uint32_t xxhRead32(const unsigned char *p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+inline uint64_t xxhRound(uint64_t accumulator, uint64_t input) {
+    accumulator += input * XXH_PRIME64_2;
+    accumulator = xxhRotl64(accumulator, 31);
+    return accumulator * XXH_PRIME64_1;
+}
+inline uint64_t xxhMergeRound(uint64_t accumulator, uint64_t value) {
+    accumulator ^= xxhRound(0, value);
+    return accumulator * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+// Assumes a little-endian host, like every platform this builds for.
+inline uint64_t xxh64(const void *data, size_t length, uint64_t seed = 0) {
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + length;
+    uint64_t hash;
+    if (length >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        const unsigned char *limit = end - 32;
+        do {
+            v1 = xxhRound(v1, xxhRead64(p)); p += 8;
+            v2 = xxhRound(v2, xxhRead64(p)); p += 8;
+            v3 = xxhRound(v3, xxhRead64(p)); p += 8;
+            v4 = xxhRound(v4, xxhRead64(p)); p += 8;
+        } while (p <= limit);
+        hash = xxhRotl64(v1, 1) + xxhRotl64(v2, 7) + xxhRotl64(v3, 12) + xxhRotl64(v4, 18);
+        hash = xxhMergeRound(hash, v1);
+        hash = xxhMergeRound(hash, v2);
+        hash = xxhMergeRound(hash, v3);
+        hash = xxhMergeRound(hash, v4);
+    } else {
+        hash = seed + XXH_PRIME64_5;
+    }
+    hash += (uint64_t)length;
+
+    while (p + 8 <= end) {
+        hash ^= xxhRound(0, xxhRead64(p));
+        hash = xxhRotl64(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        hash ^= (uint64_t)xxhRead32(p) * XXH_PRIME64_1;
+        hash = xxhRotl64(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        hash ^= (*p) * XXH_PRIME64_5;
+        hash = xxhRotl64(hash, 11) * XXH_PRIME64_1;
+        p++;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Whole file into memory; false if it cannot be read.
+inline bool readFileBytes(const std::string &path, std::vector<unsigned char> &bytes) {
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    bytes.resize(size > 0 ? (size_t)size : 0);
+    size_t read = bytes.empty() ? 0 : std::fread(bytes.data(), 1, bytes.size(), file);
+    std::fclose(file);
+    return read == bytes.size();
+}
+
+#endif
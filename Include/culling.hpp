@@ -0,0 +1,154 @@
+#ifndef culling_hpp
+#define culling_hpp
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <simd.hpp>
+
+struct BoundingBox {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+struct BoundingSphere {
+    glm::vec3 center;
+    float radius;
+};
+
+// Six normalized planes (xyz normal pointing inwards, w distance), in the
+// order left, right, bottom, top, near, far.
+struct Frustum {
+    glm::vec4 planes[6];
+};
+
+// Gribb/Hartmann extraction from a combined projection * view matrix.
+inline Frustum extractFrustum(const glm::mat4 &viewProjection) {
+    Frustum frustum;
+    glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+    glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+    glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+    glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+    frustum.planes[0] = row3 + row0;
+    frustum.planes[1] = row3 - row0;
+    frustum.planes[2] = row3 + row1;
+    frustum.planes[3] = row3 - row1;
+    frustum.planes[4] = row3 + row2;
+    frustum.planes[5] = row3 - row2;
+    for (unsigned int i = 0; i < 6; i++) {
+        frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+    }
+    return frustum;
+}
+
+// Collects world-space bounds for one frame and tests them against the view
+// frustum four at a time. Each bound is first tested as a sphere, which is
+// cheap and rejects most invisible objects; groups with a lane still alive
+// are then tested as world-space boxes, which are tighter. Call begin(),
+// add() every bound, then run() once per frame.
+class CullingPass {
+public:
+    void begin(const glm::mat4 &projection, const glm::mat4 &view) {
+        frustum = extractFrustum(projection * view);
+        centerX.clear(); centerY.clear(); centerZ.clear();
+        extentX.clear(); extentY.clear(); extentZ.clear();
+        sphereX.clear(); sphereY.clear(); sphereZ.clear(); sphereRadius.clear();
+        visibility.clear();
+        culledBounds = 0;
+    }
+
+    // Transforms local bounds by modelMatrix and queues them; the returned
+    // index is what visible() takes once run() has been called.
+    unsigned int add(const BoundingBox &box, const BoundingSphere &sphere, const glm::mat4 &modelMatrix) {
+        glm::vec3 center = glm::vec3(modelMatrix * glm::vec4((box.min + box.max) * 0.5f, 1.0f));
+        glm::vec3 halfSize = (box.max - box.min) * 0.5f;
+        // Arvo: the world extent is the local extent through |rotation * scale|.
+        glm::mat3 basis(modelMatrix);
+        glm::vec3 extent = glm::vec3(std::fabs(basis[0][0]), std::fabs(basis[0][1]), std::fabs(basis[0][2])) * halfSize.x
+                         + glm::vec3(std::fabs(basis[1][0]), std::fabs(basis[1][1]), std::fabs(basis[1][2])) * halfSize.y
+                         + glm::vec3(std::fabs(basis[2][0]), std::fabs(basis[2][1]), std::fabs(basis[2][2])) * halfSize.z;
+        glm::vec3 sphereCenter = glm::vec3(modelMatrix * glm::vec4(sphere.center, 1.0f));
+        float scale = std::max(glm::length(basis[0]), std::max(glm::length(basis[1]), glm::length(basis[2])));
+
+        centerX.push_back(center.x); centerY.push_back(center.y); centerZ.push_back(center.z);
+        extentX.push_back(extent.x); extentY.push_back(extent.y); extentZ.push_back(extent.z);
+        sphereX.push_back(sphereCenter.x); sphereY.push_back(sphereCenter.y); sphereZ.push_back(sphereCenter.z);
+        sphereRadius.push_back(sphere.radius * scale);
+        return (unsigned int)centerX.size() - 1;
+    }
+
+    void run() {
+        unsigned int count = (unsigned int)centerX.size();
+        // Pad to whole groups of four for the duration of the test.
+        unsigned int padded = (count + 3) & ~3u;
+        std::vector<float> *arrays[] = {&centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ, &sphereX, &sphereY, &sphereZ, &sphereRadius};
+        for (unsigned int a = 0; a < 10; a++) {
+            arrays[a]->resize(padded, 0.0f);
+        }
+        visibility.assign(padded, 0);
+
+        Float4 planeX[6], planeY[6], planeZ[6], planeW[6];
+        Float4 planeAbsX[6], planeAbsY[6], planeAbsZ[6];
+        for (unsigned int p = 0; p < 6; p++) {
+            planeX[p] = splat4(frustum.planes[p].x);
+            planeY[p] = splat4(frustum.planes[p].y);
+            planeZ[p] = splat4(frustum.planes[p].z);
+            planeW[p] = splat4(frustum.planes[p].w);
+            planeAbsX[p] = abs4(planeX[p]);
+            planeAbsY[p] = abs4(planeY[p]);
+            planeAbsZ[p] = abs4(planeZ[p]);
+        }
+        Float4 zero = splat4(0.0f);
+
+        for (unsigned int i = 0; i < padded; i += 4) {
+            // A bound is outside once it lies fully behind any one plane.
+            Float4 x = load4(&sphereX[i]), y = load4(&sphereY[i]), z = load4(&sphereZ[i]);
+            Float4 negativeRadius = sub4(zero, load4(&sphereRadius[i]));
+            unsigned int outside = 0;
+            for (unsigned int p = 0; p < 6; p++) {
+                Float4 distance = madd4(planeX[p], x, madd4(planeY[p], y, madd4(planeZ[p], z, planeW[p])));
+                outside |= lessMask4(distance, negativeRadius);
+            }
+            if (outside != 0xf) {
+                x = load4(&centerX[i]); y = load4(&centerY[i]); z = load4(&centerZ[i]);
+                Float4 ex = load4(&extentX[i]), ey = load4(&extentY[i]), ez = load4(&extentZ[i]);
+                for (unsigned int p = 0; p < 6; p++) {
+                    Float4 distance = madd4(planeX[p], x, madd4(planeY[p], y, madd4(planeZ[p], z, planeW[p])));
+                    Float4 radius = madd4(planeAbsX[p], ex, madd4(planeAbsY[p], ey, mul4(planeAbsZ[p], ez)));
+                    outside |= lessMask4(distance, sub4(zero, radius));
+                }
+            }
+            for (unsigned int lane = 0; lane < 4; lane++) {
+                visibility[i + lane] = (outside >> lane & 1) ? 0 : 1;
+            }
+        }
+
+        for (unsigned int a = 0; a < 10; a++) {
+            arrays[a]->resize(count);
+        }
+        visibility.resize(count);
+        for (unsigned int i = 0; i < count; i++) {
+            culledBounds += visibility[i] ? 0 : 1;
+        }
+    }
+
+    bool visible(unsigned int index) const {
+        return index < visibility.size() && visibility[index];
+    }
+    unsigned int testedCount() const {
+        return (unsigned int)centerX.size();
+    }
+    unsigned int culledCount() const {
+        return culledBounds;
+    }
+private:
+    Frustum frustum;
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+    std::vector<float> sphereX, sphereY, sphereZ, sphereRadius;
+    std::vector<unsigned char> visibility;
+    unsigned int culledBounds = 0;
+};
+
+#endif
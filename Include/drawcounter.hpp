@@ -0,0 +1,118 @@
+#ifndef drawcounter_hpp
+#define drawcounter_hpp
+
+#include <glad/glad.h>
+
+struct DrawCallCounts {
+    unsigned int calls;    // glDraw* and glMultiDraw* calls
+    unsigned int commands; // draws they issued; a multi-draw counts each of its commands
+};
+
+inline DrawCallCounts &drawCallCounts() {
+    static DrawCallCounts counts = {0, 0};
+    return counts;
+}
+
+// Counts every draw call the process makes, the ImGui backend's included, by
+// swapping glad's draw entry points for wrappers that count and forward. Only
+// the entry points this renderer uses are wrapped. Install once, after glad
+// has loaded.
+class DrawCallCounter {
+public:
+    static void install() {
+        if (drawArrays() != NULL) {
+            return;
+        }
+        drawArrays() = glad_glDrawArrays;
+        drawElements() = glad_glDrawElements;
+        drawElementsBaseVertex() = glad_glDrawElementsBaseVertex;
+        drawElementsInstanced() = glad_glDrawElementsInstanced;
+        drawElementsInstancedBaseVertex() = glad_glDrawElementsInstancedBaseVertex;
+        drawElementsIndirect() = glad_glDrawElementsIndirect;
+        multiDrawElementsIndirect() = glad_glMultiDrawElementsIndirect;
+        glad_glDrawArrays = countDrawArrays;
+        glad_glDrawElements = countDrawElements;
+        glad_glDrawElementsBaseVertex = countDrawElementsBaseVertex;
+        glad_glDrawElementsInstanced = countDrawElementsInstanced;
+        glad_glDrawElementsInstancedBaseVertex = countDrawElementsInstancedBaseVertex;
+        // Missing before GL 4.0/4.3; left missing so callers' checks still work.
+        if (drawElementsIndirect() != NULL) {
+            glad_glDrawElementsIndirect = countDrawElementsIndirect;
+        }
+        if (multiDrawElementsIndirect() != NULL) {
+            glad_glMultiDrawElementsIndirect = countMultiDrawElementsIndirect;
+        }
+    }
+
+    // The counts since the last call.
+    static DrawCallCounts take() {
+        DrawCallCounts counts = drawCallCounts();
+        drawCallCounts().calls = 0;
+        drawCallCounts().commands = 0;
+        return counts;
+    }
+private:
+    static PFNGLDRAWARRAYSPROC &drawArrays() {
+        static PFNGLDRAWARRAYSPROC function = NULL;
+        return function;
+    }
+    static PFNGLDRAWELEMENTSPROC &drawElements() {
+        static PFNGLDRAWELEMENTSPROC function = NULL;
+        return function;
+    }
+    static PFNGLDRAWELEMENTSBASEVERTEXPROC &drawElementsBaseVertex() {
+        static PFNGLDRAWELEMENTSBASEVERTEXPROC function = NULL;
+        return function;
+    }
+    static PFNGLDRAWELEMENTSINSTANCEDPROC &drawElementsInstanced() {
+        static PFNGLDRAWELEMENTSINSTANCEDPROC function = NULL;
+        return function;
+    }
+    static PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXPROC &drawElementsInstancedBaseVertex() {
+        static PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXPROC function = NULL;
+        return function;
+    }
+    static PFNGLDRAWELEMENTSINDIRECTPROC &drawElementsIndirect() {
+        static PFNGLDRAWELEMENTSINDIRECTPROC function = NULL;
+        return function;
+    }
+    static PFNGLMULTIDRAWELEMENTSINDIRECTPROC &multiDrawElementsIndirect() {
+        static PFNGLMULTIDRAWELEMENTSINDIRECTPROC function = NULL;
+        return function;
+    }
+
+    static void count(unsigned int commands) {
+        drawCallCounts().calls++;
+        drawCallCounts().commands += commands;
+    }
+    static void APIENTRY countDrawArrays(GLenum mode, GLint first, GLsizei count) {
+        DrawCallCounter::count(1);
+        drawArrays()(mode, first, count);
+    }
+    static void APIENTRY countDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices) {
+        DrawCallCounter::count(1);
+        drawElements()(mode, count, type, indices);
+    }
+    static void APIENTRY countDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const void *indices, GLint basevertex) {
+        DrawCallCounter::count(1);
+        drawElementsBaseVertex()(mode, count, type, indices, basevertex);
+    }
+    static void APIENTRY countDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instancecount) {
+        DrawCallCounter::count(1);
+        drawElementsInstanced()(mode, count, type, indices, instancecount);
+    }
+    static void APIENTRY countDrawElementsInstancedBaseVertex(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instancecount, GLint basevertex) {
+        DrawCallCounter::count(1);
+        drawElementsInstancedBaseVertex()(mode, count, type, indices, instancecount, basevertex);
+    }
+    static void APIENTRY countDrawElementsIndirect(GLenum mode, GLenum type, const void *indirect) {
+        DrawCallCounter::count(1);
+        drawElementsIndirect()(mode, type, indirect);
+    }
+    static void APIENTRY countMultiDrawElementsIndirect(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride) {
+        DrawCallCounter::count((unsigned int)drawcount);
+        multiDrawElementsIndirect()(mode, type, indirect, drawcount, stride);
+    }
+};
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef framecapture_hpp
+#define framecapture_hpp
+
+#include <camera.hpp>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// The settings a capture records alongside the camera, such as slider and
+// checkbox values. Each one is stored as a 32-bit word, so at most
+// MAX_VALUES can be tracked. Recordings and replays have to track the same
+// values in the same order.
+class CaptureValues {
+public:
+    static const unsigned int MAX_VALUES = 32;
+
+    void track(float *value) {
+        add(VALUE_FLOAT, value);
+    }
+    void track(int *value) {
+        add(VALUE_INT, value);
+    }
+    void track(bool *value) {
+        add(VALUE_BOOL, value);
+    }
+
+    unsigned int size() const {
+        return (unsigned int)values.size();
+    }
+    uint32_t read(unsigned int index) const {
+        const Value &value = values[index];
+        uint32_t word = 0;
+        if (value.type == VALUE_BOOL) {
+            word = *(bool *)value.pointer ? 1 : 0;
+        } else {
+            memcpy(&word, value.pointer, sizeof(word));
+        }
+        return word;
+    }
+    void write(unsigned int index, uint32_t word) {
+        const Value &value = values[index];
+        if (value.type == VALUE_BOOL) {
+            *(bool *)value.pointer = word != 0;
+        } else {
+            memcpy(value.pointer, &word, sizeof(word));
+        }
+    }
+private:
+    enum ValueType {
+        VALUE_FLOAT,
+        VALUE_INT,
+        VALUE_BOOL
+    };
+    struct Value {
+        ValueType type;
+        void *pointer;
+    };
+    std::vector<Value> values;
+
+    void add(ValueType type, void *pointer) {
+        if (values.size() == MAX_VALUES) {
+            std::cout << "ERROR::CAPTURE::TOO_MANY_VALUES" << std::endl;
+            return;
+        }
+        Value value = {type, pointer};
+        values.push_back(value);
+    }
+};
+
+struct CapturedFrame {
+    glm::vec3 position;
+    float yaw;
+    float pitch;
+    int width;
+    int height;
+    std::vector<uint32_t> values;
+};
+
+// Capture files start with the magic, the version and the number of
+// tracked values, all 32-bit. Each frame then stores the camera position,
+// yaw and pitch as floats, the framebuffer size as two 16-bit integers, and
+// a 32-bit mask of the values that changed since the previous frame,
+// followed by those values. Most frames only change the camera, which makes
+// them 28 bytes. Integers are stored in the byte order of the machine that
+// recorded the file.
+const char CAPTURE_MAGIC[4] = {'F', 'C', 'A', 'P'};
+const uint32_t CAPTURE_VERSION = 1;
+
+// Writes a capture frame by frame while the app runs, so a crash keeps
+// everything up to the last frame.
+class FrameRecorder {
+public:
+    bool open(const std::string &filename, const CaptureValues &values) {
+        close();
+        file.open(filename, std::ios::binary);
+        if (!file) {
+            std::cout << "ERROR::CAPTURE::FILE_NOT_WRITTEN " << filename << std::endl;
+            return false;
+        }
+        uint32_t count = values.size();
+        file.write(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+        file.write((const char *)&CAPTURE_VERSION, sizeof(CAPTURE_VERSION));
+        file.write((const char *)&count, sizeof(count));
+        previous.clear();
+        frames = 0;
+        this->filename = filename;
+        return true;
+    }
+
+    bool recording() const {
+        return file.is_open();
+    }
+    unsigned int frameCount() const {
+        return frames;
+    }
+    const std::string &name() const {
+        return filename;
+    }
+
+    void record(const Camera &camera, int width, int height, const CaptureValues &values) {
+        if (!recording()) {
+            return;
+        }
+        float pose[5] = {camera.position.x, camera.position.y, camera.position.z, camera.yaw, camera.pitch};
+        uint16_t size[2] = {(uint16_t)width, (uint16_t)height};
+        uint32_t changed = 0;
+        uint32_t words[CaptureValues::MAX_VALUES];
+        unsigned int wordCount = 0;
+        previous.resize(values.size());
+        for (unsigned int i = 0; i < values.size(); i++) {
+            uint32_t word = values.read(i);
+            if (frames == 0 || word != previous[i]) {
+                changed |= 1u << i;
+                words[wordCount++] = word;
+                previous[i] = word;
+            }
+        }
+        file.write((const char *)pose, sizeof(pose));
+        file.write((const char *)size, sizeof(size));
+        file.write((const char *)&changed, sizeof(changed));
+        file.write((const char *)words, wordCount * sizeof(uint32_t));
+        frames++;
+    }
+
+    void close() {
+        if (!recording()) {
+            return;
+        }
+        file.close();
+        std::cout << "CAPTURE: " << frames << " frames recorded to " << filename << std::endl;
+    }
+
+    ~FrameRecorder() {
+        close();
+    }
+private:
+    std::ofstream file;
+    std::string filename;
+    std::vector<uint32_t> previous;
+    unsigned int frames = 0;
+};
+
+// A whole capture in memory, every frame holding the full set of values.
+class FrameReplay {
+public:
+    std::vector<CapturedFrame> frames;
+
+    bool load(const std::string &filename, const CaptureValues &values) {
+        std::ifstream file(filename, std::ios::binary);
+        char magic[4];
+        uint32_t version = 0, count = 0;
+        if (!file.read(magic, sizeof(magic)) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0
+            || !file.read((char *)&version, sizeof(version)) || version != CAPTURE_VERSION
+            || !file.read((char *)&count, sizeof(count))) {
+            std::cout << "ERROR::CAPTURE::NOT_A_CAPTURE " << filename << std::endl;
+            return false;
+        }
+        if (count != values.size()) {
+            std::cout << "ERROR::CAPTURE::TRACKED_VALUES_DIFFER " << filename << " has " << count << ", expected " << values.size() << std::endl;
+            return false;
+        }
+        frames.clear();
+        std::vector<uint32_t> current(count, 0);
+        float pose[5];
+        while (file.read((char *)pose, sizeof(pose))) {
+            uint16_t size[2];
+            uint32_t changed = 0;
+            if (!file.read((char *)size, sizeof(size)) || !file.read((char *)&changed, sizeof(changed))) {
+                break;
+            }
+            bool complete = true;
+            for (unsigned int i = 0; i < count && complete; i++) {
+                if (changed & (1u << i)) {
+                    complete = (bool)file.read((char *)&current[i], sizeof(uint32_t));
+                }
+            }
+            if (!complete) {
+                break;
+            }
+            CapturedFrame frame = {glm::vec3(pose[0], pose[1], pose[2]), pose[3], pose[4], size[0], size[1], current};
+            frames.push_back(frame);
+        }
+        if (frames.empty()) {
+            std::cout << "ERROR::CAPTURE::NO_FRAMES " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Sets the camera and the tracked values to the frame's. The size is
+    // left to the caller, which has to resize its framebuffers.
+    void apply(unsigned int index, Camera &camera, CaptureValues &values) const {
+        const CapturedFrame &frame = frames[index];
+        camera.setPose(frame.position, frame.yaw, frame.pitch);
+        for (unsigned int i = 0; i < frame.values.size(); i++) {
+            values.write(i, frame.values[i]);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,346 @@
+#ifndef geometryarena_hpp
+#define geometryarena_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vertexformat.hpp>
+#include <instancing.hpp>
+#include <glstate.hpp>
+
+// Layout of one glMultiDrawElementsIndirect / glDrawElementsIndirect command.
+struct DrawElementsIndirectCommand {
+    uint32_t count;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    int32_t baseVertex;
+    uint32_t baseInstance;
+};
+
+// First-fit allocator over [0, capacity). Free ranges are kept sorted by
+// offset so neighbours merge back together when released.
+class RangeAllocator {
+public:
+    explicit RangeAllocator(size_t capacity = 0) : capacity(capacity) {
+        if (capacity > 0) {
+            freeRanges[0] = capacity;
+        }
+    }
+
+    // offset is a multiple of alignment on success.
+    bool allocate(size_t size, size_t alignment, size_t &offset) {
+        for (std::map<size_t, size_t>::iterator it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+            size_t start = (it->first + alignment - 1) / alignment * alignment;
+            size_t end = it->first + it->second;
+            if (start + size > end) {
+                continue;
+            }
+            size_t rangeStart = it->first;
+            freeRanges.erase(it);
+            if (start > rangeStart) {
+                freeRanges[rangeStart] = start - rangeStart;
+            }
+            if (start + size < end) {
+                freeRanges[start + size] = end - (start + size);
+            }
+            offset = start;
+            used += size;
+            return true;
+        }
+        return false;
+    }
+    void release(size_t offset, size_t size) {
+        if (size == 0) {
+            return;
+        }
+        used -= size;
+        std::map<size_t, size_t>::iterator next = freeRanges.lower_bound(offset);
+        if (next != freeRanges.end() && offset + size == next->first) {
+            size += next->second;
+            next = freeRanges.erase(next);
+        }
+        if (next != freeRanges.begin()) {
+            std::map<size_t, size_t>::iterator previous = next;
+            --previous;
+            if (previous->first + previous->second == offset) {
+                previous->second += size;
+                return;
+            }
+        }
+        freeRanges[offset] = size;
+    }
+    // Extends the range; whatever was free at the old end joins the new space.
+    void grow(size_t newCapacity) {
+        if (newCapacity <= capacity) {
+            return;
+        }
+        size_t oldCapacity = capacity;
+        capacity = newCapacity;
+        used += newCapacity - oldCapacity;
+        release(oldCapacity, newCapacity - oldCapacity);
+    }
+    size_t getCapacity() const {
+        return capacity;
+    }
+    size_t getUsed() const {
+        return used;
+    }
+private:
+    std::map<size_t, size_t> freeRanges;
+    size_t capacity;
+    size_t used = 0;
+};
+
+// Where one mesh's geometry lives in the arena. It releases its ranges when
+// destroyed, and moving hands them over, so a Mesh can keep its default moves.
+class ArenaAllocation {
+public:
+    Vertex_Format format = VERTEX_FLOAT;
+    uint32_t baseVertex = 0;
+    uint32_t vertexCount = 0;
+    uint32_t indexOffset = 0;   // in bytes
+    uint32_t indexBytes = 0;
+    bool valid = false;
+
+    ArenaAllocation() {}
+    ArenaAllocation(const ArenaAllocation &) = delete;
+    ArenaAllocation &operator=(const ArenaAllocation &) = delete;
+    ArenaAllocation(ArenaAllocation &&other) {
+        *this = std::move(other);
+    }
+    ArenaAllocation &operator=(ArenaAllocation &&other);
+    ~ArenaAllocation();
+};
+
+struct GeometryArenaStats {
+    size_t vertexBytes, vertexCapacityBytes;
+    size_t indexBytes, indexCapacityBytes;
+};
+
+// Every mesh's vertices and indices, shared: one vertex buffer, one index
+// buffer and one VAO per vertex format, with meshes sub-allocated inside.
+// Draws of different meshes then differ only in their index range and base
+// vertex, which is what lets the render queue merge them into multi-draws.
+// Buffers double (with a GPU-side copy) when a format runs out of room.
+class GeometryArena {
+public:
+    static const size_t INITIAL_VERTICES = 1 << 16;
+    static const size_t INITIAL_INDEX_BYTES = 1 << 20;
+
+    GeometryArena(const GeometryArena &) = delete;
+    GeometryArena &operator=(const GeometryArena &) = delete;
+    GeometryArena() {}
+
+    // Reserves room for the mesh and copies its data in. indexSize is 2 or
+    // 4; index ranges are aligned to 4 bytes either way.
+    bool allocate(Vertex_Format format, const void *vertices, unsigned int vertexCount, const void *indices, unsigned int indexBytes, ArenaAllocation &allocation) {
+        Pool &pool = getPool(format);
+        size_t baseVertex = 0, indexOffset = 0;
+        while (!pool.vertices.allocate(vertexCount, 1, baseVertex)) {
+            growVertices(pool, format, pool.vertices.getCapacity() * 2);
+        }
+        while (!pool.indices.allocate(indexBytes, 4, indexOffset)) {
+            growIndices(pool, format, pool.indices.getCapacity() * 2);
+        }
+        allocation.format = format;
+        allocation.baseVertex = (uint32_t)baseVertex;
+        allocation.vertexCount = vertexCount;
+        allocation.indexOffset = (uint32_t)indexOffset;
+        allocation.indexBytes = indexBytes;
+        allocation.valid = true;
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.VBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, baseVertex * pool.stride, (size_t)vertexCount * pool.stride, vertices);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.EBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset, indexBytes, indices);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return true;
+    }
+    void release(const ArenaAllocation &allocation) {
+        Pool &pool = getPool(allocation.format);
+        pool.vertices.release(allocation.baseVertex, allocation.vertexCount);
+        pool.indices.release(allocation.indexOffset, allocation.indexBytes);
+    }
+
+    // The one VAO all meshes of a format are drawn with.
+    unsigned int vertexArray(Vertex_Format format) {
+        return getPool(format).VAO;
+    }
+    // The same VAO plus an InstanceTransform per instance from
+    // instanceBuffer at attribute locations 3-9, created on first use.
+    unsigned int instanceVertexArray(Vertex_Format format, unsigned int instanceBuffer) {
+        Pool &pool = getPool(format);
+        for (unsigned int i = 0; i < pool.instanceArrays.size(); i++) {
+            if (pool.instanceArrays[i].buffer == instanceBuffer) {
+                return pool.instanceArrays[i].VAO;
+            }
+        }
+        InstanceArray instanced;
+        instanced.buffer = instanceBuffer;
+        glGenVertexArrays(1, &instanced.VAO);
+        pool.instanceArrays.push_back(instanced);
+        setupVertexArray(pool, format, instanced.VAO, instanceBuffer);
+        return instanced.VAO;
+    }
+
+    GeometryArenaStats stats() const {
+        GeometryArenaStats result = {0, 0, 0, 0};
+        for (unsigned int i = 0; i < FORMAT_COUNT; i++) {
+            if (pools[i].VAO == 0) {
+                continue;
+            }
+            result.vertexBytes += pools[i].vertices.getUsed() * pools[i].stride;
+            result.vertexCapacityBytes += pools[i].vertices.getCapacity() * pools[i].stride;
+            result.indexBytes += pools[i].indices.getUsed();
+            result.indexCapacityBytes += pools[i].indices.getCapacity();
+        }
+        return result;
+    }
+private:
+    static const unsigned int FORMAT_COUNT = 3;
+
+    struct InstanceArray {
+        unsigned int VAO;
+        unsigned int buffer;
+    };
+    struct Pool {
+        unsigned int VAO = 0, VBO = 0, EBO = 0;
+        unsigned int stride = 0;
+        RangeAllocator vertices, indices;
+        std::vector<InstanceArray> instanceArrays;
+    };
+    Pool pools[FORMAT_COUNT];
+
+    Pool &getPool(Vertex_Format format) {
+        Pool &pool = pools[format];
+        if (pool.VAO != 0) {
+            return pool;
+        }
+        pool.stride = format == VERTEX_FLOAT ? sizeof(Vertex) : sizeof(CompactVertex);
+        pool.vertices = RangeAllocator(INITIAL_VERTICES);
+        pool.indices = RangeAllocator(INITIAL_INDEX_BYTES);
+        glGenBuffers(1, &pool.VBO);
+        glGenBuffers(1, &pool.EBO);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.VBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, INITIAL_VERTICES * pool.stride, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.EBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, INITIAL_INDEX_BYTES, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glGenVertexArrays(1, &pool.VAO);
+        setupVertexArray(pool, format, pool.VAO, 0);
+        return pool;
+    }
+
+    // Replaces buffer with a larger one holding the same first oldSize bytes.
+    static void growBuffer(unsigned int &buffer, size_t oldSize, size_t newSize) {
+        unsigned int grown;
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSize);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+        buffer = grown;
+    }
+    void growVertices(Pool &pool, Vertex_Format format, size_t capacity) {
+        growBuffer(pool.VBO, pool.vertices.getCapacity() * pool.stride, capacity * pool.stride);
+        pool.vertices.grow(capacity);
+        rebuildVertexArrays(pool, format);
+    }
+    void growIndices(Pool &pool, Vertex_Format format, size_t capacity) {
+        growBuffer(pool.EBO, pool.indices.getCapacity(), capacity);
+        pool.indices.grow(capacity);
+        rebuildVertexArrays(pool, format);
+    }
+    // VAOs hold buffer names, so they are pointed at the replacements.
+    void rebuildVertexArrays(Pool &pool, Vertex_Format format) {
+        setupVertexArray(pool, format, pool.VAO, 0);
+        for (unsigned int i = 0; i < pool.instanceArrays.size(); i++) {
+            setupVertexArray(pool, format, pool.instanceArrays[i].VAO, pool.instanceArrays[i].buffer);
+        }
+    }
+
+    static void setupVertexArray(const Pool &pool, Vertex_Format format, unsigned int vertexArray, unsigned int instanceBuffer) {
+        glState().bindVertexArray(vertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, pool.VBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.EBO);
+        if (format == VERTEX_FLOAT) {
+            //Vertex Positions
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+
+            //Vertex Normals
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+
+            // Texture Coordinates
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
+        } else {
+            //Vertex Positions, unorm16 within the mesh bounds
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, position));
+
+            //Vertex Normals, octahedral snorm16
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, normal));
+
+            // Texture Coordinates
+            glEnableVertexAttribArray(2);
+            if (format == VERTEX_COMPACT_HALF_UV) {
+                glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, texCoord));
+            } else {
+                glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, texCoord));
+            }
+        }
+        if (instanceBuffer != 0) {
+            glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+            for (unsigned int column = 0; column < 4; column++) {
+                glEnableVertexAttribArray(3 + column);
+                glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform), (void*)(offsetof(InstanceTransform, model) + column * sizeof(glm::vec4)));
+                glVertexAttribDivisor(3 + column, 1);
+            }
+            for (unsigned int column = 0; column < 3; column++) {
+                glEnableVertexAttribArray(7 + column);
+                glVertexAttribPointer(7 + column, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform), (void*)(offsetof(InstanceTransform, normal) + column * sizeof(glm::vec3)));
+                glVertexAttribDivisor(7 + column, 1);
+            }
+        }
+        glState().bindVertexArray(0);
+    }
+};
+
+// The one arena; like glState(), only touched from the GL thread.
+inline GeometryArena &geometryArena() {
+    static GeometryArena arena;
+    return arena;
+}
+
+inline ArenaAllocation &ArenaAllocation::operator=(ArenaAllocation &&other) {
+    if (this != &other) {
+        if (valid) {
+            geometryArena().release(*this);
+        }
+        format = other.format;
+        baseVertex = other.baseVertex;
+        vertexCount = other.vertexCount;
+        indexOffset = other.indexOffset;
+        indexBytes = other.indexBytes;
+        valid = other.valid;
+        other.valid = false;
+    }
+    return *this;
+}
+
+inline ArenaAllocation::~ArenaAllocation() {
+    if (valid) {
+        geometryArena().release(*this);
+    }
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef glstate_hpp
+#define glstate_hpp
+
+#include <glad/glad.h>
+
+// Counts since the last resetCounters(): calls that reached the driver and
+// calls that were dropped because the state already matched.
+struct GLStateCounters {
+    unsigned int issued;
+    unsigned int elided;
+};
+
+// Shadows the GL state the renderer touches every frame and skips calls that
+// would not change it. Every bind of a tracked kind has to go through here;
+// code that binds behind its back (e.g. a third party renderer that does not
+// restore state) must call invalidate() afterwards. The ImGui backend saves
+// and restores everything it changes, so it needs no special handling.
+// Each setter returns true if the call was actually issued.
+class GLState {
+public:
+    static const unsigned int MAX_TEXTURE_UNITS = 16;
+
+    GLState() {
+        invalidate();
+    }
+
+    // Forgets everything, so the next call of each kind is always issued.
+    void invalidate() {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        framebuffer = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for (unsigned int unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+            texture2D[unit] = UNKNOWN;
+            textureCube[unit] = UNKNOWN;
+        }
+        blend = depthTest = cullFace = depthMask = -1;
+        blendSource = blendDestination = UNKNOWN;
+        for (unsigned int i = 0; i < MAX_BUFFER_BINDINGS; i++) {
+            uniformBuffer[i] = UNKNOWN;
+            uniformOffset[i] = UNKNOWN;
+            uniformSize[i] = UNKNOWN;
+        }
+    }
+
+    bool useProgram(unsigned int id) {
+        if (!changed(program, id)) {
+            return false;
+        }
+        glUseProgram(id);
+        return true;
+    }
+    bool bindVertexArray(unsigned int id) {
+        if (!changed(vertexArray, id)) {
+            return false;
+        }
+        glBindVertexArray(id);
+        return true;
+    }
+    bool bindFramebuffer(unsigned int id) {
+        if (!changed(framebuffer, id)) {
+            return false;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, id);
+        return true;
+    }
+    // target is GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP. glActiveTexture is only
+    // issued when the bind itself is.
+    bool bindTexture(unsigned int unit, GLenum target, unsigned int id) {
+        unsigned int &bound = target == GL_TEXTURE_CUBE_MAP ? textureCube[unit] : texture2D[unit];
+        if (!changed(bound, id)) {
+            return false;
+        }
+        if (activeUnit != unit) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            activeUnit = unit;
+            counters.issued++;
+        }
+        glBindTexture(target, id);
+        return true;
+    }
+    // capability is GL_BLEND, GL_DEPTH_TEST or GL_CULL_FACE.
+    bool setEnabled(GLenum capability, bool enabled) {
+        int &current = capability == GL_BLEND ? blend : capability == GL_DEPTH_TEST ? depthTest : cullFace;
+        if (!changed(current, enabled ? 1 : 0)) {
+            return false;
+        }
+        if (enabled) {
+            glEnable(capability);
+        } else {
+            glDisable(capability);
+        }
+        return true;
+    }
+    bool setDepthMask(bool enabled) {
+        if (!changed(depthMask, enabled ? 1 : 0)) {
+            return false;
+        }
+        glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+        return true;
+    }
+    bool setBlendFunc(GLenum source, GLenum destination) {
+        if (blendSource == source && blendDestination == destination) {
+            counters.elided++;
+            return false;
+        }
+        blendSource = source;
+        blendDestination = destination;
+        counters.issued++;
+        glBlendFunc(source, destination);
+        return true;
+    }
+    bool bindUniformBufferRange(unsigned int binding, unsigned int buffer, unsigned int offset, unsigned int size) {
+        if (binding < MAX_BUFFER_BINDINGS && uniformBuffer[binding] == buffer && uniformOffset[binding] == offset && uniformSize[binding] == size) {
+            counters.elided++;
+            return false;
+        }
+        if (binding < MAX_BUFFER_BINDINGS) {
+            uniformBuffer[binding] = buffer;
+            uniformOffset[binding] = offset;
+            uniformSize[binding] = size;
+        }
+        counters.issued++;
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+        return true;
+    }
+
+    GLStateCounters frameCounters() const {
+        return counters;
+    }
+    void resetCounters() {
+        counters.issued = 0;
+        counters.elided = 0;
+    }
+private:
+    static const unsigned int UNKNOWN = 0xffffffffu;
+    static const unsigned int MAX_BUFFER_BINDINGS = 8;
+
+    unsigned int program, vertexArray, framebuffer, activeUnit;
+    unsigned int texture2D[MAX_TEXTURE_UNITS], textureCube[MAX_TEXTURE_UNITS];
+    int blend, depthTest, cullFace, depthMask;
+    unsigned int blendSource, blendDestination;
+    unsigned int uniformBuffer[MAX_BUFFER_BINDINGS], uniformOffset[MAX_BUFFER_BINDINGS], uniformSize[MAX_BUFFER_BINDINGS];
+    GLStateCounters counters = {0, 0};
+
+    template <typename T>
+    bool changed(T &current, T value) {
+        if (current == value) {
+            counters.elided++;
+            return false;
+        }
+        current = value;
+        counters.issued++;
+        return true;
+    }
+};
+
+// The one context's state; everything in the renderer runs on the GL thread.
+inline GLState &glState() {
+    static GLState state;
+    return state;
+}
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef gputimer_hpp
+#define gputimer_hpp
+
+#include <glad/glad.h>
+#include <vector>
+
+// Measures GPU time between begin() and end() with GL_TIME_ELAPSED queries.
+// Results are read a few frames late from a small ring of queries, so the
+// CPU never waits for the GPU to catch up; one timer per measured section.
+class GpuTimer {
+public:
+    static const unsigned int LATENCY = 4;
+
+    GpuTimer() {
+        glGenQueries(LATENCY, queries);
+        for (unsigned int i = 0; i < LATENCY; i++) {
+            pending[i] = false;
+        }
+    }
+    GpuTimer(const GpuTimer &) = delete;
+    GpuTimer &operator=(const GpuTimer &) = delete;
+
+    void begin() {
+        current = (current + 1) % LATENCY;
+        // The slot is about to be reused; take its result if it has one.
+        collect(current);
+        glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+    }
+    void end() {
+        glEndQuery(GL_TIME_ELAPSED);
+        pending[current] = true;
+    }
+
+    // The most recent result that has come back, in milliseconds.
+    float lastMs() {
+        for (unsigned int i = 1; i < LATENCY; i++) {
+            collect((current + i) % LATENCY);
+        }
+        return latestMs;
+    }
+private:
+    unsigned int queries[LATENCY];
+    bool pending[LATENCY];
+    unsigned int current = 0;
+    float latestMs = 0.0f;
+
+    void collect(unsigned int slot) {
+        if (!pending[slot]) {
+            return;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            return;
+        }
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &elapsed);
+        latestMs = (float)(elapsed / 1.0e6);
+        pending[slot] = false;
+    }
+};
+
+struct GpuFrameTime {
+    unsigned int frame;
+    float ms;
+};
+
+// Whole-frame GPU time for every frame, for reports rather than display. It
+// brackets each frame with GL_TIMESTAMP queries, which unlike GL_TIME_ELAPSED
+// may enclose the GpuTimer sections inside. Results are tagged with the frame
+// that issued them and read back late; begin() only waits if the GPU has
+// fallen LATENCY frames behind, and finish() waits for the rest.
+class GpuFrameTimer {
+public:
+    static const unsigned int LATENCY = 4;
+
+    GpuFrameTimer() {
+        glGenQueries(LATENCY * 2, queries);
+        for (unsigned int i = 0; i < LATENCY; i++) {
+            pending[i] = false;
+        }
+    }
+    GpuFrameTimer(const GpuFrameTimer &) = delete;
+    GpuFrameTimer &operator=(const GpuFrameTimer &) = delete;
+
+    void begin(unsigned int frame) {
+        current = (current + 1) % LATENCY;
+        collect(current, true);
+        frames[current] = frame;
+        glQueryCounter(queries[current * 2], GL_TIMESTAMP);
+    }
+    void end() {
+        glQueryCounter(queries[current * 2 + 1], GL_TIMESTAMP);
+        pending[current] = true;
+        for (unsigned int i = 1; i < LATENCY; i++) {
+            collect((current + i) % LATENCY, false);
+        }
+    }
+
+    // Every result so far, in the order they came back.
+    const std::vector<GpuFrameTime> &finish() {
+        for (unsigned int i = 1; i <= LATENCY; i++) {
+            collect((current + i) % LATENCY, true);
+        }
+        return results;
+    }
+private:
+    unsigned int queries[LATENCY * 2];
+    unsigned int frames[LATENCY];
+    bool pending[LATENCY];
+    unsigned int current = 0;
+    std::vector<GpuFrameTime> results;
+
+    void collect(unsigned int slot, bool wait) {
+        if (!pending[slot]) {
+            return;
+        }
+        GLint available = 0;
+        if (!wait) {
+            glGetQueryObjectiv(queries[slot * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                return;
+            }
+        }
+        GLuint64 start = 0, end = 0;
+        glGetQueryObjectui64v(queries[slot * 2], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(queries[slot * 2 + 1], GL_QUERY_RESULT, &end);
+        GpuFrameTime result = {frames[slot], (float)((end - start) / 1.0e6)};
+        results.push_back(result);
+        pending[slot] = false;
+    }
+};
+
+#endif
@@ -0,0 +1,400 @@
+#ifndef headless_hpp
+#define headless_hpp
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(__linux__)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// Headless runs render a scripted camera path, or replay a capture, for a
+// fixed number of frames without a window and write per-frame timings as
+// JSON, so render performance can be tracked on build machines without a
+// display or GPU. Captures are recorded from interactive runs.
+struct HeadlessSettings {
+    bool enabled = false;
+    int frames = 300;
+    int warmupFrames = 60; // rendered but not reported; loads and texture streaming settle
+    int width = 1280;
+    int height = 720;
+    int stressInstances = 0; // enables the instancing stress scene
+    std::string pathFile;    // camera keyframes; the built-in orbit if empty
+    std::string reportFile = "headless_report.json";
+    std::string replayFile;  // a capture to replay instead of the path; implies headless
+    std::string recordFile;  // a capture to record from the start of an interactive run
+};
+
+// Simulated time advances by this much per headless frame, whatever the
+// frame really took, so every run renders the same images.
+const float HEADLESS_TIMESTEP = 1.0f / 60.0f;
+
+// --headless [--frames N] [--warmup N] [--size WxH] [--stress N]
+//            [--path keyframes.txt] [--report out.json]
+// --replay capture.fcap [--warmup N] [--report out.json]
+// --record capture.fcap
+// False, with the usage printed, if an argument is not understood.
+inline bool parseHeadlessArgs(int argc, char **argv, HeadlessSettings &settings) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--headless") {
+            settings.enabled = true;
+        } else if (arg == "--frames" && hasValue) {
+            settings.frames = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--warmup" && hasValue) {
+            settings.warmupFrames = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--size" && hasValue && sscanf(argv[i + 1], "%dx%d", &settings.width, &settings.height) == 2) {
+            i++;
+        } else if (arg == "--stress" && hasValue) {
+            settings.stressInstances = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--path" && hasValue) {
+            settings.pathFile = argv[++i];
+        } else if (arg == "--report" && hasValue) {
+            settings.reportFile = argv[++i];
+        } else if (arg == "--replay" && hasValue) {
+            settings.replayFile = argv[++i];
+            settings.enabled = true;
+        } else if (arg == "--record" && hasValue) {
+            settings.recordFile = argv[++i];
+        } else {
+            std::cout << "ERROR::HEADLESS::UNKNOWN_ARGUMENT " << arg << std::endl;
+            std::cout << "usage: " << argv[0] << " [--headless [--frames N] [--warmup N] [--size WxH] [--stress N] [--path keyframes.txt] [--report out.json]]" << std::endl;
+            std::cout << "       " << argv[0] << " [--replay capture.fcap [--warmup N] [--report out.json]]" << std::endl;
+            std::cout << "       " << argv[0] << " [--record capture.fcap]" << std::endl;
+            return false;
+        }
+    }
+    if (settings.enabled && !settings.recordFile.empty()) {
+        std::cout << "ERROR::HEADLESS::RECORD_NEEDS_A_WINDOW" << std::endl;
+        return false;
+    }
+    return settings.width > 0 && settings.height > 0;
+}
+
+// Seconds on a steady clock. glfwGetTime() needs GLFW, which a headless run
+// on EGL never initializes.
+inline double monotonicSeconds() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// A GL context with no window and no display: EGL on Mesa's surfaceless
+// platform, which falls back to llvmpipe on machines without a GPU. Rendering
+// has to go to framebuffer objects, as there is no default framebuffer.
+// Elsewhere create() fails and the caller can use a hidden window instead.
+class HeadlessContext {
+public:
+    bool create(int major, int minor) {
+#if defined(__linux__)
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay) {
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        }
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+            if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+                std::cout << "ERROR::HEADLESS::NO_EGL_DISPLAY" << std::endl;
+                display = EGL_NO_DISPLAY;
+                return false;
+            }
+        }
+        EGLint configAttributes[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_SURFACE_TYPE, 0, EGL_NONE};
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0) {
+            std::cout << "ERROR::HEADLESS::NO_OPENGL_CONFIG" << std::endl;
+            destroy();
+            return false;
+        }
+        EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, major,
+            EGL_CONTEXT_MINOR_VERSION, minor,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+            std::cout << "ERROR::HEADLESS::CONTEXT_FAILED 0x" << std::hex << eglGetError() << std::dec << std::endl;
+            destroy();
+            return false;
+        }
+        return true;
+#else
+        (void)major;
+        (void)minor;
+        return false;
+#endif
+    }
+
+    bool loadGL() {
+#if defined(__linux__)
+        return gladLoadGLLoader((GLADloadproc)eglGetProcAddress) != 0;
+#else
+        return false;
+#endif
+    }
+
+    void destroy() {
+#if defined(__linux__)
+        if (display == EGL_NO_DISPLAY) {
+            return;
+        }
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (context != EGL_NO_CONTEXT) {
+            eglDestroyContext(display, context);
+            context = EGL_NO_CONTEXT;
+        }
+        eglTerminate(display);
+        display = EGL_NO_DISPLAY;
+#endif
+    }
+private:
+#if defined(__linux__)
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+#endif
+};
+
+struct CameraPose {
+    glm::vec3 position;
+    float yaw;   // degrees, as Camera keeps them
+    float pitch;
+};
+
+// A looping camera flight through keyframes, each a position and a point to
+// look at, visited at an even pace along a Catmull-Rom spline.
+class CameraPath {
+public:
+    struct Keyframe {
+        glm::vec3 position;
+        glm::vec3 target;
+    };
+    std::vector<Keyframe> keyframes;
+
+    // Circles the scene, dipping towards the models and rising above the
+    // stress grid.
+    static CameraPath orbit() {
+        CameraPath path;
+        const unsigned int count = 8;
+        for (unsigned int i = 0; i < count; i++) {
+            float angle = glm::radians(360.0f * i / count);
+            float radius = i % 2 == 0 ? 9.0f : 5.0f;
+            float height = i % 4 == 3 ? 6.0f : 1.0f;
+            Keyframe keyframe = {glm::vec3(std::cos(angle) * radius, height, std::sin(angle) * radius), glm::vec3(0.0f, 0.0f, 0.0f)};
+            path.keyframes.push_back(keyframe);
+        }
+        return path;
+    }
+
+    // One keyframe per line: position x y z, then target x y z. Lines
+    // starting with # are comments.
+    bool load(const std::string &filename) {
+        std::ifstream file(filename);
+        if (!file) {
+            std::cout << "ERROR::HEADLESS::PATH_NOT_FOUND " << filename << std::endl;
+            return false;
+        }
+        keyframes.clear();
+        std::string line;
+        while (std::getline(file, line)) {
+            Keyframe keyframe;
+            std::istringstream values(line);
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            if (values >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z >> keyframe.target.x >> keyframe.target.y >> keyframe.target.z) {
+                keyframes.push_back(keyframe);
+            }
+        }
+        if (keyframes.size() < 2) {
+            std::cout << "ERROR::HEADLESS::PATH_NEEDS_TWO_KEYFRAMES " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // t in [0, 1) goes once around the loop.
+    CameraPose sample(float t) const {
+        unsigned int count = (unsigned int)keyframes.size();
+        float scaled = (t - std::floor(t)) * count;
+        unsigned int segment = std::min((unsigned int)scaled, count - 1);
+        float f = scaled - segment;
+        const Keyframe &k0 = keyframes[(segment + count - 1) % count];
+        const Keyframe &k1 = keyframes[segment];
+        const Keyframe &k2 = keyframes[(segment + 1) % count];
+        const Keyframe &k3 = keyframes[(segment + 2) % count];
+        glm::vec3 position = catmullRom(k0.position, k1.position, k2.position, k3.position, f);
+        glm::vec3 direction = glm::normalize(catmullRom(k0.target, k1.target, k2.target, k3.target, f) - position);
+        CameraPose pose = {position, glm::degrees(std::atan2(direction.z, direction.x)), glm::degrees(std::asin(glm::clamp(direction.y, -1.0f, 1.0f)))};
+        return pose;
+    }
+private:
+    static glm::vec3 catmullRom(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2, const glm::vec3 &p3, float t) {
+        float t2 = t * t, t3 = t2 * t;
+        return 0.5f * (2.0f * p1 + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+    }
+};
+
+// The parts of a render loop iteration whose CPU time is reported
+// separately. Time spent waiting for the GPU falls between them.
+enum FrameStage {
+    STAGE_UI,          // events and building the UI
+    STAGE_UPLOADS,     // loader uploads and texture streaming
+    STAGE_SETUP,       // camera, frame uniforms, skybox, transforms
+    STAGE_CULLING,
+    STAGE_SCENE,       // level of detail, queueing and drawing
+    STAGE_POSTPROCESS,
+    STAGE_IMGUI,       // ImGui draw data and backend
+    FRAME_STAGE_COUNT
+};
+
+inline const char *frameStageName(unsigned int stage) {
+    static const char *names[FRAME_STAGE_COUNT] = {"ui", "uploads", "setup", "culling", "scene", "postprocess", "imgui"};
+    return names[stage];
+}
+
+// Splits a frame's CPU time into stages: each lap() charges the time since
+// the previous one, or since begin(), to a stage.
+class FrameStages {
+public:
+    float ms[FRAME_STAGE_COUNT];
+
+    void begin() {
+        for (unsigned int i = 0; i < FRAME_STAGE_COUNT; i++) {
+            ms[i] = 0.0f;
+        }
+        last = monotonicSeconds();
+    }
+    void lap(FrameStage stage) {
+        double now = monotonicSeconds();
+        ms[stage] += (float)((now - last) * 1000.0);
+        last = now;
+    }
+private:
+    double last = 0.0;
+};
+
+struct HeadlessFrame {
+    unsigned int frame;
+    double cpuMs;        // render loop iteration, wall clock
+    float gpuMs;         // first to last command of the frame on the GPU
+    unsigned int drawCalls;
+    unsigned int drawCommands; // multi-draws count each command
+    unsigned int triangles;
+    float stageMs[FRAME_STAGE_COUNT];
+};
+
+struct FrameTimeSummary {
+    double mean, p50, p95, p99;
+};
+
+// Nearest-rank percentiles, so every reported figure is a measured frame.
+inline FrameTimeSummary summarizeFrameTimes(std::vector<double> ms) {
+    FrameTimeSummary summary = {0.0, 0.0, 0.0, 0.0};
+    if (ms.empty()) {
+        return summary;
+    }
+    std::sort(ms.begin(), ms.end());
+    for (unsigned int i = 0; i < ms.size(); i++) {
+        summary.mean += ms[i];
+    }
+    summary.mean /= ms.size();
+    double percentiles[3] = {50.0, 95.0, 99.0};
+    double *results[3] = {&summary.p50, &summary.p95, &summary.p99};
+    for (unsigned int i = 0; i < 3; i++) {
+        unsigned int rank = (unsigned int)std::ceil(percentiles[i] / 100.0 * ms.size());
+        *results[i] = ms[std::max(rank, 1u) - 1];
+    }
+    return summary;
+}
+
+// Summaries of frame time, GPU time and each stage, in that order.
+inline std::vector<FrameTimeSummary> summarizeHeadlessFrames(const std::vector<HeadlessFrame> &frames) {
+    std::vector<FrameTimeSummary> summaries;
+    std::vector<double> ms(frames.size());
+    for (unsigned int column = 0; column < 2 + FRAME_STAGE_COUNT; column++) {
+        for (unsigned int i = 0; i < frames.size(); i++) {
+            ms[i] = column == 0 ? frames[i].cpuMs : column == 1 ? frames[i].gpuMs : frames[i].stageMs[column - 2];
+        }
+        summaries.push_back(summarizeFrameTimes(ms));
+    }
+    return summaries;
+}
+
+inline std::string jsonSummary(const FrameTimeSummary &summary) {
+    std::ostringstream json;
+    json << "{\"mean\": " << summary.mean << ", \"p50\": " << summary.p50 << ", \"p95\": " << summary.p95 << ", \"p99\": " << summary.p99 << "}";
+    return json.str();
+}
+
+inline std::string jsonEscape(const std::string &text) {
+    std::string escaped;
+    for (unsigned int i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if ((unsigned char)c < 0x20) {
+            escaped += ' ';
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+inline bool writeHeadlessReport(const HeadlessSettings &settings, const std::vector<HeadlessFrame> &frames) {
+    std::ofstream file(settings.reportFile);
+    if (!file) {
+        std::cout << "ERROR::HEADLESS::REPORT_NOT_WRITTEN " << settings.reportFile << std::endl;
+        return false;
+    }
+    double drawCalls = 0.0, triangles = 0.0;
+    for (unsigned int i = 0; i < frames.size(); i++) {
+        drawCalls += frames[i].drawCalls;
+        triangles += frames[i].triangles;
+    }
+    double count = frames.empty() ? 1.0 : (double)frames.size();
+    std::vector<FrameTimeSummary> summaries = summarizeHeadlessFrames(frames);
+    file << "{\n";
+    file << "  \"renderer\": \"" << jsonEscape((const char *)glGetString(GL_RENDERER)) << "\",\n";
+    file << "  \"version\": \"" << jsonEscape((const char *)glGetString(GL_VERSION)) << "\",\n";
+    file << "  \"width\": " << settings.width << ",\n";
+    file << "  \"height\": " << settings.height << ",\n";
+    file << "  \"warmupFrames\": " << settings.warmupFrames << ",\n";
+    file << "  \"stressInstances\": " << settings.stressInstances << ",\n";
+    file << "  \"replay\": \"" << jsonEscape(settings.replayFile) << "\",\n";
+    file << "  \"mean\": {\"cpuMs\": " << summaries[0].mean << ", \"gpuMs\": " << summaries[1].mean << ", \"drawCalls\": " << drawCalls / count << ", \"triangles\": " << triangles / count << "},\n";
+    file << "  \"cpuMs\": " << jsonSummary(summaries[0]) << ",\n";
+    file << "  \"gpuMs\": " << jsonSummary(summaries[1]) << ",\n";
+    file << "  \"stageMs\": {";
+    for (unsigned int stage = 0; stage < FRAME_STAGE_COUNT; stage++) {
+        file << (stage == 0 ? "\n" : ",\n") << "    \"" << frameStageName(stage) << "\": " << jsonSummary(summaries[2 + stage]);
+    }
+    file << "\n  },\n";
+    file << "  \"frames\": [";
+    for (unsigned int i = 0; i < frames.size(); i++) {
+        const HeadlessFrame &frame = frames[i];
+        file << (i == 0 ? "\n" : ",\n");
+        file << "    {\"frame\": " << frame.frame << ", \"cpuMs\": " << frame.cpuMs << ", \"gpuMs\": " << frame.gpuMs << ", \"drawCalls\": " << frame.drawCalls << ", \"drawCommands\": " << frame.drawCommands << ", \"triangles\": " << frame.triangles << ", \"stageMs\": {";
+        for (unsigned int stage = 0; stage < FRAME_STAGE_COUNT; stage++) {
+            file << (stage == 0 ? "" : ", ") << "\"" << frameStageName(stage) << "\": " << frame.stageMs[stage];
+        }
+        file << "}}";
+    }
+    file << "\n  ]\n}\n";
+    return true;
+}
+
+#endif
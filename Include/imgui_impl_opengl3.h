@@ -36,6 +36,33 @@ IMGUI_IMPL_API void     ImGui_ImplOpenGL3_DestroyFontsTexture();
 IMGUI_IMPL_API bool     ImGui_ImplOpenGL3_CreateDeviceObjects();
 IMGUI_IMPL_API void     ImGui_ImplOpenGL3_DestroyDeviceObjects();
 
+// (Optional) Buffer ring for vertex/index uploads. Instead of one glBufferData() per draw list, every list of a frame is
+// written into one triple-buffered, fenced buffer and drawn with a base vertex offset. The buffer stays persistently mapped
+// on GL 4.4+ and is mapped with glMapBufferRange() each frame on GL 3.2+. Ignored on older GL and GL ES.
+IMGUI_IMPL_API void     ImGui_ImplOpenGL3_SetBufferRing(bool enabled);
+
+// (Optional) Command merging, on top of the buffer ring. Consecutive ImDrawCmd with the same texture are coalesced into one
+// draw, across draw lists too, when their scissor boxes match or when neither command's geometry reaches outside its box
+// (then the union of the boxes clips nothing either). Indices are rebased onto a shared base vertex as they are packed.
+// The rendered image is unchanged.
+IMGUI_IMPL_API void     ImGui_ImplOpenGL3_SetMergeCommands(bool enabled);
+
+// Counters for the last frame rendered
+struct ImGui_ImplOpenGL3_RenderStats
+{
+    int     Lists;          // Draw lists
+    int     Commands;       // ImDrawCmd in them, user callbacks included
+    int     DrawCalls;      // Draws issued for them
+    int     BufferCalls;    // glBufferData()/glMapBufferRange() calls spent uploading them
+    int     VtxBytes;
+    int     IdxBytes;
+    int     FenceWaits;     // Frames so far that had to wait for the GPU to finish with a ring region
+    bool    Ring;           // The frame went through the buffer ring
+    bool    Persistent;     // ... and the ring is persistently mapped
+    bool    Merged;         // ... and its commands were merged
+};
+IMGUI_IMPL_API ImGui_ImplOpenGL3_RenderStats ImGui_ImplOpenGL3_GetRenderStats();
+
 // Specific OpenGL ES versions
 //#define IMGUI_IMPL_OPENGL_ES2     // Auto-detected on Emscripten
 //#define IMGUI_IMPL_OPENGL_ES3     // Auto-detected on iOS/Android
@@ -0,0 +1,62 @@
+#ifndef instancing_hpp
+#define instancing_hpp
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <normalmatrix.hpp>
+
+// One instance's vertex attributes: the model matrix at locations 3-6 and
+// its precomputed normal matrix at 7-9.
+struct InstanceTransform {
+    glm::mat4 model;
+    glm::mat3 normal;
+};
+
+// Per-instance transforms for glDrawElementsInstanced. Every upload
+// orphans the previous storage, so the driver can hand out fresh memory
+// while earlier instanced draws still read the old contents. The buffer
+// name never changes, which keeps the instanced VAOs that point at it valid.
+class InstanceBuffer {
+public:
+    unsigned int ID;
+
+    InstanceBuffer(unsigned int initialCapacity = 1024) {
+        capacity = initialCapacity > 0 ? initialCapacity : 1;
+        glGenBuffers(1, &ID);
+        glBindBuffer(GL_ARRAY_BUFFER, ID);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceTransform), NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    InstanceBuffer(const InstanceBuffer &) = delete;
+    InstanceBuffer &operator=(const InstanceBuffer &) = delete;
+
+    // Replaces the contents with count model matrices and their normal
+    // matrices, growing if needed.
+    void upload(const glm::mat4 *transforms, unsigned int count) {
+        normals.resize(count);
+        normalMatrices(transforms, count, normals.data());
+        upload(transforms, normals.data(), count);
+    }
+    // Same, with the normal matrices already computed.
+    void upload(const glm::mat4 *transforms, const glm::mat3 *normals, unsigned int count) {
+        while (capacity < count) {
+            capacity *= 2;
+        }
+        staging.resize(count);
+        for (unsigned int i = 0; i < count; i++) {
+            staging[i].model = transforms[i];
+            staging[i].normal = normals[i];
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, ID);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceTransform), NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(InstanceTransform), staging.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+private:
+    unsigned int capacity;
+    std::vector<glm::mat3> normals;
+    std::vector<InstanceTransform> staging;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef jobsystem_hpp
+#define jobsystem_hpp
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed pool of worker threads for CPU work (parsing, vertex conversion,
+// image decoding) plus a queue of tasks that must run on the thread owning
+// the GL context. Workers hand finished CPU buffers to the main thread with
+// submitUpload(); the render loop drains that queue with processUploads().
+class JobSystem {
+public:
+    // threadCount 0 uses every core except the one running the render loop.
+    JobSystem(unsigned int threadCount = 0) {
+        if (threadCount == 0) {
+            unsigned int cores = std::thread::hardware_concurrency();
+            threadCount = cores > 1 ? cores - 1 : 1;
+        }
+        for (unsigned int i = 0; i < threadCount; i++) {
+            workers.push_back(std::thread(&JobSystem::workerLoop, this));
+        }
+    }
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            stopping = true;
+        }
+        jobReady.notify_all();
+        for (unsigned int i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    unsigned int threadCount() const {
+        return (unsigned int)workers.size();
+    }
+
+    void submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            jobs.push_back(std::move(job));
+            activeJobs++;
+        }
+        jobReady.notify_one();
+    }
+
+    void submitUpload(std::function<void()> task) {
+        std::lock_guard<std::mutex> lock(uploadMutex);
+        uploads.push_back(std::move(task));
+    }
+
+    // Runs queued main-thread tasks until the budget is spent. At least one
+    // task runs per call so a large upload can never stall loading forever.
+    void processUploads(double budgetMs) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        do {
+            std::function<void()> task;
+            {
+                std::lock_guard<std::mutex> lock(uploadMutex);
+                if (uploads.empty()) {
+                    return;
+                }
+                task = std::move(uploads.front());
+                uploads.pop_front();
+            }
+            task();
+        } while (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() < budgetMs);
+    }
+
+    // True once no worker job is queued or running and no upload is pending.
+    bool idle() {
+        std::lock_guard<std::mutex> lock(uploadMutex);
+        return activeJobs.load() == 0 && uploads.empty();
+    }
+
+    // Blocks until every worker job has finished. Pending uploads are left
+    // for the caller, since they can only run on the GL thread.
+    void waitForJobs() {
+        std::unique_lock<std::mutex> lock(jobMutex);
+        jobsDone.wait(lock, [this] { return activeJobs.load() == 0; });
+    }
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex jobMutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobsDone;
+    std::atomic<int> activeJobs{0};
+    bool stopping = false;
+
+    std::deque<std::function<void()>> uploads;
+    std::mutex uploadMutex;
+
+    void workerLoop() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(jobMutex);
+                jobReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty()) {
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+            {
+                std::lock_guard<std::mutex> lock(jobMutex);
+                activeJobs--;
+            }
+            jobsDone.notify_all();
+        }
+    }
+};
+
+#endif
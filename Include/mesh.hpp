@@ -6,86 +6,299 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
 #include <shader.hpp>
+#include <vertexformat.hpp>
+#include <culling.hpp>
+#include <instancing.hpp>
+#include <geometryarena.hpp>
 #include <stb_image.h>
 
-struct Vertex {
-    glm::vec3 position;
-    glm::vec3 normal;
-    glm::vec2 texCoord;
-};
-
 struct Tex {
     unsigned int id;
     std::string type;
     std::string path;
 };
 
+struct TexRef {
+    std::string type;
+    std::string path;
+};
+
+const unsigned int MAX_MESH_LODS = 4;
+// Texture unit every mesh samples the environment cubemap from.
+const unsigned int SKYBOX_TEXTURE_UNIT = 6;
+
+// One level of detail: a range of the mesh's index buffer drawn over the
+// shared vertex buffer. error is the simplifier's deviation relative to the
+// mesh's bounds diagonal (0 for the full-detail level).
+struct MeshLod {
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float error;
+};
+
+// CPU-side result of importing one mesh, built on a loader thread and turned
+// into a Mesh on the GL thread. indices holds every LOD back to back; an
+// empty lods list means a single level covering all of them.
+struct MeshData {
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<MeshLod> lods;
+    std::vector<TexRef> textures;
+};
+
+// What happens to a mesh's CPU-side geometry once it is on the GPU.
+enum Mesh_Residency {
+    KEEP_RESIDENT,
+    DISCARD_AFTER_UPLOAD,
+    RELOAD_ON_DEMAND
+};
+
 class Mesh {
 public:
     std::vector<Vertex> verticies;
     std::vector<Tex> textures;
     std::vector<unsigned int> indices;
     
-    Mesh(std::vector<Vertex> verticies, std::vector<Tex> textures, std::vector<unsigned int> indices) {
-        this->verticies = verticies;
-        this->indices = indices;
-        this->textures = textures;
-        
-        setupMesh();
+    // verticies/indices only hold a CPU copy when keepResident is set;
+    // otherwise the geometry lives on the GPU alone after setupMesh (see
+    // Mesh_Residency for how Model chooses).
+    Mesh(MeshData &&data, bool keepResident, Vertex_Format format = VERTEX_FLOAT) {
+        // Take the buffers either way, so a dropped copy is freed here rather
+        // than when the caller's MeshData goes.
+        MeshData local = std::move(data);
+        setupMesh(local.vertices.data(), (unsigned int)local.vertices.size(), local.indices.data(), (unsigned int)local.indices.size(), local.lods, format);
+        if (keepResident) {
+            this->verticies = std::move(local.vertices);
+            this->indices = std::move(local.indices);
+        }
     };
-    void Draw(Shader &shader, unsigned int skybox) {
-                unsigned int diffuseNr  = 1;
-                unsigned int specularNr = 1;
+    // Uploads straight from caller-owned memory (e.g. a mapped mesh cache).
+    Mesh(const Vertex *verticies, unsigned int vertexCount, const unsigned int *indices, unsigned int indexCount, const std::vector<MeshLod> &lods, bool keepResident, Vertex_Format format = VERTEX_FLOAT) {
+        setupMesh(verticies, vertexCount, indices, indexCount, lods, format);
+        if (keepResident) {
+            this->verticies.assign(verticies, verticies + vertexCount);
+            this->indices.assign(indices, indices + indexCount);
+        }
+    };
+    // Arena ranges are owned by exactly one Mesh, so meshes can only be moved.
+    Mesh(const Mesh &) = delete;
+    Mesh &operator=(const Mesh &) = delete;
+    Mesh(Mesh &&) = default;
+    Mesh &operator=(Mesh &&) = default;
+    
+    unsigned int getVertexCount() const {
+        return vertexCount;
+    }
+    unsigned int getIndexCount() const {
+        return indexCount;
+    }
+    Vertex_Format getVertexFormat() const {
+        return format;
+    }
+    unsigned int getLodCount() const {
+        return (unsigned int)lods.size();
+    }
+    // Levels past the last one the mesh has resolve to its coarsest level.
+    const MeshLod &getLod(unsigned int lod) const {
+        return lods[std::min(lod, (unsigned int)lods.size() - 1)];
+    }
+    // Object-space bounds of the vertex buffer.
+    const BoundingBox &getBounds() const {
+        return bounds;
+    }
+    const BoundingSphere &getBoundingSphere() const {
+        return sphere;
+    }
+    size_t gpuBytes() const {
+        return (size_t)vertexCount * vertexStride + (size_t)indexCount * indexSize;
+    }
+    size_t cpuBytes() const {
+        return verticies.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int);
+    }
+    // What the CPU copy takes while it is kept, whatever the GPU format.
+    size_t residentCpuBytes() const {
+        return (size_t)vertexCount * sizeof(Vertex) + (size_t)indexCount * sizeof(unsigned int);
+    }
+    bool hasGeometry() const {
+        return verticies.size() == vertexCount && indices.size() == indexCount;
+    }
+    void setGeometry(const Vertex *verticies, const unsigned int *indices) {
+        this->verticies.assign(verticies, verticies + vertexCount);
+        this->indices.assign(indices, indices + indexCount);
+    }
+    void releaseGeometry() {
+        std::vector<Vertex>().swap(verticies);
+        std::vector<unsigned int>().swap(indices);
+    }
+    
+    void Draw(Shader &shader, unsigned int skybox, unsigned int lod = 0) {
+                applyUniforms(shader);
                 for(unsigned int i = 0; i < textures.size(); i++)
                 {
-                    glActiveTexture(GL_TEXTURE0 + i);
-                    std::string number;
-                    std::string name = textures[i].type;
-                    if(name == "texture_diffuse")
-                        number = std::to_string(diffuseNr++);
-                    else if(name == "texture_specular")
-                        number = std::to_string(specularNr++);
-                    glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-                    glBindTexture(GL_TEXTURE_2D, textures[i].id);
+                    glState().bindTexture(i, GL_TEXTURE_2D, textures[i].id);
                 }
-                glBindVertexArray(VAO);
-                glActiveTexture(GL_TEXTURE6);
-                glUniform1i(glGetUniformLocation(shader.ID, "skybox"), 6);
-                glBindTexture(GL_TEXTURE_CUBE_MAP, skybox);
-                glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-                glBindVertexArray(0);
-
-                glActiveTexture(GL_TEXTURE0);
+                glState().bindVertexArray(getVAO());
+                glState().bindTexture(SKYBOX_TEXTURE_UNIT, GL_TEXTURE_CUBE_MAP, skybox);
+                drawElements(lod);
     };
+    
+    // The parts of Draw, for callers that track bound state themselves
+    // (see RenderQueue). Texture i goes to unit i, the skybox to
+    // SKYBOX_TEXTURE_UNIT.
+    void applyUniforms(Shader &shader, bool instanced = false) {
+        if (shader.ID != samplerProgram) {
+            cacheSamplerLocations(shader);
+        }
+        for(unsigned int i = 0; i < textures.size(); i++) {
+            shader.set(samplerLocations[i], (int)i);
+        }
+        shader.set(skyboxLocation, (int)SKYBOX_TEXTURE_UNIT);
+        shader.set(positionOffsetLocation, quantization.positionOffset);
+        shader.set(positionScaleLocation, quantization.positionScale);
+        shader.set(uvOffsetLocation, quantization.uvOffset);
+        shader.set(uvScaleLocation, quantization.uvScale);
+        shader.set(octahedralNormalsLocation, quantization.octahedralNormals);
+        shader.set(instancedLocation, instanced);
+    }
+    // Shared by every mesh with the same vertex format (see GeometryArena).
+    unsigned int getVAO() const {
+        return geometryArena().vertexArray(format);
+    }
+    GLenum getIndexType() const {
+        return indexType;
+    }
+    const VertexQuantization &getQuantization() const {
+        return quantization;
+    }
+    // Expects this mesh's VAO to be bound.
+    void drawElements(unsigned int lod) const {
+        const MeshLod &level = getLod(lod);
+        glDrawElementsBaseVertex(GL_TRIANGLES, level.indexCount, indexType, (void*)(allocation.indexOffset + (size_t)level.indexOffset * indexSize), allocation.baseVertex);
+    }
+    // The same draw as an indirect command; baseInstance selects the
+    // instance data it reads.
+    DrawElementsIndirectCommand indirectCommand(unsigned int lod, unsigned int baseInstance) const {
+        const MeshLod &level = getLod(lod);
+        DrawElementsIndirectCommand command;
+        command.count = level.indexCount;
+        command.instanceCount = 1;
+        command.firstIndex = allocation.indexOffset / indexSize + level.indexOffset;
+        command.baseVertex = (int32_t)allocation.baseVertex;
+        command.baseInstance = baseInstance;
+        return command;
+    }
+    
+    // Draws instanceCount copies, each with the model matrix at the same
+    // index in instanceBuffer (see InstanceBuffer).
+    void DrawInstanced(Shader &shader, unsigned int skybox, unsigned int lod, unsigned int instanceBuffer, unsigned int instanceCount) {
+        applyUniforms(shader, true);
+        for(unsigned int i = 0; i < textures.size(); i++) {
+            glState().bindTexture(i, GL_TEXTURE_2D, textures[i].id);
+        }
+        glState().bindVertexArray(geometryArena().instanceVertexArray(format, instanceBuffer));
+        glState().bindTexture(SKYBOX_TEXTURE_UNIT, GL_TEXTURE_CUBE_MAP, skybox);
+        const MeshLod &level = getLod(lod);
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, level.indexCount, indexType, (void*)(allocation.indexOffset + (size_t)level.indexOffset * indexSize), instanceCount, allocation.baseVertex);
+    }
 private:
-    unsigned int VAO, VBO, EBO;
+    ArenaAllocation allocation;
+    unsigned int vertexCount;
+    unsigned int indexCount;
+    unsigned int vertexStride;
+    GLenum indexType;
+    unsigned int indexSize;
+    Vertex_Format format;
+    VertexQuantization quantization;
+    std::vector<MeshLod> lods;
+    BoundingBox bounds;
+    BoundingSphere sphere;
+    unsigned int samplerProgram = 0;
+    std::vector<int> samplerLocations;
+    int skyboxLocation = -1;
+    int positionOffsetLocation = -1, positionScaleLocation = -1;
+    int uvOffsetLocation = -1, uvScaleLocation = -1;
+    int octahedralNormalsLocation = -1;
+    int instancedLocation = -1;
     
-    void setupMesh() {
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-          
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-        glBufferData(GL_ARRAY_BUFFER, verticies.size() * sizeof(Vertex), &verticies[0], GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        //Vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+    // Sampler names only depend on the texture list, so they are resolved
+    // once per program instead of being rebuilt as strings on every draw.
+    void cacheSamplerLocations(Shader &shader) {
+        unsigned int diffuseNr  = 1;
+        unsigned int specularNr = 1;
+        samplerLocations.resize(textures.size());
+        for(unsigned int i = 0; i < textures.size(); i++)
+        {
+            std::string number;
+            std::string name = textures[i].type;
+            if(name == "texture_diffuse")
+                number = std::to_string(diffuseNr++);
+            else if(name == "texture_specular")
+                number = std::to_string(specularNr++);
+            samplerLocations[i] = shader.uniform(name + number);
+        }
+        skyboxLocation = shader.uniform("skybox");
+        positionOffsetLocation = shader.uniform("positionOffset");
+        positionScaleLocation = shader.uniform("positionScale");
+        uvOffsetLocation = shader.uniform("uvOffset");
+        uvScaleLocation = shader.uniform("uvScale");
+        octahedralNormalsLocation = shader.uniform("octahedralNormals");
+        instancedLocation = shader.uniform("instanced");
+        samplerProgram = shader.ID;
+    }
+    
+    void setupMesh(const Vertex *verticies, unsigned int vertexCount, const unsigned int *indices, unsigned int indexCount, const std::vector<MeshLod> &lods, Vertex_Format format) {
+        this->vertexCount = vertexCount;
+        this->indexCount = indexCount;
+        this->quantization = identityQuantization();
+        this->lods = lods;
+        if (this->lods.empty()) {
+            MeshLod full = {0, indexCount, 0.0f};
+            this->lods.push_back(full);
+        }
+        bounds.min = bounds.max = vertexCount > 0 ? verticies[0].position : glm::vec3(0.0f);
+        for (unsigned int i = 1; i < vertexCount; i++) {
+            bounds.min = glm::min(bounds.min, verticies[i].position);
+            bounds.max = glm::max(bounds.max, verticies[i].position);
+        }
+        // Centred on the box, but sized by the farthest vertex rather than
+        // the box corner.
+        sphere.center = (bounds.min + bounds.max) * 0.5f;
+        float radiusSquared = 0.0f;
+        for (unsigned int i = 0; i < vertexCount; i++) {
+            glm::vec3 offset = verticies[i].position - sphere.center;
+            radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+        }
+        sphere.radius = std::sqrt(radiusSquared);
         
-        //Vertex Normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+        std::vector<CompactVertex> compact;
+        if (format != VERTEX_FLOAT) {
+            QuantizationError error = quantizeVertices(verticies, vertexCount, format, compact, quantization);
+            if (!withinTolerance(error)) {
+                std::cout << "WARNING::MESH::QUANTIZATION_ERROR position " << error.position << " normal " << error.normal
+                          << " uv " << error.texCoord << ", keeping float vertices" << std::endl;
+                format = VERTEX_FLOAT;
+                quantization = identityQuantization();
+            }
+        }
+        this->format = format;
+        this->vertexStride = format == VERTEX_FLOAT ? sizeof(Vertex) : sizeof(CompactVertex);
         
-        // Texture Coordinates
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
-
-        glBindVertexArray(0);
+        // Anything that fits in 16 bits gets half-size indices; the CPU side
+        // and the mesh cache always keep 32-bit ones. Base vertices keep
+        // them mesh-relative inside the shared arena.
+        std::vector<unsigned short> shortIndices;
+        const void *indexData = indices;
+        if (vertexCount <= 65536) {
+            shortIndices.assign(indices, indices + indexCount);
+            indexType = GL_UNSIGNED_SHORT;
+            indexSize = sizeof(unsigned short);
+            indexData = shortIndices.data();
+        } else {
+            indexType = GL_UNSIGNED_INT;
+            indexSize = sizeof(unsigned int);
+        }
+        const void *vertexData = format == VERTEX_FLOAT ? (const void *)verticies : (const void *)compact.data();
+        geometryArena().allocate(format, vertexData, vertexCount, indexData, indexCount * indexSize, allocation);
     };
 };
 
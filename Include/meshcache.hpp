@@ -0,0 +1,277 @@
+#ifndef meshcache_hpp
+#define meshcache_hpp
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mesh.hpp>
+
+// Layout of a .meshcache file, all fields little endian and 4-byte aligned:
+//   MeshCacheHeader, source path (padded)
+//   per mesh: MeshCacheRecord, texture refs (type, path; each padded),
+//             LOD table (MeshLod[lodCount]), vertex blob (Vertex[vertexCount]),
+//             index blob (uint32[indexCount], every LOD back to back)
+// Bump the version whenever Vertex, the record layout or the import-time
+// processing (see meshoptimize.hpp) changes.
+const uint32_t MESH_CACHE_VERSION = 4;
+
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t sourceMtime; // sourceRevision(), materials included
+    uint32_t importFlags;
+    uint32_t processFlags;
+    uint32_t vertexSize;
+    uint32_t meshCount;
+    uint32_t pathLength;
+    uint32_t reserved;
+};
+
+struct MeshCacheRecord {
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t textureCount;
+    uint32_t lodCount;
+};
+
+// A mesh as stored in the cache. The geometry pointers reference the mapped
+// file and stay valid for as long as the MappedFile they came from.
+struct MeshBlob {
+    const Vertex *vertices;
+    uint32_t vertexCount;
+    const unsigned int *indices;
+    uint32_t indexCount;
+    std::vector<MeshLod> lods;
+    std::vector<TexRef> textures;
+};
+
+class MappedFile {
+public:
+    const unsigned char *data = NULL;
+    size_t size = 0;
+
+    MappedFile(const std::string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void *mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                data = (const unsigned char *)mapping;
+                size = info.st_size;
+            }
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if (data) {
+            munmap((void *)data, size);
+        }
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+};
+
+inline std::string meshCachePath(const std::string &sourcePath) {
+    return sourcePath + ".meshcache";
+}
+
+inline int64_t sourceModifiedTime(const std::string &sourcePath) {
+    struct stat info;
+    if (stat(sourcePath.c_str(), &info) != 0) {
+        return -1;
+    }
+    return (int64_t)info.st_mtime;
+}
+
+// The source file's modification time folded together with those of the
+// material libraries an OBJ file names, so editing a material or one of its
+// texture references invalidates the cache too. Only the lines before the
+// first face are searched, which is where exporters write mtllib.
+inline int64_t sourceRevision(const std::string &sourcePath) {
+    uint64_t revision = (uint64_t)sourceModifiedTime(sourcePath);
+    std::string extension = sourcePath.substr(sourcePath.find_last_of('.') + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension != "obj") {
+        return (int64_t)revision;
+    }
+    std::string directory = sourcePath.substr(0, sourcePath.find_last_of('/') + 1);
+    std::ifstream source(sourcePath.c_str());
+    std::string line;
+    while (std::getline(source, line) && line.compare(0, 2, "f ") != 0) {
+        if (line.compare(0, 7, "mtllib ") != 0) {
+            continue;
+        }
+        size_t first = line.find_first_not_of(" \t", 7);
+        size_t last = line.find_last_not_of(" \t\r");
+        if (first == std::string::npos || last < first) {
+            continue;
+        }
+        revision = revision * 1000003u + (uint64_t)sourceModifiedTime(directory + line.substr(first, last - first + 1));
+    }
+    return (int64_t)revision;
+}
+
+// Parses a mapped cache file. Returns false if it is missing, truncated or
+// was written for a different source file, source revision, Assimp import
+// flags or post-import processing (ModelSettings::processFlags).
+inline bool readMeshCache(const MappedFile &file, const std::string &sourcePath, unsigned int importFlags, unsigned int processFlags, std::vector<MeshBlob> &blobs) {
+    if (!file.data || file.size < sizeof(MeshCacheHeader)) {
+        return false;
+    }
+    MeshCacheHeader header;
+    std::memcpy(&header, file.data, sizeof(header));
+    if (std::memcmp(header.magic, "LOGM", 4) != 0 ||
+        header.version != MESH_CACHE_VERSION ||
+        header.vertexSize != sizeof(Vertex) ||
+        header.importFlags != importFlags ||
+        header.processFlags != processFlags ||
+        header.sourceMtime != sourceRevision(sourcePath)) {
+        return false;
+    }
+
+    size_t offset = sizeof(header);
+    // Each read checks the remaining size first so a truncated file is
+    // rejected instead of read past its end.
+    auto readString = [&](uint32_t length, std::string &out) {
+        size_t padded = (length + 3) & ~(size_t)3;
+        if (offset + padded > file.size) {
+            return false;
+        }
+        out.assign((const char *)file.data + offset, length);
+        offset += padded;
+        return true;
+    };
+    auto readU32 = [&](uint32_t &out) {
+        if (offset + sizeof(uint32_t) > file.size) {
+            return false;
+        }
+        std::memcpy(&out, file.data + offset, sizeof(uint32_t));
+        offset += sizeof(uint32_t);
+        return true;
+    };
+
+    std::string storedPath;
+    if (!readString(header.pathLength, storedPath) || storedPath != sourcePath) {
+        return false;
+    }
+
+    blobs.clear();
+    blobs.reserve(header.meshCount);
+    for (uint32_t i = 0; i < header.meshCount; i++) {
+        MeshCacheRecord record;
+        if (offset + sizeof(record) > file.size) {
+            return false;
+        }
+        std::memcpy(&record, file.data + offset, sizeof(record));
+        offset += sizeof(record);
+
+        MeshBlob blob;
+        blob.textures.resize(record.textureCount);
+        for (uint32_t t = 0; t < record.textureCount; t++) {
+            uint32_t length;
+            if (!readU32(length) || !readString(length, blob.textures[t].type)) {
+                return false;
+            }
+            if (!readU32(length) || !readString(length, blob.textures[t].path)) {
+                return false;
+            }
+        }
+
+        size_t lodBytes = (size_t)record.lodCount * sizeof(MeshLod);
+        if (offset + lodBytes > file.size) {
+            return false;
+        }
+        blob.lods.resize(record.lodCount);
+        if (lodBytes > 0) {
+            std::memcpy(&blob.lods[0], file.data + offset, lodBytes);
+        }
+        offset += lodBytes;
+
+        size_t vertexBytes = (size_t)record.vertexCount * sizeof(Vertex);
+        size_t indexBytes = (size_t)record.indexCount * sizeof(unsigned int);
+        if (offset + vertexBytes + indexBytes > file.size) {
+            return false;
+        }
+        blob.vertices = (const Vertex *)(file.data + offset);
+        blob.vertexCount = record.vertexCount;
+        offset += vertexBytes;
+        blob.indices = (const unsigned int *)(file.data + offset);
+        blob.indexCount = record.indexCount;
+        offset += indexBytes;
+        blobs.push_back(blob);
+    }
+    return true;
+}
+
+// Writes through a temporary file and renames it into place, so a crash
+// mid-write never leaves a cache that passes validation.
+inline bool writeMeshCache(const std::string &sourcePath, unsigned int importFlags, unsigned int processFlags, const std::vector<MeshBlob> &blobs) {
+    std::string path = meshCachePath(sourcePath);
+    std::string tempPath = path + ".tmp";
+    std::ofstream out(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cout << "ERROR::MESHCACHE::COULD_NOT_WRITE " << path << std::endl;
+        return false;
+    }
+    const char zeros[4] = {0, 0, 0, 0};
+    auto writeString = [&](const std::string &value) {
+        out.write(value.data(), value.size());
+        out.write(zeros, ((value.size() + 3) & ~(size_t)3) - value.size());
+    };
+
+    MeshCacheHeader header;
+    std::memcpy(header.magic, "LOGM", 4);
+    header.version = MESH_CACHE_VERSION;
+    header.sourceMtime = sourceRevision(sourcePath);
+    header.importFlags = importFlags;
+    header.processFlags = processFlags;
+    header.vertexSize = sizeof(Vertex);
+    header.meshCount = (uint32_t)blobs.size();
+    header.pathLength = (uint32_t)sourcePath.size();
+    header.reserved = 0;
+    out.write((const char *)&header, sizeof(header));
+    writeString(sourcePath);
+
+    for (size_t i = 0; i < blobs.size(); i++) {
+        const MeshBlob &blob = blobs[i];
+        MeshCacheRecord record;
+        record.vertexCount = blob.vertexCount;
+        record.indexCount = blob.indexCount;
+        record.textureCount = (uint32_t)blob.textures.size();
+        record.lodCount = (uint32_t)blob.lods.size();
+        out.write((const char *)&record, sizeof(record));
+        for (size_t t = 0; t < blob.textures.size(); t++) {
+            uint32_t length = (uint32_t)blob.textures[t].type.size();
+            out.write((const char *)&length, sizeof(length));
+            writeString(blob.textures[t].type);
+            length = (uint32_t)blob.textures[t].path.size();
+            out.write((const char *)&length, sizeof(length));
+            writeString(blob.textures[t].path);
+        }
+        out.write((const char *)blob.lods.data(), blob.lods.size() * sizeof(MeshLod));
+        out.write((const char *)blob.vertices, (size_t)blob.vertexCount * sizeof(Vertex));
+        out.write((const char *)blob.indices, (size_t)blob.indexCount * sizeof(unsigned int));
+    }
+    out.close();
+    if (!out || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        std::cout << "ERROR::MESHCACHE::COULD_NOT_WRITE " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,355 @@
+#ifndef meshoptimize_hpp
+#define meshoptimize_hpp
+
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <string>
+#include <glm/glm.hpp>
+#include <vertexformat.hpp>
+
+// Import-time index and vertex reordering:
+//   weldVertices         merge bit-identical vertices
+//   optimizeVertexCache  Tipsify (Sander, Nehab, Barczak 2007) for the
+//                        post-transform cache, which also yields clusters
+//   optimizeOverdraw     order those clusters outside-in
+//   optimizeVertexFetch  store vertices in first-use order
+// Every pass is measured with a simulated FIFO post-transform cache.
+
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+struct CacheStats {
+    float acmr; // transformed vertices per triangle, 0.5 is ideal and 3.0 worst
+    float atvr; // transformed vertices per referenced vertex, 1.0 is ideal
+};
+
+struct OptimizationPass {
+    const char *name;
+    CacheStats before;
+    CacheStats after;
+};
+
+inline CacheStats analyzeVertexCache(const std::vector<unsigned int> &indices, unsigned int vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE) {
+    CacheStats stats = {0.0f, 0.0f};
+    if (indices.empty()) {
+        return stats;
+    }
+    // A vertex is in the FIFO if it was pushed within the last cacheSize misses.
+    std::vector<unsigned int> pushedAt(vertexCount, 0);
+    std::vector<char> referenced(vertexCount, 0);
+    unsigned int misses = 0, unique = 0;
+    for (size_t i = 0; i < indices.size(); i++) {
+        unsigned int v = indices[i];
+        if (!referenced[v]) {
+            referenced[v] = 1;
+            unique++;
+        }
+        if (pushedAt[v] == 0 || misses + 1 - pushedAt[v] > cacheSize) {
+            misses++;
+            pushedAt[v] = misses;
+        }
+    }
+    stats.acmr = (float)misses / (float)(indices.size() / 3);
+    stats.atvr = (float)misses / (float)unique;
+    return stats;
+}
+
+struct VertexHash {
+    size_t operator()(const Vertex &v) const {
+        unsigned int words[sizeof(Vertex) / 4];
+        std::memcpy(words, &v, sizeof(Vertex));
+        size_t h = 2166136261u;
+        for (unsigned int i = 0; i < sizeof(Vertex) / 4; i++) {
+            h = (h ^ words[i]) * 16777619u;
+        }
+        return h;
+    }
+};
+struct VertexEqual {
+    bool operator()(const Vertex &a, const Vertex &b) const {
+        return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+    }
+};
+
+// Formats like OBJ index positions, normals and UVs separately, so Assimp
+// hands back one vertex per face corner. Collapsing identical ones is what
+// gives the post-transform cache something to reuse.
+inline void weldVertices(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices) {
+    std::unordered_map<Vertex, unsigned int, VertexHash, VertexEqual> unique;
+    unique.reserve(vertices.size());
+    std::vector<unsigned int> remap(vertices.size());
+    std::vector<Vertex> welded;
+    welded.reserve(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        std::pair<std::unordered_map<Vertex, unsigned int, VertexHash, VertexEqual>::iterator, bool> inserted =
+            unique.insert(std::make_pair(vertices[i], (unsigned int)welded.size()));
+        if (inserted.second) {
+            welded.push_back(vertices[i]);
+        }
+        remap[i] = inserted.first->second;
+    }
+    for (size_t i = 0; i < indices.size(); i++) {
+        indices[i] = remap[indices[i]];
+    }
+    vertices.swap(welded);
+}
+
+// Reorders triangles for a cache of cacheSize entries. clusters receives the
+// first triangle of every run that starts after a dead end (a cache miss
+// either way); those runs can be reordered without hurting the cache much.
+inline void optimizeVertexCache(std::vector<unsigned int> &indices, unsigned int vertexCount, std::vector<unsigned int> &clusters, unsigned int cacheSize = VERTEX_CACHE_SIZE) {
+    clusters.clear();
+    unsigned int triangleCount = (unsigned int)(indices.size() / 3);
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // vertex -> triangle adjacency in CSR form
+    std::vector<unsigned int> liveTriangles(vertexCount, 0);
+    for (size_t i = 0; i < indices.size(); i++) {
+        liveTriangles[indices[i]]++;
+    }
+    std::vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (unsigned int v = 0; v < vertexCount; v++) {
+        offsets[v + 1] = offsets[v] + liveTriangles[v];
+    }
+    std::vector<unsigned int> adjacency(indices.size());
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (unsigned int t = 0; t < triangleCount; t++) {
+        for (unsigned int k = 0; k < 3; k++) {
+            adjacency[fill[indices[t * 3 + k]]++] = t;
+        }
+    }
+
+    std::vector<unsigned int> cacheTime(vertexCount, 0);
+    std::vector<char> emitted(triangleCount, 0);
+    std::vector<unsigned int> deadEnd;
+    std::vector<unsigned int> candidates;
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+    unsigned int timestamp = cacheSize + 1;
+    unsigned int cursor = 0;
+    int fanning = 0;
+    bool restarted = true;
+
+    while (fanning >= 0) {
+        if (restarted) {
+            clusters.push_back((unsigned int)(output.size() / 3));
+            restarted = false;
+        }
+        candidates.clear();
+        for (unsigned int a = offsets[fanning]; a < offsets[fanning + 1]; a++) {
+            unsigned int t = adjacency[a];
+            if (emitted[t]) {
+                continue;
+            }
+            for (unsigned int k = 0; k < 3; k++) {
+                unsigned int v = indices[t * 3 + k];
+                output.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (timestamp - cacheTime[v] > cacheSize) {
+                    cacheTime[v] = timestamp++;
+                }
+            }
+            emitted[t] = 1;
+        }
+
+        // Prefer the candidate that will still be in cache once its
+        // remaining triangles are emitted, and among those the oldest. The
+        // others score 0 and never win; if none is left the fan restarts
+        // from the dead-end stack.
+        int next = -1, best = 0;
+        for (size_t c = 0; c < candidates.size(); c++) {
+            unsigned int v = candidates[c];
+            if (liveTriangles[v] == 0) {
+                continue;
+            }
+            int priority = 0;
+            if (timestamp - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+                priority = (int)(timestamp - cacheTime[v]);
+            }
+            if (priority > best) {
+                best = priority;
+                next = (int)v;
+            }
+        }
+        if (next == -1) {
+            while (!deadEnd.empty() && next == -1) {
+                unsigned int v = deadEnd.back();
+                deadEnd.pop_back();
+                if (liveTriangles[v] > 0) {
+                    next = (int)v;
+                    restarted = true;
+                }
+            }
+        }
+        if (next == -1) {
+            while (cursor < vertexCount && liveTriangles[cursor] == 0) {
+                cursor++;
+            }
+            if (cursor < vertexCount) {
+                next = (int)cursor;
+                restarted = true;
+            }
+        }
+        fanning = next;
+    }
+    indices.swap(output);
+}
+
+// Sander et al.'s linear-time overdraw pass: clusters facing away from the
+// mesh centre are likely to occlude the rest, so they are drawn first.
+inline void optimizeOverdraw(std::vector<unsigned int> &indices, const std::vector<Vertex> &vertices, const std::vector<unsigned int> &clusters) {
+    unsigned int triangleCount = (unsigned int)(indices.size() / 3);
+    if (clusters.size() < 2) {
+        return;
+    }
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    std::vector<glm::vec3> clusterCentroid(clusters.size(), glm::vec3(0.0f));
+    std::vector<glm::vec3> clusterNormal(clusters.size(), glm::vec3(0.0f));
+    std::vector<float> clusterArea(clusters.size(), 0.0f);
+    for (size_t c = 0; c < clusters.size(); c++) {
+        unsigned int end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+        for (unsigned int t = clusters[c]; t < end; t++) {
+            const glm::vec3 &p0 = vertices[indices[t * 3 + 0]].position;
+            const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].position;
+            const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].position;
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float area = glm::length(n) * 0.5f;
+            glm::vec3 centroid = (p0 + p1 + p2) / 3.0f;
+            clusterCentroid[c] += centroid * area;
+            clusterNormal[c] += n;
+            clusterArea[c] += area;
+        }
+        meshCentroid += clusterCentroid[c];
+        meshArea += clusterArea[c];
+    }
+    if (meshArea > 0.0f) {
+        meshCentroid /= meshArea;
+    }
+
+    std::vector<float> sortKey(clusters.size());
+    std::vector<unsigned int> order(clusters.size());
+    for (size_t c = 0; c < clusters.size(); c++) {
+        glm::vec3 centroid = clusterArea[c] > 0.0f ? clusterCentroid[c] / clusterArea[c] : clusterCentroid[c];
+        float length = glm::length(clusterNormal[c]);
+        glm::vec3 normal = length > 0.0f ? clusterNormal[c] / length : glm::vec3(0.0f);
+        sortKey[c] = glm::dot(centroid - meshCentroid, normal);
+        order[c] = (unsigned int)c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+        return sortKey[a] > sortKey[b];
+    });
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+    for (size_t o = 0; o < order.size(); o++) {
+        unsigned int c = order[o];
+        unsigned int end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+        output.insert(output.end(), indices.begin() + clusters[c] * 3, indices.begin() + end * 3);
+    }
+    indices.swap(output);
+}
+
+// Renumbers vertices in the order the index buffer first touches them, so
+// the vertex fetch walks memory mostly forwards. Unused vertices are dropped.
+inline void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices) {
+    const unsigned int unused = 0xffffffffu;
+    std::vector<unsigned int> remap(vertices.size(), unused);
+    std::vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+        unsigned int &target = remap[indices[i]];
+        if (target == unused) {
+            target = (unsigned int)ordered.size();
+            ordered.push_back(vertices[indices[i]]);
+        }
+        indices[i] = target;
+    }
+    vertices.swap(ordered);
+}
+
+struct MeshPart {
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+};
+
+// Cuts a triangle list into parts of at most maxVertices vertices each, in
+// triangle order, so already optimized meshes keep their locality and every
+// part can be drawn with 16-bit indices. Vertices on a cut are duplicated.
+inline std::vector<MeshPart> splitForShortIndices(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices, unsigned int maxVertices = 65536) {
+    std::vector<MeshPart> parts;
+    const unsigned int unused = 0xffffffffu;
+    std::vector<unsigned int> remap(vertices.size(), unused);
+    std::vector<unsigned int> touched;
+    MeshPart part;
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        unsigned int added = 0;
+        for (unsigned int k = 0; k < 3; k++) {
+            added += remap[indices[t + k]] == unused ? 1 : 0;
+        }
+        if (part.vertices.size() + added > maxVertices) {
+            parts.push_back(std::move(part));
+            part = MeshPart();
+            for (size_t i = 0; i < touched.size(); i++) {
+                remap[touched[i]] = unused;
+            }
+            touched.clear();
+        }
+        for (unsigned int k = 0; k < 3; k++) {
+            unsigned int v = indices[t + k];
+            if (remap[v] == unused) {
+                remap[v] = (unsigned int)part.vertices.size();
+                part.vertices.push_back(vertices[v]);
+                touched.push_back(v);
+            }
+            part.indices.push_back(remap[v]);
+        }
+    }
+    if (!part.indices.empty()) {
+        parts.push_back(std::move(part));
+    }
+    return parts;
+}
+
+// Runs every pass in order on a triangle list and records the cache stats
+// around each one.
+inline std::vector<OptimizationPass> optimizeMesh(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices) {
+    std::vector<OptimizationPass> passes;
+    if (indices.size() < 3 || indices.size() % 3 != 0) {
+        return passes;
+    }
+    OptimizationPass pass;
+
+    pass.name = "weld";
+    pass.before = analyzeVertexCache(indices, (unsigned int)vertices.size());
+    weldVertices(vertices, indices);
+    pass.after = analyzeVertexCache(indices, (unsigned int)vertices.size());
+    passes.push_back(pass);
+
+    std::vector<unsigned int> clusters;
+    pass.name = "vertex cache";
+    pass.before = pass.after;
+    optimizeVertexCache(indices, (unsigned int)vertices.size(), clusters);
+    pass.after = analyzeVertexCache(indices, (unsigned int)vertices.size());
+    passes.push_back(pass);
+
+    pass.name = "overdraw";
+    pass.before = pass.after;
+    optimizeOverdraw(indices, vertices, clusters);
+    pass.after = analyzeVertexCache(indices, (unsigned int)vertices.size());
+    passes.push_back(pass);
+
+    pass.name = "vertex fetch";
+    pass.before = pass.after;
+    optimizeVertexFetch(vertices, indices);
+    pass.after = analyzeVertexCache(indices, (unsigned int)vertices.size());
+    passes.push_back(pass);
+    return passes;
+}
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef meshsimplify_hpp
+#define meshsimplify_hpp
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <unordered_set>
+#include <glm/glm.hpp>
+#include <vertexformat.hpp>
+
+// Import-time mesh simplification with quadric error metrics (Garland and
+// Heckbert 1997). Edges are collapsed onto one of their existing vertices,
+// so every level indexes the original vertex buffer and LODs only cost
+// index memory. Vertices on open borders and on UV/normal seams (which are
+// borders in index space) are never moved.
+
+// Symmetric 4x4 error quadric, upper triangle row by row. Planes are
+// weighted by triangle area; weight keeps the total so errors come out as
+// squared distances.
+struct Quadric {
+    double a[10];
+    double weight;
+};
+
+inline Quadric planeQuadric(const glm::dvec3 &n, double d, double weight) {
+    Quadric q;
+    q.a[0] = n.x * n.x * weight; q.a[1] = n.x * n.y * weight; q.a[2] = n.x * n.z * weight; q.a[3] = n.x * d * weight;
+    q.a[4] = n.y * n.y * weight; q.a[5] = n.y * n.z * weight; q.a[6] = n.y * d * weight;
+    q.a[7] = n.z * n.z * weight; q.a[8] = n.z * d * weight;
+    q.a[9] = d * d * weight;
+    q.weight = weight;
+    return q;
+}
+
+inline void addQuadric(Quadric &q, const Quadric &other) {
+    for (unsigned int i = 0; i < 10; i++) {
+        q.a[i] += other.a[i];
+    }
+    q.weight += other.weight;
+}
+
+// Mean squared distance of p from the planes in q.
+inline double quadricError(const Quadric &q, const glm::vec3 &p) {
+    double x = p.x, y = p.y, z = p.z;
+    double error = q.a[0] * x * x + 2.0 * q.a[1] * x * y + 2.0 * q.a[2] * x * z + 2.0 * q.a[3] * x
+                 + q.a[4] * y * y + 2.0 * q.a[5] * y * z + 2.0 * q.a[6] * y
+                 + q.a[7] * z * z + 2.0 * q.a[8] * z
+                 + q.a[9];
+    return q.weight > 0.0 ? std::fabs(error) / q.weight : 0.0;
+}
+
+struct EdgeCollapse {
+    unsigned int from;
+    unsigned int to;
+    double cost;
+};
+
+// Reduces a triangle list towards targetIndexCount without moving any
+// surface further than maxError (relative to the bounds diagonal). Returns
+// the new index list; resultError receives the largest error introduced.
+inline std::vector<unsigned int> simplifyMesh(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices, size_t targetIndexCount, float maxError, float *resultError = NULL) {
+    std::vector<unsigned int> result(indices);
+    unsigned int vertexCount = (unsigned int)vertices.size();
+    if (resultError) {
+        *resultError = 0.0f;
+    }
+    if (result.size() < 3 || vertexCount == 0) {
+        return result;
+    }
+
+    glm::vec3 minPosition = vertices[0].position, maxPosition = vertices[0].position;
+    for (unsigned int v = 1; v < vertexCount; v++) {
+        minPosition = glm::min(minPosition, vertices[v].position);
+        maxPosition = glm::max(maxPosition, vertices[v].position);
+    }
+    double diagonal = glm::length(maxPosition - minPosition);
+    if (diagonal <= 0.0) {
+        return result;
+    }
+    double costLimit = (double)maxError * diagonal * (double)maxError * diagonal;
+
+    // A directed edge without its twin is a border.
+    std::unordered_set<unsigned long long> edges;
+    edges.reserve(result.size());
+    for (size_t t = 0; t < result.size(); t += 3) {
+        for (unsigned int k = 0; k < 3; k++) {
+            unsigned long long a = result[t + k], b = result[t + (k + 1) % 3];
+            edges.insert(a << 32 | b);
+        }
+    }
+    std::vector<char> locked(vertexCount, 0);
+    for (size_t t = 0; t < result.size(); t += 3) {
+        for (unsigned int k = 0; k < 3; k++) {
+            unsigned long long a = result[t + k], b = result[t + (k + 1) % 3];
+            if (edges.find(b << 32 | a) == edges.end()) {
+                locked[a] = 1;
+                locked[b] = 1;
+            }
+        }
+    }
+
+    std::vector<Quadric> quadrics(vertexCount);
+    for (unsigned int v = 0; v < vertexCount; v++) {
+        std::fill(quadrics[v].a, quadrics[v].a + 10, 0.0);
+        quadrics[v].weight = 0.0;
+    }
+    for (size_t t = 0; t < result.size(); t += 3) {
+        glm::dvec3 p0(vertices[result[t + 0]].position);
+        glm::dvec3 p1(vertices[result[t + 1]].position);
+        glm::dvec3 p2(vertices[result[t + 2]].position);
+        glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+        double length = glm::length(n);
+        if (length <= 0.0) {
+            continue;
+        }
+        n /= length;
+        Quadric q = planeQuadric(n, -glm::dot(n, p0), length * 0.5);
+        for (unsigned int k = 0; k < 3; k++) {
+            addQuadric(quadrics[result[t + k]], q);
+        }
+    }
+
+    std::vector<unsigned int> collapseTo(vertexCount);
+    std::vector<char> touched(vertexCount);
+    std::vector<unsigned int> offsets(vertexCount + 1);
+    std::vector<unsigned int> adjacency;
+    std::vector<EdgeCollapse> collapses;
+    double worstCost = 0.0;
+
+    // Each pass collapses the cheapest independent edges, then rewrites the
+    // index list, until the target is met or every edge costs too much.
+    while (result.size() > targetIndexCount) {
+        unsigned int triangleCount = (unsigned int)(result.size() / 3);
+
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for (size_t i = 0; i < result.size(); i++) {
+            offsets[result[i] + 1]++;
+        }
+        for (unsigned int v = 0; v < vertexCount; v++) {
+            offsets[v + 1] += offsets[v];
+        }
+        adjacency.resize(result.size());
+        std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for (unsigned int t = 0; t < triangleCount; t++) {
+            for (unsigned int k = 0; k < 3; k++) {
+                adjacency[fill[result[t * 3 + k]]++] = t;
+            }
+        }
+
+        // Every interior edge is seen from both of its triangles; keeping
+        // only the a < b sighting visits it once.
+        collapses.clear();
+        for (size_t t = 0; t < result.size(); t += 3) {
+            for (unsigned int k = 0; k < 3; k++) {
+                unsigned int a = result[t + k], b = result[t + (k + 1) % 3];
+                if (a > b || (locked[a] && locked[b])) {
+                    continue;
+                }
+                Quadric q = quadrics[a];
+                addQuadric(q, quadrics[b]);
+                double costToB = locked[a] ? HUGE_VAL : quadricError(q, vertices[b].position);
+                double costToA = locked[b] ? HUGE_VAL : quadricError(q, vertices[a].position);
+                EdgeCollapse collapse;
+                collapse.from = costToB <= costToA ? a : b;
+                collapse.to = costToB <= costToA ? b : a;
+                collapse.cost = std::min(costToA, costToB);
+                if (collapse.cost <= costLimit) {
+                    collapses.push_back(collapse);
+                }
+            }
+        }
+        if (collapses.empty()) {
+            break;
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const EdgeCollapse &x, const EdgeCollapse &y) {
+            return x.cost < y.cost;
+        });
+
+        for (unsigned int v = 0; v < vertexCount; v++) {
+            collapseTo[v] = v;
+        }
+        std::fill(touched.begin(), touched.end(), 0);
+        size_t removable = (result.size() - targetIndexCount) / 3;
+        size_t removed = 0;
+        for (size_t c = 0; c < collapses.size() && removed < removable; c++) {
+            const EdgeCollapse &collapse = collapses[c];
+            unsigned int from = collapse.from, to = collapse.to;
+            if (touched[from] || touched[to]) {
+                continue;
+            }
+            // Reject collapses that would fold a surrounding triangle over.
+            bool flips = false;
+            for (unsigned int a = offsets[from]; a < offsets[from + 1] && !flips; a++) {
+                const unsigned int *triangle = &result[adjacency[a] * 3];
+                if (triangle[0] == to || triangle[1] == to || triangle[2] == to) {
+                    continue;
+                }
+                glm::vec3 p[3], q[3];
+                for (unsigned int k = 0; k < 3; k++) {
+                    p[k] = vertices[triangle[k]].position;
+                    q[k] = triangle[k] == from ? vertices[to].position : p[k];
+                }
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                flips = glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after);
+            }
+            if (flips) {
+                continue;
+            }
+            // Everything around the collapsed vertex changes shape, so none
+            // of it may collapse again until the next pass re-evaluates it.
+            for (unsigned int a = offsets[from]; a < offsets[from + 1]; a++) {
+                const unsigned int *triangle = &result[adjacency[a] * 3];
+                touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+            }
+            collapseTo[from] = to;
+            addQuadric(quadrics[to], quadrics[from]);
+            worstCost = std::max(worstCost, collapse.cost);
+            removed += 2;
+        }
+        if (removed == 0) {
+            break;
+        }
+
+        size_t output = 0;
+        for (size_t t = 0; t < result.size(); t += 3) {
+            unsigned int a = collapseTo[result[t + 0]];
+            unsigned int b = collapseTo[result[t + 1]];
+            unsigned int c = collapseTo[result[t + 2]];
+            if (a != b && b != c && a != c) {
+                result[output++] = a;
+                result[output++] = b;
+                result[output++] = c;
+            }
+        }
+        result.resize(output);
+    }
+
+    if (resultError) {
+        *resultError = (float)(std::sqrt(worstCost) / diagonal);
+    }
+    return result;
+}
+
+#endif
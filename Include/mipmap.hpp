@@ -0,0 +1,409 @@
+#ifndef mipmap_hpp
+#define mipmap_hpp
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <simd.hpp>
+
+// CPU mip chains, built on the loader threads instead of with
+// glGenerateMipmap on the GL thread. Colour channels are filtered in linear
+// light: 8-bit sRGB texels are decoded through a table, filtered as floats
+// and encoded back, so dark and bright texels average to what the eye
+// expects instead of darkening every level. Each level is filtered from the
+// previous one's float result, not from its rounded 8-bit copy.
+
+enum Mip_Filter {
+    MIP_BOX,   // 2x2 average
+    MIP_KAISER // Kaiser-windowed sinc over 6x6 texels; sharper, slightly ringing
+};
+
+struct MipSettings {
+    Mip_Filter filter = MIP_KAISER;
+    // Filter the colour channels of 3 and 4-channel images in linear light.
+    // 1 and 2-channel images (ambient occlusion, masks) are data and are
+    // always filtered as stored, as is alpha.
+    bool gammaCorrect = true;
+};
+
+struct MipLevel {
+    uint32_t width;
+    uint32_t height;
+    size_t offset; // into MipChain::pixels
+};
+
+// Every level below the base image, down to 1x1, tightly packed with the
+// base image's channel count.
+struct MipChain {
+    int channels = 0;
+    std::vector<MipLevel> levels;
+    std::vector<unsigned char> pixels;
+
+    const unsigned char *level(size_t i) const {
+        return pixels.data() + levels[i].offset;
+    }
+};
+
+// One image to build a chain for.
+struct MipSource {
+    const unsigned char *pixels;
+    uint32_t width;
+    uint32_t height;
+    int channels;
+};
+
+// Runs body(begin, end) over [0, count) split into chunks of at least
+// grain, on up to threads threads (0: one per core) including the caller.
+// Short-lived threads rather than the JobSystem, since this is called from
+// inside loader jobs and must not wait on its own pool.
+inline void parallelFor(unsigned int count, unsigned int grain, unsigned int threads, const std::function<void(unsigned int, unsigned int)> &body) {
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    unsigned int chunks = std::min(threads, (count + grain - 1) / std::max(grain, 1u));
+    if (chunks <= 1) {
+        if (count > 0) {
+            body(0, count);
+        }
+        return;
+    }
+    std::vector<std::thread> helpers;
+    helpers.reserve(chunks - 1);
+    for (unsigned int chunk = 1; chunk < chunks; chunk++) {
+        helpers.push_back(std::thread(body, (unsigned int)((uint64_t)count * chunk / chunks), (unsigned int)((uint64_t)count * (chunk + 1) / chunks)));
+    }
+    body(0, (unsigned int)((uint64_t)count / chunks));
+    for (unsigned int i = 0; i < helpers.size(); i++) {
+        helpers[i].join();
+    }
+}
+
+inline float srgbToLinear(float value) {
+    return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+inline float linearToSrgb(float value) {
+    return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// Lookup tables for the conversions: 256 entries to decode, and a
+// 16384-step ramp over [0, 1] to encode, which is fine enough that the
+// darkest sRGB steps still round correctly.
+struct SrgbTables {
+    static const int ENCODE_STEPS = 16384;
+    float decode[256];
+    unsigned char encode[ENCODE_STEPS + 1];
+
+    SrgbTables() {
+        for (int i = 0; i < 256; i++) {
+            decode[i] = srgbToLinear(i / 255.0f);
+        }
+        for (int i = 0; i <= ENCODE_STEPS; i++) {
+            encode[i] = (unsigned char)(linearToSrgb((float)i / ENCODE_STEPS) * 255.0f + 0.5f);
+        }
+    }
+};
+
+inline const SrgbTables &srgbTables() {
+    static SrgbTables tables;
+    return tables;
+}
+
+// Weights for halving along one axis. Output texel x sits between source
+// texels 2x and 2x+1; tap t covers source texel 2x + t - (taps / 2 - 1).
+struct MipKernel {
+    int taps;
+    float weights[6];
+};
+
+inline double besselI0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+inline MipKernel mipKernel(Mip_Filter filter) {
+    MipKernel kernel;
+    if (filter == MIP_BOX) {
+        kernel.taps = 2;
+        kernel.weights[0] = kernel.weights[1] = 0.5f;
+        return kernel;
+    }
+    // Sinc with its cutoff at the new level's Nyquist frequency, windowed
+    // by a Kaiser window (alpha 4) reaching zero three source texels out.
+    const double alpha = 4.0, radius = 3.0, pi = 3.14159265358979323846;
+    kernel.taps = 6;
+    double total = 0.0, weights[6];
+    for (int t = 0; t < 6; t++) {
+        double distance = std::fabs(t - 2.5);
+        double x = pi * distance / 2.0;
+        double sinc = x > 0.0 ? std::sin(x) / x : 1.0;
+        double window = besselI0(alpha * std::sqrt(std::max(0.0, 1.0 - (distance / radius) * (distance / radius)))) / besselI0(alpha);
+        weights[t] = sinc * window;
+        total += weights[t];
+    }
+    for (int t = 0; t < 6; t++) {
+        kernel.weights[t] = (float)(weights[t] / total);
+    }
+    return kernel;
+}
+
+inline bool channelIsSrgb(int channel, int channels, const MipSettings &settings) {
+    return settings.gammaCorrect && channels >= 3 && channel < 3;
+}
+
+inline unsigned char encodeMipValue(float value, bool srgb) {
+    value = std::min(std::max(value, 0.0f), 1.0f);
+    if (srgb) {
+        return srgbTables().encode[(int)(value * SrgbTables::ENCODE_STEPS + 0.5f)];
+    }
+    return (unsigned char)(value * 255.0f + 0.5f);
+}
+
+// Working state of one image while its chain is built: the float texels of
+// the level being read.
+struct MipWork {
+    MipSource source;
+    MipChain *chain;
+    std::vector<float> linear;
+    std::vector<float> next;
+    uint32_t width, height; // of the level being read
+};
+
+// Produces output rows [begin, end) of one level. The vertical taps are
+// summed into a float row first, then split into even and odd source
+// texels (padded by one texel each side) so that every horizontal tap is a
+// contiguous, four-wide multiply-add over x * channels + c.
+inline void filterMipRows(MipWork &work, uint32_t begin, uint32_t end, const MipKernel &kernel, const MipSettings &settings, size_t levelIndex) {
+    const int channels = work.source.channels;
+    const uint32_t width = work.width, height = work.height;
+    const uint32_t nextWidth = std::max(width / 2, 1u);
+    const size_t rowFloats = (size_t)width * channels;
+    const size_t outFloats = (size_t)nextWidth * channels;
+    const int reach = kernel.taps / 2 - 1;
+    const float *decode = srgbTables().decode;
+
+    bool srgb[4];
+    for (int c = 0; c < 4; c++) {
+        srgb[c] = channelIsSrgb(c, channels, settings);
+    }
+    std::vector<float> sourceRow(levelIndex == 0 ? rowFloats : 0);
+    std::vector<float> column(rowFloats + 4);
+    std::vector<float> even((nextWidth + 2) * channels + 4), odd((nextWidth + 2) * channels + 4);
+    const MipLevel &output = work.chain->levels[levelIndex];
+    unsigned char *outPixels = work.chain->pixels.data() + output.offset;
+
+    for (uint32_t y = begin; y < end; y++) {
+        std::fill(column.begin(), column.end(), 0.0f);
+        for (int t = 0; t < kernel.taps; t++) {
+            int sourceY = std::min(std::max((int)(y * 2) + t - reach, 0), (int)height - 1);
+            const float *row;
+            if (levelIndex == 0) {
+                const unsigned char *bytes = work.source.pixels + (size_t)sourceY * rowFloats;
+                for (size_t i = 0; i < rowFloats; i += channels) {
+                    for (int c = 0; c < channels; c++) {
+                        sourceRow[i + c] = srgb[c] ? decode[bytes[i + c]] : bytes[i + c] * (1.0f / 255.0f);
+                    }
+                }
+                row = sourceRow.data();
+            } else {
+                row = work.linear.data() + (size_t)sourceY * rowFloats;
+            }
+            Float4 weight = splat4(kernel.weights[t]);
+            size_t i = 0;
+            for (; i + 4 <= rowFloats; i += 4) {
+                store4(column.data() + i, madd4(weight, load4(row + i), load4(column.data() + i)));
+            }
+            for (; i < rowFloats; i++) {
+                column[i] += kernel.weights[t] * row[i];
+            }
+        }
+
+        // even/odd[(x + 1) * channels + c] hold source texels 2x and 2x+1,
+        // clamped at the edges, for x from -1 to nextWidth.
+        for (int x = -1; x <= (int)nextWidth; x++) {
+            int left = std::min(std::max(x * 2, 0), (int)width - 1);
+            int right = std::min(std::max(x * 2 + 1, 0), (int)width - 1);
+            for (int c = 0; c < channels; c++) {
+                even[(x + 1) * channels + c] = column[left * channels + c];
+                odd[(x + 1) * channels + c] = column[right * channels + c];
+            }
+        }
+        // Taps 2p and 2p+1 read the even and odd texel of output x + p - reach / 2.
+        float *outRow = work.next.data() + (size_t)y * outFloats;
+        size_t i = 0;
+        for (; i + 4 <= outFloats; i += 4) {
+            Float4 sum = splat4(0.0f);
+            for (int pair = 0; pair < kernel.taps / 2; pair++) {
+                size_t at = i + (size_t)(pair - reach / 2 + 1) * channels;
+                sum = madd4(splat4(kernel.weights[pair * 2]), load4(even.data() + at), sum);
+                sum = madd4(splat4(kernel.weights[pair * 2 + 1]), load4(odd.data() + at), sum);
+            }
+            store4(outRow + i, sum);
+        }
+        for (; i < outFloats; i++) {
+            float sum = 0.0f;
+            for (int pair = 0; pair < kernel.taps / 2; pair++) {
+                size_t at = i + (size_t)(pair - reach / 2 + 1) * channels;
+                sum += kernel.weights[pair * 2] * even[at] + kernel.weights[pair * 2 + 1] * odd[at];
+            }
+            outRow[i] = sum;
+        }
+
+        unsigned char *outBytes = outPixels + (size_t)y * outFloats;
+        for (size_t b = 0; b < outFloats; b++) {
+            outBytes[b] = encodeMipValue(outRow[b], srgb[b % channels]);
+        }
+    }
+}
+
+// Builds the chains of several images at once, one level at a time, with
+// the rows of every image sharing one parallel loop; this is how the six
+// faces of a cube map are done together. threads 0 uses every core.
+inline void buildMipChains(const MipSource *sources, unsigned int count, const MipSettings &settings, MipChain *chains, unsigned int threads = 0) {
+    std::vector<MipWork> work(count);
+    unsigned int levelCount = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        MipChain &chain = chains[i];
+        chain = MipChain();
+        chain.channels = sources[i].channels;
+        uint32_t width = sources[i].width, height = sources[i].height;
+        size_t offset = 0;
+        while (width > 1 || height > 1) {
+            width = std::max(width / 2, 1u);
+            height = std::max(height / 2, 1u);
+            MipLevel level = {width, height, offset};
+            chain.levels.push_back(level);
+            offset += (size_t)width * height * chain.channels;
+        }
+        chain.pixels.resize(offset);
+        work[i].source = sources[i];
+        work[i].chain = &chain;
+        work[i].width = sources[i].width;
+        work[i].height = sources[i].height;
+        levelCount = std::max(levelCount, (unsigned int)chain.levels.size());
+    }
+
+    MipKernel kernel = mipKernel(settings.filter);
+    std::vector<unsigned int> firstRow(count + 1);
+    for (unsigned int level = 0; level < levelCount; level++) {
+        // Rows of all images still being reduced, back to back.
+        firstRow[0] = 0;
+        for (unsigned int i = 0; i < count; i++) {
+            bool active = level < work[i].chain->levels.size();
+            if (active) {
+                const MipLevel &output = work[i].chain->levels[level];
+                work[i].next.resize((size_t)output.width * output.height * work[i].source.channels);
+            }
+            firstRow[i + 1] = firstRow[i] + (active ? work[i].chain->levels[level].height : 0);
+        }
+        parallelFor(firstRow[count], 16, threads, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int i = 0; i < count; i++) {
+                unsigned int from = std::max(begin, firstRow[i]), to = std::min(end, firstRow[i + 1]);
+                if (from < to) {
+                    filterMipRows(work[i], from - firstRow[i], to - firstRow[i], kernel, settings, level);
+                }
+            }
+        });
+        for (unsigned int i = 0; i < count; i++) {
+            if (level < work[i].chain->levels.size()) {
+                work[i].linear.swap(work[i].next);
+                work[i].width = work[i].chain->levels[level].width;
+                work[i].height = work[i].chain->levels[level].height;
+            }
+        }
+    }
+}
+
+inline void buildMipChain(const unsigned char *pixels, uint32_t width, uint32_t height, int channels, const MipSettings &settings, MipChain &chain, unsigned int threads = 0) {
+    MipSource source = {pixels, width, height, channels};
+    buildMipChains(&source, 1, settings, &chain, threads);
+}
+
+// Straightforward version of the same filter: one texel at a time, the
+// full 2D kernel, exact pow() conversions and no threads. Kept as the
+// reference the fast path is checked and timed against.
+inline void buildMipChainScalar(const MipSource &source, const MipSettings &settings, MipChain &chain) {
+    chain = MipChain();
+    chain.channels = source.channels;
+    const int channels = source.channels;
+    MipKernel kernel = mipKernel(settings.filter);
+    const int reach = kernel.taps / 2 - 1;
+    uint32_t width = source.width, height = source.height;
+    std::vector<float> linear((size_t)width * height * channels), next;
+    for (size_t i = 0; i < linear.size(); i++) {
+        float value = source.pixels[i] / 255.0f;
+        linear[i] = channelIsSrgb((int)(i % channels), channels, settings) ? srgbToLinear(value) : value;
+    }
+    while (width > 1 || height > 1) {
+        uint32_t nextWidth = std::max(width / 2, 1u), nextHeight = std::max(height / 2, 1u);
+        next.assign((size_t)nextWidth * nextHeight * channels, 0.0f);
+        MipLevel level = {nextWidth, nextHeight, chain.pixels.size()};
+        chain.levels.push_back(level);
+        chain.pixels.resize(level.offset + next.size());
+        for (uint32_t y = 0; y < nextHeight; y++) {
+            for (uint32_t x = 0; x < nextWidth; x++) {
+                for (int c = 0; c < channels; c++) {
+                    float sum = 0.0f;
+                    for (int ty = 0; ty < kernel.taps; ty++) {
+                        int sourceY = std::min(std::max((int)(y * 2) + ty - reach, 0), (int)height - 1);
+                        for (int tx = 0; tx < kernel.taps; tx++) {
+                            int sourceX = std::min(std::max((int)(x * 2) + tx - reach, 0), (int)width - 1);
+                            sum += kernel.weights[ty] * kernel.weights[tx] * linear[((size_t)sourceY * width + sourceX) * channels + c];
+                        }
+                    }
+                    size_t at = ((size_t)y * nextWidth + x) * channels + c;
+                    next[at] = sum;
+                    float clamped = std::min(std::max(sum, 0.0f), 1.0f);
+                    bool srgb = channelIsSrgb(c, channels, settings);
+                    chain.pixels[level.offset + at] = (unsigned char)((srgb ? linearToSrgb(clamped) : clamped) * 255.0f + 0.5f);
+                }
+            }
+        }
+        linear.swap(next);
+        width = nextWidth;
+        height = nextHeight;
+    }
+}
+
+struct MipBenchmark {
+    double scalarMs;   // buildMipChainScalar, one image after another
+    double simdMs;     // buildMipChains on one thread
+    double threadedMs; // buildMipChains on every core
+    int maxError;      // largest 8-bit difference from the scalar result
+};
+
+// Times the three ways of building the chains of the given images.
+inline MipBenchmark benchmarkMipChains(const MipSource *sources, unsigned int count, const MipSettings &settings) {
+    MipBenchmark result = {0.0, 0.0, 0.0, 0};
+    std::vector<MipChain> reference(count), fast(count);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < count; i++) {
+        buildMipChainScalar(sources[i], settings, reference[i]);
+    }
+    result.scalarMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    buildMipChains(sources, count, settings, fast.data(), 1);
+    result.simdMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    buildMipChains(sources, count, settings, fast.data());
+    result.threadedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    for (unsigned int i = 0; i < count; i++) {
+        for (size_t b = 0; b < fast[i].pixels.size(); b++) {
+            result.maxError = std::max(result.maxError, std::abs((int)fast[i].pixels[b] - (int)reference[i].pixels[b]));
+        }
+    }
+    return result;
+}
+
+#endif
@@ -2,178 +2,967 @@
 #define model_hpp
 
 #include <vector>
+#include <chrono>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+#include <algorithm>
 #include <mesh.hpp>
+#include <meshcache.hpp>
+#include <meshoptimize.hpp>
+#include <meshsimplify.hpp>
+#include <culling.hpp>
+#include <renderqueue.hpp>
+#include <instancing.hpp>
+#include <jobsystem.hpp>
+#include <texturecache.hpp>
+#include <contenthash.hpp>
+#include <mipmap.hpp>
+#include <texturecompress.hpp>
+#include <texturestreaming.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <stb_image.h>
 
-unsigned int TextureFromFile(const char *path, const std::string &directory, bool state);
+struct ImageData {
+    unsigned char *data;
+    int width, height, nrComponents;
+    // Levels below data, built on the loader thread when mipmaps are wanted.
+    MipChain mips;
+};
+
+// Where a model's texture comes from: decoded by this model, already
+// claimed by another model under the same path, or byte-identical to
+// another path's file.
+enum Image_Source {
+    IMAGE_DECODE,
+    IMAGE_SHARED,
+    IMAGE_ALIAS
+};
+
+ImageData DecodeImage(const std::string &filename, bool state);
+ImageData DecodeImage(const std::vector<unsigned char> &bytes, bool state);
+std::string ContentKey(const std::vector<unsigned char> &bytes, const TextureOptions &options, double &hashMs);
+unsigned int UploadTexture(ImageData &image, const std::string &path, const TextureOptions &options = TextureOptions());
+bool BakedTextureFromFile(const std::string &filename, const TextureOptions &options, BakedTexture &baked, const std::vector<unsigned char> *bytes = NULL);
+bool TextureSourceFromFile(const std::string &filename, const TextureOptions &options, TextureSource &source, const std::vector<unsigned char> *bytes = NULL);
+unsigned int UploadCompressedTexture(BakedTexture &baked, const TextureOptions &options = TextureOptions());
+GLenum CompressedInternalFormat(Block_Format format, bool srgb);
+bool CompressedTexturesSupported();
+
+// Geometry memory of one model. releasedBytes is what KEEP_RESIDENT would
+// additionally hold on the CPU side under the model's current policy.
+struct ModelMemory {
+    size_t gpuBytes;
+    size_t cpuBytes;
+    size_t releasedBytes;
+};
+
+// How a Model is imported and stored. Any setting that changes the
+// processed geometry has to be part of processFlags() so the mesh cache
+// is rebuilt when it changes.
+struct ModelSettings {
+    Mesh_Residency residency = DISCARD_AFTER_UPLOAD;
+    Vertex_Format vertexFormat = VERTEX_FLOAT;
+    // Split meshes with more than 65536 vertices into parts that can use
+    // 16-bit indices.
+    bool splitForShortIndices = false;
+    // Build up to MAX_MESH_LODS simplified levels per mesh at import.
+    bool generateLods = false;
+    // Load textures block-compressed from .bctex files, baking them on
+    // first use. Only set where CompressedTexturesSupported().
+    bool compressTextures = false;
+    // Start textures as placeholders and let textureStreamer() bring in
+    // their levels, so the model draws before its images are decoded. Only
+    // used by the JobSystem constructor.
+    bool streamTextures = false;
+    
+    unsigned int processFlags() const {
+        return (splitForShortIndices ? 1u : 0u) | (generateLods ? 2u : 0u);
+    }
+};
+
+// Each level aims for LOD_REDUCTION of the previous one's triangles and
+// stops early once the simplifier would exceed LOD_MAX_ERROR (relative to
+// the mesh bounds) or can no longer make meaningful progress.
+const float LOD_REDUCTION = 0.5f;
+const float LOD_MAX_ERROR = 0.02f;
+
+// Projected model height, as a fraction of the viewport height, below which
+// each coarser level is drawn: LOD i+1 once the model is smaller than
+// below[i].
+struct LodThresholds {
+    float below[MAX_MESH_LODS - 1] = {0.4f, 0.2f, 0.08f};
+};
+
 class Model
 {
+    // Everything a load needs between the worker stages and the GL uploads.
+    // It is released once the model is ready to draw.
+    struct ModelLoad {
+        std::string path;
+        std::unique_ptr<MappedFile> cache;
+        std::vector<MeshData> imported;
+        std::vector<MeshBlob> blobs;
+        std::vector<std::string> texturePaths;
+        // Only images this model claimed from the texture cache are decoded
+        // here; the rest arrive through textureCache().whenReady().
+        std::vector<Image_Source> imageSources;
+        std::vector<ImageData> images;
+        // Used instead of images when textures are compressed.
+        std::vector<BakedTexture> baked;
+        std::vector<double> decodeMs;
+        unsigned int remainingUploads;
+        std::chrono::steady_clock::time_point start;
+    };
+    
     std::vector<Mesh> meshes;
-    std::vector<Tex> textures_loaded;
+    std::unordered_map<std::string, unsigned int> textures_loaded;
+    std::vector<std::string> textureKeys;
     std::string directory;
+    std::string sourcePath;
     bool isFlip;
+    bool fromCache;
+    ModelSettings settings;
+    BoundingBox bounds;
+    BoundingSphere sphere;
+    std::atomic<bool> ready;
     unsigned int skybox;
+    std::unique_ptr<ModelLoad> load;
     public:
-        Model(const char *path, bool state, unsigned int cubemap)
+        static const unsigned int importFlags = aiProcess_Triangulate | aiProcess_FlipUVs;
+        
+        Model(const char *path, bool state, unsigned int cubemap, ModelSettings settings = ModelSettings())
         {
-            this->isFlip = state;
-            this->skybox = cubemap;
-            loadModel(path);
-            std::cout << "LOADED: " << path << std::endl;
+            beginLoad(path, state, cubemap, settings);
+            parse();
+            // The last upload releases load, so nothing reads it after that.
+            unsigned int imageCount = (unsigned int)load->images.size();
+            unsigned int blobCount = (unsigned int)load->blobs.size();
+            if (imageCount + blobCount == 0) {
+                finishLoad();
+                return;
+            }
+            for (unsigned int i = 0; i < imageCount; i++) {
+                if (load->imageSources[i] == IMAGE_DECODE) {
+                    decodeImage(i);
+                }
+            }
+            std::vector<Image_Source> sources = load->imageSources;
+            for (unsigned int i = 0; i < imageCount; i++) {
+                if (sources[i] == IMAGE_DECODE) {
+                    uploadImage(i);
+                } else if (sources[i] == IMAGE_ALIAS) {
+                    aliasImage(i);
+                } else {
+                    waitForTexture(i);
+                }
+            }
+            for (unsigned int i = 0; i < blobCount; i++) {
+                uploadMesh(i);
+            }
+        }
+        // Parsing and image decoding run on the job system's workers; the GL
+        // uploads are queued for jobs.processUploads() on the render thread.
+        // The model draws nothing until every upload has run.
+        Model(const char *path, bool state, unsigned int cubemap, JobSystem &jobs, ModelSettings settings = ModelSettings())
+        {
+            beginLoad(path, state, cubemap, settings);
+            jobs.submit([this, &jobs] {
+                parse();
+                // Once the last upload is queued the render thread may finish
+                // the model and release load, so it is only read before then.
+                unsigned int imageCount = (unsigned int)load->images.size();
+                unsigned int blobCount = (unsigned int)load->blobs.size();
+                std::vector<Image_Source> sources = load->imageSources;
+                if (imageCount + blobCount == 0) {
+                    jobs.submitUpload([this] { finishLoad(); });
+                    return;
+                }
+                for (unsigned int i = 0; i < imageCount; i++) {
+                    if (sources[i] != IMAGE_DECODE) {
+                        jobs.submitUpload([this, i] { waitForTexture(i); });
+                        continue;
+                    }
+                    jobs.submit([this, &jobs, i] {
+                        if (this->settings.streamTextures) {
+                            streamImage(i, jobs);
+                            return;
+                        }
+                        decodeImage(i);
+                        if (load->imageSources[i] == IMAGE_ALIAS) {
+                            jobs.submitUpload([this, i] { aliasImage(i); });
+                        } else {
+                            jobs.submitUpload([this, i] { uploadImage(i); });
+                        }
+                    });
+                }
+                for (unsigned int i = 0; i < blobCount; i++) {
+                    jobs.submitUpload([this, i] { uploadMesh(i); });
+                }
+            });
+        }
+        Model(const Model &) = delete;
+        Model &operator=(const Model &) = delete;
+        // The textures themselves go once no other model uses them, at the
+        // next textureCache().collect().
+        ~Model()
+        {
+            for (unsigned int i = 0; i < textureKeys.size(); i++) {
+                textureCache().release(textureKeys[i]);
+            }
+        }
+        
+        bool isReady() const {
+            return ready;
         }
         
-        void Draw(Shader &shader)
+        ModelMemory memoryUsage() const {
+            ModelMemory memory = {0, 0, 0};
+            if (!ready) {
+                return memory;
+            }
+            for (unsigned int i = 0; i < meshes.size(); i++) {
+                memory.gpuBytes += meshes[i].gpuBytes();
+                memory.cpuBytes += meshes[i].cpuBytes();
+                if (meshes[i].residentCpuBytes() > meshes[i].cpuBytes()) {
+                    memory.releasedBytes += meshes[i].residentCpuBytes() - meshes[i].cpuBytes();
+                }
+            }
+            return memory;
+        }
+        
+        // Makes Mesh::verticies/indices available for CPU-side work. Under
+        // RELOAD_ON_DEMAND they are read back from the mesh cache (or Assimp if
+        // the cache is gone); DISCARD_AFTER_UPLOAD models cannot provide them.
+        bool requireGeometry() {
+            if (!ready || settings.residency == DISCARD_AFTER_UPLOAD) {
+                return false;
+            }
+            bool resident = true;
+            for (unsigned int i = 0; i < meshes.size(); i++) {
+                resident = resident && meshes[i].hasGeometry();
+            }
+            if (resident) {
+                return true;
+            }
+            load.reset(new ModelLoad());
+            load->path = sourcePath;
+            if (!loadFromCache(sourcePath)) {
+                importWithAssimp(sourcePath);
+            }
+            bool matches = load->blobs.size() == meshes.size();
+            for (unsigned int i = 0; matches && i < meshes.size(); i++) {
+                matches = load->blobs[i].vertexCount == meshes[i].getVertexCount() && load->blobs[i].indexCount == meshes[i].getIndexCount();
+            }
+            if (matches) {
+                for (unsigned int i = 0; i < meshes.size(); i++) {
+                    meshes[i].setGeometry(load->blobs[i].vertices, load->blobs[i].indices);
+                }
+            }
+            load.reset();
+            return matches;
+        }
+        // Tells the texture streamer how tall the model is on screen this
+        // frame, in pixels.
+        void requestTextures(float screenPixels) const {
+            if (!ready) {
+                return;
+            }
+            for (std::unordered_map<std::string, unsigned int>::const_iterator it = textures_loaded.begin(); it != textures_loaded.end(); ++it) {
+                textureStreamer().request(it->second, screenPixels);
+            }
+        }
+        
+        // Drops the CPU copy again; a no-op for KEEP_RESIDENT models.
+        void releaseGeometry() {
+            if (!ready || settings.residency == KEEP_RESIDENT) {
+                return;
+            }
+            for (unsigned int i = 0; i < meshes.size(); i++) {
+                meshes[i].releaseGeometry();
+            }
+        }
+        
+        // Diameter of the model's bounding sphere projected at its distance
+        // from the camera, as a fraction of the viewport height.
+        float projectedSize(const glm::mat4 &modelMatrix, const glm::vec3 &cameraPosition, float fieldOfViewY) const {
+            if (!ready) {
+                return 0.0f;
+            }
+            glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(sphere.center, 1.0f));
+            float scale = std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+            float radius = sphere.radius * scale;
+            float distance = glm::length(center - cameraPosition);
+            if (distance <= radius) {
+                return 1.0f;
+            }
+            return radius / (distance * std::tan(fieldOfViewY * 0.5f));
+        }
+        unsigned int selectLod(float projectedSize, const LodThresholds &thresholds) const {
+            unsigned int lod = 0;
+            while (lod < MAX_MESH_LODS - 1 && projectedSize < thresholds.below[lod]) {
+                lod++;
+            }
+            return lod;
+        }
+        unsigned int triangleCount(unsigned int lod = 0) const {
+            unsigned int triangles = 0;
+            if (!ready) {
+                return triangles;
+            }
+            for (unsigned int i = 0; i < meshes.size(); i++) {
+                triangles += meshes[i].getLod(lod).indexCount / 3;
+            }
+            return triangles;
+        }
+        
+        const BoundingBox &getBounds() const {
+            return bounds;
+        }
+        const BoundingSphere &getBoundingSphere() const {
+            return sphere;
+        }
+        
+        // Queues every mesh's bounds for this frame's culling pass and
+        // returns the index of the first; pass it back to Draw.
+        unsigned int addBounds(CullingPass &culling, const glm::mat4 &modelMatrix) const {
+            unsigned int first = culling.testedCount();
+            if (!ready) {
+                return first;
+            }
+            for (unsigned int i = 0; i < meshes.size(); i++) {
+                culling.add(meshes[i].getBounds(), meshes[i].getBoundingSphere(), modelMatrix);
+            }
+            return first;
+        }
+        // True if any of the meshes queued by addBounds survived culling.
+        bool anyVisible(const CullingPass &culling, unsigned int firstBound) const {
+            for (unsigned int i = 0; i < meshes.size(); i++) {
+                if (culling.visible(firstBound + i)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        
+        // Returns the number of triangles drawn.
+        unsigned int Draw(Shader &shader, unsigned int lod = 0)
         {
+            unsigned int triangles = 0;
+            if (!ready) {
+                return triangles;
+            }
             for(unsigned int i = 0; i < meshes.size(); i++) {
-                meshes[i].Draw(shader, this->skybox);
+                meshes[i].Draw(shader, this->skybox, lod);
+                triangles += meshes[i].getLod(lod).indexCount / 3;
             }
+            return triangles;
+        }
+        // Queues the meshes the culling pass found visible; depth is the
+        // normalized view distance used to order draws within a state bucket.
+        unsigned int submit(RenderQueue &queue, Shader &shader, unsigned int lod, const DrawMaterial &material, const glm::mat4 &modelMatrix, float depth, const CullingPass &culling, unsigned int firstBound)
+        {
+            unsigned int triangles = 0;
+            if (!ready) {
+                return triangles;
+            }
+            for(unsigned int i = 0; i < meshes.size(); i++) {
+                if (culling.visible(firstBound + i)) {
+                    queue.submit(shader, meshes[i], lod, this->skybox, material, modelMatrix, depth);
+                    triangles += meshes[i].getLod(lod).indexCount / 3;
+                }
+            }
+            return triangles;
+        }
+        // Skips the meshes the culling pass found outside the frustum.
+        unsigned int Draw(Shader &shader, unsigned int lod, const CullingPass &culling, unsigned int firstBound)
+        {
+            unsigned int triangles = 0;
+            if (!ready) {
+                return triangles;
+            }
+            for(unsigned int i = 0; i < meshes.size(); i++) {
+                if (culling.visible(firstBound + i)) {
+                    meshes[i].Draw(shader, this->skybox, lod);
+                    triangles += meshes[i].getLod(lod).indexCount / 3;
+                }
+            }
+            return triangles;
+        }
+        // Draws count copies of the model in one call per mesh, one copy per
+        // transform. The transforms go through instances, which is reused by
+        // every instanced draw; the shader's modelMatrix uniform is ignored.
+        unsigned int DrawInstanced(Shader &shader, InstanceBuffer &instances, const glm::mat4 *transforms, unsigned int count, unsigned int lod = 0)
+        {
+            unsigned int triangles = 0;
+            if (!ready || count == 0) {
+                return triangles;
+            }
+            instances.upload(transforms, count);
+            for(unsigned int i = 0; i < meshes.size(); i++) {
+                meshes[i].DrawInstanced(shader, this->skybox, lod, instances.ID, count);
+                triangles += meshes[i].getLod(lod).indexCount / 3 * count;
+            }
+            return triangles;
         }
     private:
-        void loadModel(std::string path) {
+        void beginLoad(const char *path, bool state, unsigned int cubemap, const ModelSettings &settings) {
+            this->isFlip = state;
+            this->settings = settings;
+            this->sourcePath = path;
+            this->skybox = cubemap;
+            this->ready = false;
+            this->fromCache = false;
+            this->bounds.min = this->bounds.max = glm::vec3(0.0f);
+            this->sphere.center = glm::vec3(0.0f);
+            this->sphere.radius = 0.0f;
+            this->load.reset(new ModelLoad());
+            load->path = path;
+            load->start = std::chrono::steady_clock::now();
+            directory = load->path.substr(0, load->path.find_last_of('/'));
+        }
+        
+        // Worker stage: fills load->blobs from the mesh cache or from Assimp
+        // and collects the unique texture paths to decode.
+        void parse() {
+            fromCache = loadFromCache(load->path);
+            if (!fromCache) {
+                importWithAssimp(load->path);
+            }
+            
+            std::unordered_map<std::string, unsigned int> seen;
+            for (unsigned int i = 0; i < load->blobs.size(); i++) {
+                for (unsigned int t = 0; t < load->blobs[i].textures.size(); t++) {
+                    const std::string &texturePath = load->blobs[i].textures[t].path;
+                    if (seen.find(texturePath) == seen.end()) {
+                        seen[texturePath] = (unsigned int)load->texturePaths.size();
+                        load->texturePaths.push_back(texturePath);
+                    }
+                }
+            }
+            load->images.resize(load->texturePaths.size());
+            load->baked.resize(load->texturePaths.size());
+            load->imageSources.resize(load->texturePaths.size());
+            load->decodeMs.resize(load->texturePaths.size());
+            textureKeys.resize(load->texturePaths.size());
+            for (unsigned int i = 0; i < load->texturePaths.size(); i++) {
+                std::string canonicalPath = canonicalTexturePath(directory + '/' + load->texturePaths[i]);
+                textureKeys[i] = TextureCache::key(canonicalPath, textureOptions());
+                load->imageSources[i] = textureCache().claim(textureKeys[i]) == TextureCache::CLAIM_LOAD ? IMAGE_DECODE : IMAGE_SHARED;
+            }
+            load->remainingUploads = (unsigned int)(load->texturePaths.size() + load->blobs.size());
+            meshes.reserve(load->blobs.size());
+        }
+        bool loadFromCache(const std::string &path) {
+            load->cache.reset(new MappedFile(meshCachePath(path)));
+            if (!readMeshCache(*load->cache, path, importFlags, settings.processFlags(), load->blobs)) {
+                load->cache.reset();
+                load->blobs.clear();
+                return false;
+            }
+            return true;
+        }
+        void importWithAssimp(const std::string &path) {
             Assimp::Importer importer;
-            const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+            const aiScene *scene = importer.ReadFile(path, importFlags);
             if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
                 std::cout << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
                 return;
             }
-            directory = path.substr(0, path.find_last_of('/'));
+            load->imported.reserve(scene->mNumMeshes);
             processNode(scene->mRootNode, scene);
-        };
+            
+            load->blobs.resize(load->imported.size());
+            for (unsigned int i = 0; i < load->imported.size(); i++) {
+                MeshData &data = load->imported[i];
+                load->blobs[i].vertices = data.vertices.data();
+                load->blobs[i].vertexCount = (uint32_t)data.vertices.size();
+                load->blobs[i].indices = data.indices.data();
+                load->blobs[i].indexCount = (uint32_t)data.indices.size();
+                load->blobs[i].lods = data.lods;
+                load->blobs[i].textures = data.textures;
+            }
+            writeMeshCache(path, importFlags, settings.processFlags(), load->blobs);
+        }
+        
+        // Worker stage for each image this model claimed. The file is hashed
+        // first; if its bytes are already loaded under another path, the
+        // image becomes an IMAGE_ALIAS and is not decoded at all.
+        void decodeImage(unsigned int i) {
+            std::string filename = directory + '/' + load->texturePaths[i];
+            std::vector<unsigned char> bytes;
+            if (!readFileBytes(filename, bytes)) {
+                load->images[i] = DecodeImage(filename, isFlip);
+                return;
+            }
+            double hashMs = 0.0;
+            std::string contentKey = ContentKey(bytes, textureOptions(), hashMs);
+            if (textureCache().claimContent(textureKeys[i], contentKey, hashMs) == TextureCache::CLAIM_SHARED) {
+                load->imageSources[i] = IMAGE_ALIAS;
+                return;
+            }
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if (!textureOptions().compress || !BakedTextureFromFile(filename, textureOptions(), load->baked[i], &bytes)) {
+                ImageData &image = load->images[i];
+                image = DecodeImage(bytes, isFlip);
+                if (image.data && textureOptions().mipmaps) {
+                    buildMipChain(image.data, image.width, image.height, image.nrComponents, MipSettings(), image.mips);
+                }
+            }
+            load->decodeMs[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        
+        // Streaming counterpart of decodeImage(). Once the file is hashed the
+        // texture is published as a placeholder, which is all the model waits
+        // for; the decoded levels reach textureStreamer() afterwards. Nothing
+        // queued after the placeholder touches load, which may be released by
+        // the time it runs.
+        void streamImage(unsigned int i, JobSystem &jobs) {
+            std::string filename = directory + '/' + load->texturePaths[i];
+            std::string key = textureKeys[i];
+            TextureOptions options = textureOptions();
+            std::vector<unsigned char> bytes;
+            bool read = readFileBytes(filename, bytes);
+            if (read) {
+                double hashMs = 0.0;
+                std::string contentKey = ContentKey(bytes, options, hashMs);
+                if (textureCache().claimContent(key, contentKey, hashMs) == TextureCache::CLAIM_SHARED) {
+                    load->imageSources[i] = IMAGE_ALIAS;
+                    jobs.submitUpload([this, i] { aliasImage(i); });
+                    return;
+                }
+            }
+            jobs.submitUpload([this, i] { placeholderImage(i); });
+            
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::shared_ptr<TextureSource> source(new TextureSource());
+            bool loaded = TextureSourceFromFile(filename, options, *source, read ? &bytes : NULL);
+            double decodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            jobs.submitUpload([key, filename, source, loaded, decodeMs] {
+                unsigned int id = 0;
+                if (!textureCache().readyId(key, id)) {
+                    return;
+                }
+                if (!loaded) {
+                    std::cout << "Texture failed to load at path: " << filename << std::endl;
+                    return;
+                }
+                TextureCost cost = {decodeMs, 0};
+                for (unsigned int level = 0; level < source->levels.size(); level++) {
+                    cost.bytes += source->levels[level].size;
+                }
+                textureCache().setCost(key, cost);
+                textureStreamer().add(id, filename, std::move(*source));
+            });
+        }
+        
+        // GL stages, always on the render thread.
+        void placeholderImage(unsigned int i) {
+            unsigned int id = textureStreamer().createPlaceholder();
+            textureCache().publish(textureKeys[i], id);
+            textureLoaded(i, id);
+        }
+        void uploadImage(unsigned int i) {
+            if (load->baked[i].valid()) {
+                TextureCost cost = {load->decodeMs[i], load->baked[i].bytes()};
+                unsigned int id = UploadCompressedTexture(load->baked[i], textureOptions());
+                textureCache().publish(textureKeys[i], id, cost);
+                textureLoaded(i, id);
+                return;
+            }
+            const ImageData &image = load->images[i];
+            TextureCost cost = {load->decodeMs[i], (size_t)image.width * image.height * image.nrComponents};
+            if (textureOptions().mipmaps) {
+                cost.bytes = cost.bytes * 4 / 3;
+            }
+            unsigned int id = UploadTexture(load->images[i], load->texturePaths[i], textureOptions());
+            textureCache().publish(textureKeys[i], id, cost);
+            textureLoaded(i, id);
+        }
+        void aliasImage(unsigned int i) {
+            std::cout << "TEXTURE: " << directory << '/' << load->texturePaths[i] << " has the same contents as an already loaded file, sharing it" << std::endl;
+            textureCache().resolveAlias(textureKeys[i]);
+            waitForTexture(i);
+        }
+        // Another model decodes this one; it counts as this model's upload
+        // once it has been published.
+        void waitForTexture(unsigned int i) {
+            textureCache().whenReady(textureKeys[i], [this, i](unsigned int id) {
+                textureLoaded(i, id);
+            });
+        }
+        void textureLoaded(unsigned int i, unsigned int id) {
+            textures_loaded[load->texturePaths[i]] = id;
+            finishUpload();
+        }
+        TextureOptions textureOptions() const {
+            TextureOptions options;
+            options.flip = isFlip;
+            options.compress = settings.compressTextures;
+            return options;
+        }
+        void uploadMesh(unsigned int i) {
+            if (fromCache) {
+                const MeshBlob &blob = load->blobs[i];
+                meshes.emplace_back(blob.vertices, blob.vertexCount, blob.indices, blob.indexCount, blob.lods, settings.residency == KEEP_RESIDENT, settings.vertexFormat);
+            } else {
+                // Moving the imported data in frees it as soon as it is on the
+                // GPU instead of when the whole model has finished loading.
+                meshes.emplace_back(std::move(load->imported[i]), settings.residency == KEEP_RESIDENT, settings.vertexFormat);
+            }
+            finishUpload();
+        }
+        void finishUpload() {
+            if (--load->remainingUploads == 0) {
+                finishLoad();
+            }
+        }
+        // GL thread, after the last upload, or straight after parse() for a
+        // model with nothing to upload.
+        void finishLoad() {
+            for (unsigned int i = 0; i < meshes.size(); i++) {
+                bounds.min = i == 0 ? meshes[i].getBounds().min : glm::min(bounds.min, meshes[i].getBounds().min);
+                bounds.max = i == 0 ? meshes[i].getBounds().max : glm::max(bounds.max, meshes[i].getBounds().max);
+                const std::vector<TexRef> &refs = load->blobs[i].textures;
+                for (unsigned int t = 0; t < refs.size(); t++) {
+                    meshes[i].textures.push_back(findTexture(refs[t].path, refs[t].type));
+                }
+            }
+            sphere.center = (bounds.min + bounds.max) * 0.5f;
+            for (unsigned int i = 0; i < meshes.size(); i++) {
+                const BoundingSphere &part = meshes[i].getBoundingSphere();
+                sphere.radius = std::max(sphere.radius, glm::length(part.center - sphere.center) + part.radius);
+            }
+            double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load->start).count();
+            // Compare a cold start (no .meshcache yet) against a warm one to
+            // see what the cache saves for each model.
+            std::cout << "LOADED: " << load->path << " (" << (fromCache ? "cache" : "assimp") << ", " << loadMs << " ms)" << std::endl;
+            load.reset();
+            ready = true;
+        }
+        Tex findTexture(const std::string &path, const std::string &typeName) {
+            std::unordered_map<std::string, unsigned int>::const_iterator it = textures_loaded.find(path);
+            Tex texture;
+            texture.id = it != textures_loaded.end() ? it->second : 0;
+            texture.type = typeName;
+            texture.path = path;
+            return texture;
+        }
+        
         void processNode(aiNode *node, const aiScene *scene) {
             for(unsigned int i = 0; i < node->mNumMeshes; i++) {
                 aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-                meshes.push_back(processMesh(mesh, scene));
+                MeshData data = processMesh(mesh, scene);
+                std::string name = load->path + ":" + mesh->mName.C_Str();
+                if (settings.splitForShortIndices && data.vertices.size() > 65536) {
+                    std::vector<MeshPart> parts = splitForShortIndices(data.vertices, data.indices);
+                    for (unsigned int p = 0; p < parts.size(); p++) {
+                        MeshData part;
+                        part.vertices = std::move(parts[p].vertices);
+                        part.indices = std::move(parts[p].indices);
+                        part.textures = data.textures;
+                        addImportedMesh(std::move(part), name, mesh->mPrimitiveTypes);
+                    }
+                } else {
+                    addImportedMesh(std::move(data), name, mesh->mPrimitiveTypes);
+                }
             }
             for(unsigned int i = 0; i < node->mNumChildren; i++) {
                 processNode(node->mChildren[i], scene);
             }
         };
-        Mesh processMesh(aiMesh *mesh, const aiScene *scene) {
-            std::vector<Vertex> vertices;
-            std::vector<unsigned int> indices;
-            std::vector<Tex> textures;
+        void addImportedMesh(MeshData &&data, const std::string &name, unsigned int primitiveTypes) {
+            if (settings.generateLods && primitiveTypes == aiPrimitiveType_TRIANGLE) {
+                generateLods(data, name);
+            }
+            load->imported.emplace_back(std::move(data));
+        }
+        // Appends each simplified level to data.indices, simplifying from the
+        // previous level so the chain stays nested.
+        void generateLods(MeshData &data, const std::string &name) {
+            MeshLod full = {0, (uint32_t)data.indices.size(), 0.0f};
+            data.lods.assign(1, full);
+            std::vector<unsigned int> level(data.indices);
+            std::vector<unsigned int> clusters;
+            while (data.lods.size() < MAX_MESH_LODS) {
+                size_t target = (size_t)(level.size() / 3 * LOD_REDUCTION) * 3;
+                float error = 0.0f;
+                std::vector<unsigned int> simplified = simplifyMesh(data.vertices, level, target, LOD_MAX_ERROR, &error);
+                if (simplified.empty() || simplified.size() > level.size() * 0.9f) {
+                    break;
+                }
+                optimizeVertexCache(simplified, (unsigned int)data.vertices.size(), clusters);
+                MeshLod lod = {(uint32_t)data.indices.size(), (uint32_t)simplified.size(), error};
+                data.indices.insert(data.indices.end(), simplified.begin(), simplified.end());
+                data.lods.push_back(lod);
+                level.swap(simplified);
+            }
+            
+            std::ostringstream report;
+            report << "LODS: " << name;
+            for (size_t i = 0; i < data.lods.size(); i++) {
+                report << (i == 0 ? " " : " / ") << data.lods[i].indexCount / 3;
+            }
+            report << " triangles, error " << data.lods.back().error << "\n";
+            std::cout << report.str() << std::flush;
+        }
+        MeshData processMesh(aiMesh *mesh, const aiScene *scene) {
+            MeshData data;
             
+            // process vertex positions, normals and texture coordinates
+            data.vertices.resize(mesh->mNumVertices);
+            const aiVector3D *normals = mesh->HasNormals() ? mesh->mNormals : NULL;
+            const aiVector3D *texCoords = mesh->mTextureCoords[0];
             for(unsigned int i = 0; i < mesh->mNumVertices; i++) {
-                Vertex vertex;
-                // process vertex positions, normals and texture coordinates
-                glm::vec3 vec;
-                vec.x = mesh->mVertices[i].x;
-                vec.y = mesh->mVertices[i].y;
-                vec.z = mesh->mVertices[i].z;
-                
-                vertex.position = vec;
-                
-                if (mesh->HasNormals()) {
-                vec.x = mesh->mNormals[i].x;
-                vec.y = mesh->mNormals[i].y;
-                vec.z = mesh->mNormals[i].z;
-                vertex.normal = vec;
-                }
-                
-                if(mesh->mTextureCoords[0]) {
-                    glm::vec2 vecTex;
-                    vecTex.x = mesh->mTextureCoords[0][i].x;
-                    vecTex.y = mesh->mTextureCoords[0][i].y;
-                    vertex.texCoord = vecTex;
-                }
-                else {
-                    vertex.texCoord = glm::vec2(0.0f, 0.0f);
-                }
-                //
-                vertices.push_back(vertex);
+                Vertex &vertex = data.vertices[i];
+                const aiVector3D &position = mesh->mVertices[i];
+                vertex.position = glm::vec3(position.x, position.y, position.z);
+                vertex.normal = normals ? glm::vec3(normals[i].x, normals[i].y, normals[i].z) : glm::vec3(0.0f);
+                vertex.texCoord = texCoords ? glm::vec2(texCoords[i].x, texCoords[i].y) : glm::vec2(0.0f, 0.0f);
             }
             
-        // process indices
-        for(unsigned int i = 0; i < mesh->mNumFaces; i++) {
-            aiFace face = mesh->mFaces[i];
-            for(unsigned int j = 0; j < face.mNumIndices; j++) {
-                indices.push_back(face.mIndices[j]);
-            }
-        }
-        //
-        // process material
-        if(mesh->mMaterialIndex >= 0) {
-            aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-            std::vector<Tex> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-            textures.insert(textures.end(), std::make_move_iterator(diffuseMaps.begin()), std::make_move_iterator(diffuseMaps.end()));
-            std::vector<Tex> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-            textures.insert(textures.end(), std::make_move_iterator(specularMaps.begin()), std::make_move_iterator(specularMaps.end()));
-        }
-        //
-        return Mesh(vertices, textures, indices);
-    }
+            // process indices
+            size_t indexCount = 0;
+            for(unsigned int i = 0; i < mesh->mNumFaces; i++) {
+                indexCount += mesh->mFaces[i].mNumIndices;
+            }
+            data.indices.resize(indexCount);
+            unsigned int *index = data.indices.data();
+            for(unsigned int i = 0; i < mesh->mNumFaces; i++) {
+                const aiFace &face = mesh->mFaces[i];
+                index = std::copy(face.mIndices, face.mIndices + face.mNumIndices, index);
+            }
+            
+            // weld and reorder for the post-transform cache, overdraw and fetch
+            if (mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE) {
+                optimizeMesh(data.vertices, data.indices);
+            }
+            
+            // process material
+            if(mesh->mMaterialIndex >= 0) {
+                aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
+                data.textures = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
+                std::vector<TexRef> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+                data.textures.insert(data.textures.end(), std::make_move_iterator(specularMaps.begin()), std::make_move_iterator(specularMaps.end()));
+            }
+            return data;
+        }
 
-        std::vector<Tex> loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName) {
-            std::vector<Tex> textures;
+        std::vector<TexRef> loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName) {
+            std::vector<TexRef> textures;
                     for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
                     {
                         aiString str;
                         mat->GetTexture(type, i, &str);
-                        bool skip = false;
-                        for(unsigned int j = 0; j < textures_loaded.size(); j++)
-                        {
-                            if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                            {
-                                textures.push_back(textures_loaded[j]);
-                                skip = true;
-                                break;
-                            }
-                        }
-                        if(!skip)
-                        {
-                            Tex texture;
-                            texture.id = TextureFromFile(str.C_Str(), this->directory, this->isFlip);
-                            texture.type = typeName;
-                            texture.path = str.C_Str();
-                            textures.push_back(texture);
-                            textures_loaded.push_back(texture);
-                        }
+                        TexRef texture;
+                        texture.type = typeName;
+                        texture.path = str.C_Str();
+                        textures.push_back(texture);
                     }
                     return textures;
                 }
 };
 
-unsigned int TextureFromFile(const char *path, const std::string &directory, bool state)
+// Safe to call from loader threads: the flip flag is set per thread and no
+// GL calls are made.
+ImageData DecodeImage(const std::string &filename, bool state)
 {
-    std::string filename = std::string(path);
-    filename = directory + '/' + filename;
+    ImageData image = {};
+    stbi_set_flip_vertically_on_load_thread(state);
+    image.data = stbi_load(filename.c_str(), &image.width, &image.height, &image.nrComponents, 0);
+    return image;
+}
 
+// Same, from a file already read into memory.
+ImageData DecodeImage(const std::vector<unsigned char> &bytes, bool state)
+{
+    ImageData image = {};
+    stbi_set_flip_vertically_on_load_thread(state);
+    image.data = stbi_load_from_memory(bytes.data(), (int)bytes.size(), &image.width, &image.height, &image.nrComponents, 0);
+    return image;
+}
+
+// Cache key for a file's contents rather than its path: its XXH64 and size.
+std::string ContentKey(const std::vector<unsigned char> &bytes, const TextureOptions &options, double &hashMs)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t hash = xxh64(bytes.data(), bytes.size());
+    char content[48];
+    std::snprintf(content, sizeof(content), "xxh64:%016llx:%llu", (unsigned long long)hash, (unsigned long long)bytes.size());
+    hashMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return TextureCache::key(content, options);
+}
+
+unsigned int UploadTexture(ImageData &image, const std::string &path, const TextureOptions &options)
+{
     unsigned int textureID;
     glGenTextures(1, &textureID);
 
-    int width, height, nrComponents;
-    stbi_set_flip_vertically_on_load(state);
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
+    if (image.data)
     {
         GLenum format;
-        if (nrComponents == 1) {
-            format = GL_RED;
-        } else if (nrComponents == 3) {
+        GLenum internalFormat;
+        if (image.nrComponents == 1) {
+            format = internalFormat = GL_RED;
+        } else if (image.nrComponents == 3) {
             format = GL_RGB;
+            internalFormat = options.srgb ? GL_SRGB8 : GL_RGB;
         } else {
             format = GL_RGBA;
+            internalFormat = options.srgb ? GL_SRGB8_ALPHA8 : GL_RGBA;
+        }
+        if (options.mipmaps && image.mips.levels.empty()) {
+            buildMipChain(image.data, image.width, image.height, image.nrComponents, MipSettings(), image.mips);
         }
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        glState().bindTexture(0, GL_TEXTURE_2D, textureID);
+        // Rows are tightly packed, whatever their width.
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
+        if (options.mipmaps) {
+            for (unsigned int level = 0; level < image.mips.levels.size(); level++) {
+                const MipLevel &mip = image.mips.levels[level];
+                glTexImage2D(GL_TEXTURE_2D, level + 1, internalFormat, mip.width, mip.height, 0, format, GL_UNSIGNED_BYTE, image.mips.level(level));
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.mips.levels.size());
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, options.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        stbi_image_free(data);
+        stbi_image_free(image.data);
     }
     else
     {
         std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        stbi_image_free(image.data);
     }
+    image.data = NULL;
+    image.mips = MipChain();
 
     return textureID;
 }
 
+// The block-compressed form of an image file, read from its .bctex file or,
+// if that is missing or stale, decoded, baked and written there. bytes may
+// hold the file's contents if the caller has them. Safe on loader threads.
+bool BakedTextureFromFile(const std::string &filename, const TextureOptions &options, BakedTexture &baked, const std::vector<unsigned char> *bytes)
+{
+    uint32_t bakeFlags = (options.flip ? BAKE_FLIPPED : 0u) | (options.mipmaps ? BAKE_MIPMAPS : 0u);
+    if (readBakedTexture(filename, bakeFlags, baked)) {
+        size_t rawBytes = (size_t)baked.width * baked.height * baked.channels;
+        textureBakeLog().record(false, 0.0, options.mipmaps ? rawBytes * 4 / 3 : rawBytes, baked.bytes());
+        return true;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<unsigned char> read;
+    if (!bytes) {
+        if (!readFileBytes(filename, read)) {
+            return false;
+        }
+        bytes = &read;
+    }
+    ImageData image = DecodeImage(*bytes, options.flip);
+    if (!image.data) {
+        return false;
+    }
+    bakeTexture(image.data, (uint32_t)image.width, (uint32_t)image.height, image.nrComponents, options.mipmaps, baked);
+    stbi_image_free(image.data);
+    writeBakedTexture(filename, bakeFlags, baked);
+    size_t rawBytes = (size_t)baked.width * baked.height * baked.channels;
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    textureBakeLog().record(true, ms, options.mipmaps ? rawBytes * 4 / 3 : rawBytes, baked.bytes());
+    std::cout << "TEXTURE: baked " << filename << " (" << baked.levels.size() << " levels, " << baked.bytes() / 1024 << " KB) in " << ms << " ms" << std::endl;
+    return true;
+}
+
+// Every level of an image file for textureStreamer(): the baked blocks if
+// options.compress, otherwise the decoded pixels and their CPU mip chain.
+// Safe on loader threads.
+bool TextureSourceFromFile(const std::string &filename, const TextureOptions &options, TextureSource &source, const std::vector<unsigned char> *bytes)
+{
+    if (options.compress && BakedTextureFromFile(filename, options, source.baked, bytes)) {
+        source.compressed = true;
+        source.internalFormat = CompressedInternalFormat(source.baked.format, options.srgb);
+        for (unsigned int level = 0; level < source.baked.levels.size(); level++) {
+            const BakedLevel &baked = source.baked.levels[level];
+            StreamLevel data = {baked.width, baked.height, baked.size, source.baked.blocks + baked.offset};
+            source.levels.push_back(data);
+        }
+        return true;
+    }
+    ImageData image = bytes ? DecodeImage(*bytes, options.flip) : DecodeImage(filename, options.flip);
+    if (!image.data) {
+        return false;
+    }
+    const GLenum formats[4] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+    source.format = formats[image.nrComponents - 1];
+    source.internalFormat = source.format;
+    if (options.srgb && image.nrComponents >= 3) {
+        source.internalFormat = image.nrComponents == 3 ? GL_SRGB8 : GL_SRGB8_ALPHA8;
+    }
+    source.pixels.reset(image.data, stbi_image_free);
+    StreamLevel base = {(uint32_t)image.width, (uint32_t)image.height, (uint32_t)(image.width * image.height * image.nrComponents), image.data};
+    source.levels.push_back(base);
+    if (options.mipmaps) {
+        buildMipChain(image.data, image.width, image.height, image.nrComponents, MipSettings(), source.mips);
+        for (unsigned int level = 0; level < source.mips.levels.size(); level++) {
+            const MipLevel &mip = source.mips.levels[level];
+            StreamLevel data = {mip.width, mip.height, (uint32_t)(mip.width * mip.height * image.nrComponents), source.mips.level(level)};
+            source.levels.push_back(data);
+        }
+    }
+    return true;
+}
+
+GLenum CompressedInternalFormat(Block_Format format, bool srgb)
+{
+    if (format == BLOCK_BC4) {
+        return GL_COMPRESSED_RED_RGTC1;
+    }
+    if (format == BLOCK_BC3) {
+        return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    }
+    return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+}
+
+// Every baked level goes up as it is; nothing is generated on the GPU.
+// Releases the blocks (or the mapping) afterwards.
+unsigned int UploadCompressedTexture(BakedTexture &baked, const TextureOptions &options)
+{
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glState().bindTexture(0, GL_TEXTURE_2D, textureID);
+    GLenum internalFormat = CompressedInternalFormat(baked.format, options.srgb);
+    for (unsigned int level = 0; level < baked.levels.size(); level++) {
+        const BakedLevel &data = baked.levels[level];
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, data.width, data.height, 0, data.size, baked.blocks + data.offset);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)baked.levels.size() - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, baked.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    baked = BakedTexture();
+    return textureID;
+}
+
+// S3TC is an extension, if a universal one; RGTC is core. Needs a current
+// context.
+bool CompressedTexturesSupported()
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+        const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+        if (name && std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 
 #endif
@@ -0,0 +1,75 @@
+#ifndef normalmatrix_hpp
+#define normalmatrix_hpp
+
+#include <cmath>
+#include <glm/glm.hpp>
+#include <simd.hpp>
+
+// Normal matrices, transpose(inverse(mat3(model))), computed on the CPU so
+// the vertex shader does not invert the same matrix for every vertex. With
+// columns c0, c1, c2 of the upper 3x3, the inverse transpose is
+// [c1 x c2, c2 x c0, c0 x c1] / det, which needs no general inverse.
+
+inline glm::mat3 normalMatrix(const glm::mat4 &model) {
+    glm::vec3 c0(model[0]), c1(model[1]), c2(model[2]);
+    glm::vec3 n0 = glm::cross(c1, c2);
+    float det = glm::dot(c0, n0);
+    // Degenerate scales keep the cofactors; the shader renormalizes anyway.
+    float invDet = det != 0.0f ? 1.0f / det : 1.0f;
+    return glm::mat3(n0 * invDet, glm::cross(c2, c0) * invDet, glm::cross(c0, c1) * invDet);
+}
+
+// Batched form, four matrices at a time. Each group is transposed into
+// structure-of-arrays registers, so every lane runs the same cross products.
+inline void normalMatrices(const glm::mat4 *models, unsigned int count, glm::mat3 *out) {
+    unsigned int whole = count & ~3u;
+    float lanes[9][4];
+    for (unsigned int i = 0; i < whole; i += 4) {
+        for (unsigned int lane = 0; lane < 4; lane++) {
+            const glm::mat4 &m = models[i + lane];
+            for (unsigned int column = 0; column < 3; column++) {
+                for (unsigned int row = 0; row < 3; row++) {
+                    lanes[column * 3 + row][lane] = m[column][row];
+                }
+            }
+        }
+        Float4 ax = load4(lanes[0]), ay = load4(lanes[1]), az = load4(lanes[2]);
+        Float4 bx = load4(lanes[3]), by = load4(lanes[4]), bz = load4(lanes[5]);
+        Float4 cx = load4(lanes[6]), cy = load4(lanes[7]), cz = load4(lanes[8]);
+
+        Float4 n0x = sub4(mul4(by, cz), mul4(bz, cy));
+        Float4 n0y = sub4(mul4(bz, cx), mul4(bx, cz));
+        Float4 n0z = sub4(mul4(bx, cy), mul4(by, cx));
+        Float4 n1x = sub4(mul4(cy, az), mul4(cz, ay));
+        Float4 n1y = sub4(mul4(cz, ax), mul4(cx, az));
+        Float4 n1z = sub4(mul4(cx, ay), mul4(cy, ax));
+        Float4 n2x = sub4(mul4(ay, bz), mul4(az, by));
+        Float4 n2y = sub4(mul4(az, bx), mul4(ax, bz));
+        Float4 n2z = sub4(mul4(ax, by), mul4(ay, bx));
+
+        Float4 det = madd4(ax, n0x, madd4(ay, n0y, mul4(az, n0z)));
+        float dets[4];
+        store4(dets, det);
+        for (unsigned int lane = 0; lane < 4; lane++) {
+            dets[lane] = dets[lane] != 0.0f ? dets[lane] : 1.0f;
+        }
+        Float4 invDet = div4(splat4(1.0f), load4(dets));
+
+        store4(lanes[0], mul4(n0x, invDet)); store4(lanes[1], mul4(n0y, invDet)); store4(lanes[2], mul4(n0z, invDet));
+        store4(lanes[3], mul4(n1x, invDet)); store4(lanes[4], mul4(n1y, invDet)); store4(lanes[5], mul4(n1z, invDet));
+        store4(lanes[6], mul4(n2x, invDet)); store4(lanes[7], mul4(n2y, invDet)); store4(lanes[8], mul4(n2z, invDet));
+        for (unsigned int lane = 0; lane < 4; lane++) {
+            glm::mat3 &n = out[i + lane];
+            for (unsigned int column = 0; column < 3; column++) {
+                for (unsigned int row = 0; row < 3; row++) {
+                    n[column][row] = lanes[column * 3 + row][lane];
+                }
+            }
+        }
+    }
+    for (unsigned int i = whole; i < count; i++) {
+        out[i] = normalMatrix(models[i]);
+    }
+}
+
+#endif
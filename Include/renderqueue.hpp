@@ -0,0 +1,319 @@
+#ifndef renderqueue_hpp
+#define renderqueue_hpp
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <shader.hpp>
+#include <glstate.hpp>
+#include <mesh.hpp>
+#include <uniformbuffer.hpp>
+#include <normalmatrix.hpp>
+#include <instancing.hpp>
+#include <geometryarena.hpp>
+
+// Passes run in this order; double-sided geometry (foliage) gets its own
+// pass so face culling is toggled at most twice a frame.
+enum Render_Pass {
+    PASS_OPAQUE = 0,
+    PASS_DOUBLE_SIDED = 1
+};
+
+// Per-draw state that is not part of the mesh itself.
+struct DrawMaterial {
+    unsigned int id;          // small index, only used for sorting
+    unsigned int uniformOffset; // MaterialData range in the frame's UniformRing
+    bool doubleSided;
+};
+
+// Sort key layout, most significant first:
+//   63..62 pass   61..54 program   53..46 material   45..30 texture set
+//   29..6  depth (front to back)   5..0  unused
+// so a sorted queue changes program least often, then material, then
+// textures, and draws near objects first within a state bucket.
+inline uint64_t makeSortKey(unsigned int pass, unsigned int program, unsigned int material, unsigned int textureSet, float depth) {
+    uint64_t depthBits = (uint64_t)(std::min(std::max(depth, 0.0f), 1.0f) * 0xffffff);
+    return (uint64_t)(pass & 0x3) << 62 |
+           (uint64_t)(program & 0xff) << 54 |
+           (uint64_t)(material & 0xff) << 46 |
+           (uint64_t)(textureSet & 0xffff) << 30 |
+           depthBits << 6;
+}
+
+// Sorts order by keys[order[i]] with an LSD radix sort, one byte per pass.
+// Passes where every key has the same byte are skipped, which with this key
+// layout is most of them.
+inline void radixSortKeys(const std::vector<uint64_t> &keys, std::vector<unsigned int> &order) {
+    unsigned int count = (unsigned int)keys.size();
+    order.resize(count);
+    for (unsigned int i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    std::vector<unsigned int> scratch(count);
+    for (unsigned int shift = 0; shift < 64; shift += 8) {
+        unsigned int histogram[256] = {0};
+        for (unsigned int i = 0; i < count; i++) {
+            histogram[(keys[i] >> shift) & 0xff]++;
+        }
+        if (count == 0 || histogram[(keys[0] >> shift) & 0xff] == count) {
+            continue;
+        }
+        unsigned int offset = 0;
+        for (unsigned int b = 0; b < 256; b++) {
+            unsigned int bucket = histogram[b];
+            histogram[b] = offset;
+            offset += bucket;
+        }
+        for (unsigned int i = 0; i < count; i++) {
+            unsigned int item = order[i];
+            scratch[histogram[(keys[item] >> shift) & 0xff]++] = item;
+        }
+        order.swap(scratch);
+    }
+}
+
+// Bind calls issued while executing the queue, and how many a naive
+// bind-everything-per-draw loop would have issued on top of that.
+struct RenderQueueStats {
+    unsigned int draws;
+    unsigned int batches;     // glMultiDrawElementsIndirect calls
+    unsigned int batchedDraws; // draws that went out through them
+    unsigned int programSwitches, programSwitchesSaved;
+    unsigned int materialBinds, materialBindsSaved;
+    unsigned int textureBinds, textureBindsSaved;
+    unsigned int vertexArrayBinds, vertexArrayBindsSaved;
+    unsigned int cullToggles, cullTogglesSaved;
+};
+
+// Collects the frame's draws, sorts them by key and executes them with
+// redundant program, material, texture, vertex array and cull state changes
+// removed. Face culling is left enabled afterwards.
+//
+// Runs of draws that share all of that state and the mesh's vertex format,
+// index type and dequantization differ only in their arena ranges and
+// transforms. With GL 4.3 each run is one glMultiDrawElementsIndirect that
+// reads its transforms as instance data (selected by baseInstance); the
+// GL 4.1 core profile has neither, so there the same run goes out as one
+// glDrawElementsBaseVertex per draw with the transforms as uniforms.
+class RenderQueue {
+public:
+    // Cleared to compare against the per-draw path where multi-draw exists.
+    bool useMultiDraw = true;
+
+    struct DrawItem {
+        Shader *shader;
+        Mesh *mesh;
+        unsigned int lod;
+        unsigned int skybox;
+        DrawMaterial material;
+        glm::mat4 modelMatrix;
+    };
+
+    void clear() {
+        items.clear();
+        keys.clear();
+    }
+
+    // depth is the view distance normalized to [0, 1] (e.g. over the far
+    // plane).
+    void submit(Shader &shader, Mesh &mesh, unsigned int lod, unsigned int skybox, const DrawMaterial &material, const glm::mat4 &modelMatrix, float depth) {
+        DrawItem item = {&shader, &mesh, lod, skybox, material, modelMatrix};
+        items.push_back(item);
+        keys.push_back(makeSortKey(material.doubleSided ? PASS_DOUBLE_SIDED : PASS_OPAQUE, programSlot(shader.ID), material.id, textureSetKey(mesh), depth));
+    }
+
+    void execute(const UniformRing &uniformRing) {
+        stats = RenderQueueStats();
+        radixSortKeys(keys, order);
+        
+        // Normal matrices for the whole queue in one batch, instead of an
+        // inverse per vertex in the shader.
+        models.resize(items.size());
+        normals.resize(items.size());
+        for (unsigned int i = 0; i < items.size(); i++) {
+            models[i] = items[i].modelMatrix;
+        }
+        normalMatrices(models.data(), (unsigned int)models.size(), normals.data());
+        
+        // Transforms in sorted order, so a run's baseInstance is its first
+        // position in the order, and every command written up front.
+        bool multiDraw = useMultiDraw && multiDrawSupported();
+        if (multiDraw && !order.empty()) {
+            sortedModels.resize(order.size());
+            sortedNormals.resize(order.size());
+            commands.resize(order.size());
+            for (unsigned int o = 0; o < order.size(); o++) {
+                const DrawItem &item = items[order[o]];
+                sortedModels[o] = item.modelMatrix;
+                sortedNormals[o] = normals[order[o]];
+                commands[o] = item.mesh->indirectCommand(item.lod, o);
+            }
+            if (!instances) {
+                instances.reset(new InstanceBuffer());
+                glGenBuffers(1, &indirectBuffer);
+            }
+            instances->upload(sortedModels.data(), sortedNormals.data(), (unsigned int)order.size());
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+        }
+
+        // The redundant binds themselves are dropped by glState(); sorting
+        // is what makes most of them redundant.
+        Shader *currentShader = NULL;
+        int modelMatrixLocation = -1, normalMatrixLocation = -1;
+        Mesh *currentMesh = NULL;
+        for (unsigned int o = 0; o < order.size(); o++) {
+            DrawItem &item = items[order[o]];
+            Mesh &mesh = *item.mesh;
+            unsigned int runLength = multiDraw ? batchableRun(o) : 1;
+            stats.draws += runLength;
+
+            if (glState().useProgram(item.shader->ID)) {
+                stats.programSwitches++;
+            } else {
+                stats.programSwitchesSaved++;
+            }
+            if (item.shader != currentShader) {
+                modelMatrixLocation = item.shader->uniform("modelMatrix");
+                normalMatrixLocation = item.shader->uniform("normalMatrix");
+                currentShader = item.shader;
+                currentMesh = NULL;
+            }
+
+            if (uniformRing.bind(MATERIAL_BINDING, item.material.uniformOffset, sizeof(MaterialData))) {
+                stats.materialBinds++;
+            } else {
+                stats.materialBindsSaved++;
+            }
+
+            if (glState().setEnabled(GL_CULL_FACE, !item.material.doubleSided)) {
+                stats.cullToggles++;
+            } else {
+                stats.cullTogglesSaved++;
+            }
+
+            // Sampler and dequantization uniforms belong to the mesh, so two
+            // draws of the same mesh in a row (instances) share them.
+            if (runLength > 1) {
+                mesh.applyUniforms(*item.shader, true);
+                currentMesh = NULL;
+            } else if (&mesh != currentMesh) {
+                mesh.applyUniforms(*item.shader);
+                currentMesh = &mesh;
+            }
+
+            unsigned int textureCount = (unsigned int)std::min(mesh.textures.size(), (size_t)SKYBOX_TEXTURE_UNIT);
+            for (unsigned int unit = 0; unit < textureCount; unit++) {
+                if (glState().bindTexture(unit, GL_TEXTURE_2D, mesh.textures[unit].id)) {
+                    stats.textureBinds++;
+                } else {
+                    stats.textureBindsSaved++;
+                }
+            }
+            if (glState().bindTexture(SKYBOX_TEXTURE_UNIT, GL_TEXTURE_CUBE_MAP, item.skybox)) {
+                stats.textureBinds++;
+            } else {
+                stats.textureBindsSaved++;
+            }
+
+            unsigned int vertexArray = runLength > 1 ? geometryArena().instanceVertexArray(mesh.getVertexFormat(), instances->ID) : mesh.getVAO();
+            if (glState().bindVertexArray(vertexArray)) {
+                stats.vertexArrayBinds++;
+            } else {
+                stats.vertexArrayBindsSaved++;
+            }
+
+            if (runLength > 1) {
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+                glMultiDrawElementsIndirect(GL_TRIANGLES, mesh.getIndexType(), (void*)(o * sizeof(DrawElementsIndirectCommand)), runLength, 0);
+                stats.batches++;
+                stats.batchedDraws += runLength;
+                o += runLength - 1;
+                continue;
+            }
+            currentShader->set(modelMatrixLocation, item.modelMatrix);
+            currentShader->set(normalMatrixLocation, normals[order[o]]);
+            mesh.drawElements(item.lod);
+        }
+        glState().setEnabled(GL_CULL_FACE, true);
+    }
+
+    const RenderQueueStats &lastStats() const {
+        return stats;
+    }
+private:
+    std::vector<DrawItem> items;
+    std::vector<uint64_t> keys;
+    std::vector<unsigned int> order;
+    std::vector<unsigned int> programs;
+    std::vector<glm::mat4> models;
+    std::vector<glm::mat3> normals;
+    std::vector<glm::mat4> sortedModels;
+    std::vector<glm::mat3> sortedNormals;
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::unique_ptr<InstanceBuffer> instances;
+    unsigned int indirectBuffer = 0;
+    
+    static bool multiDrawSupported() {
+        return GLAD_GL_VERSION_4_3 != 0;
+    }
+    
+    // Number of draws from position first in the order that can share one
+    // multi-draw: everything a draw binds or sets per mesh must match.
+    unsigned int batchableRun(unsigned int first) const {
+        const DrawItem &head = items[order[first]];
+        unsigned int end = first + 1;
+        while (end < order.size()) {
+            const DrawItem &item = items[order[end]];
+            if (item.shader != head.shader || item.skybox != head.skybox ||
+                item.material.uniformOffset != head.material.uniformOffset || item.material.doubleSided != head.material.doubleSided ||
+                !sameBatchState(*item.mesh, *head.mesh)) {
+                break;
+            }
+            end++;
+        }
+        return end - first;
+    }
+    static bool sameBatchState(const Mesh &a, const Mesh &b) {
+        if (&a == &b) {
+            return true;
+        }
+        if (a.getVertexFormat() != b.getVertexFormat() || a.getIndexType() != b.getIndexType() || a.textures.size() != b.textures.size()) {
+            return false;
+        }
+        for (unsigned int i = 0; i < a.textures.size(); i++) {
+            if (a.textures[i].id != b.textures[i].id || a.textures[i].type != b.textures[i].type) {
+                return false;
+            }
+        }
+        const VertexQuantization &qa = a.getQuantization(), &qb = b.getQuantization();
+        return qa.positionOffset == qb.positionOffset && qa.positionScale == qb.positionScale &&
+               qa.uvOffset == qb.uvOffset && qa.uvScale == qb.uvScale && qa.octahedralNormals == qb.octahedralNormals;
+    }
+    RenderQueueStats stats = RenderQueueStats();
+
+    // Programs get a dense slot in first-seen order so they fit the key.
+    unsigned int programSlot(unsigned int program) {
+        for (unsigned int i = 0; i < programs.size(); i++) {
+            if (programs[i] == program) {
+                return i;
+            }
+        }
+        programs.push_back(program);
+        return (unsigned int)programs.size() - 1;
+    }
+
+    // Meshes with the same textures hash alike and end up adjacent.
+    static unsigned int textureSetKey(const Mesh &mesh) {
+        uint32_t hash = 2166136261u;
+        for (unsigned int i = 0; i < mesh.textures.size(); i++) {
+            hash = (hash ^ mesh.textures[i].id) * 16777619u;
+        }
+        return (hash ^ (hash >> 16)) & 0xffff;
+    }
+};
+
+#endif
@@ -6,14 +6,19 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glstate.hpp>
 
 class Shader {
 public:
     unsigned int ID;
-    Shader(const char* vertexShaderFilePath, const char* fragmentShaderFilePath) {
+    // Each define is inserted as "#define NAME" after the #version line of
+    // both stages, so one source file can be built into several variants.
+    Shader(const char* vertexShaderFilePath, const char* fragmentShaderFilePath, const std::vector<std::string> &defines = std::vector<std::string>()) {
             std::string vertexCode;
             std::string fragmentCode;
             std::ifstream vShaderFile;
@@ -36,6 +41,8 @@ public:
             {
                 std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
             }
+            insertDefines(vertexCode, defines);
+            insertDefines(fragmentCode, defines);
             const char* vShaderCode = vertexCode.c_str();
             const char* fShaderCode = fragmentCode.c_str();
         
@@ -74,32 +81,121 @@ public:
         }
         glDeleteShader(vertex);
         glDeleteShader(fragment);
+        
+        cacheUniformLocations();
     };
     void use() {
-        glUseProgram(ID);
+        glState().useProgram(ID);
+    }
+    
+    // GLSL 4.1 has no layout(binding = N) for blocks, so the binding point is
+    // assigned here. Programs that don't declare the block are left untouched.
+    void bindBlock(const char *name, unsigned int binding) const {
+        unsigned int index = glGetUniformBlockIndex(ID, name);
+        if (index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(ID, index, binding);
+        }
+    }
+    
+    // Looks a uniform up in the table filled at link time. Resolve handles once
+    // outside the render loop and pass them to set(); -1 means "not active"
+    // and is silently ignored by glUniform*, same as glGetUniformLocation.
+    int uniform(const std::string &name) const {
+        std::unordered_map<std::string, int>::const_iterator it = uniformLocations.find(name);
+        if (it == uniformLocations.end()) {
+            return -1;
+        }
+        return it->second;
+    }
+    
+    void set(int location, float value) const {
+        glUniform1f(location, value);
+    }
+    void set(int location, int value) const {
+        glUniform1i(location, value);
+    }
+    void set(int location, bool value) const {
+        glUniform1i(location, (int)value);
+    }
+    void set(int location, const glm::vec2 &value) const {
+        glUniform2f(location, value.x, value.y);
+    }
+    void set(int location, const glm::vec3 &value) const {
+        glUniform3f(location, value.x, value.y, value.z);
     }
+    void set(int location, const glm::vec4 &value) const {
+        glUniform4f(location, value.x, value.y, value.z, value.w);
+    }
+    void set(int location, const glm::mat3 &value) const {
+        glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+    void set(int location, const glm::mat4 &value) const {
+        glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+    
     void setUniformFloat(const std::string &name, float value) const {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        set(uniform(name), value);
     }
     void setUniformInt(const std::string &name, int value) const
         {
-            glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+            set(uniform(name), value);
         }
     void setUniformVec3(const std::string &name, glm::vec3 value) const {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), value.x, value.y, value.z);
+        set(uniform(name), value);
     }
     void setUniformVec2(const std::string &name, glm::vec2 value) const {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), value.x, value.y);
+        set(uniform(name), value);
     }
     void setUniformVec4(const std::string &name, glm::vec4 value) const {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), value.x, value.y, value.z, value.w);
+        set(uniform(name), value);
     }
     void setUniformMat4(const std::string &name, float *value) const {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, value);
+        glUniformMatrix4fv(uniform(name), 1, GL_FALSE, value);
     }
     void setUniformBool(const std::string &name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        set(uniform(name), value);
+    }
+private:
+    std::unordered_map<std::string, int> uniformLocations;
+    
+    static void insertDefines(std::string &code, const std::vector<std::string> &defines) {
+        if (defines.empty()) {
+            return;
+        }
+        std::string block;
+        for (unsigned int i = 0; i < defines.size(); i++) {
+            block += "#define " + defines[i] + "\n";
+        }
+        size_t lineEnd = code.find('\n');
+        code.insert(lineEnd == std::string::npos ? code.size() : lineEnd + 1, block);
+    }
+    
+    void cacheUniformLocations() {
+        int count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> nameBuffer(maxLength > 0 ? maxLength : 1);
+        uniformLocations.reserve(count);
+        for (int i = 0; i < count; i++) {
+            int length = 0, size = 0;
+            GLenum type;
+            glGetActiveUniform(ID, i, maxLength, &length, &size, &type, &nameBuffer[0]);
+            std::string name(&nameBuffer[0], length);
+            
+            // Arrays of basic types are reported once as "name[0]"; register the
+            // bare name and every element so callers can use either spelling.
+            if (size > 1 || (length > 3 && name.compare(length - 3, 3, "[0]") == 0)) {
+                std::string base = name.substr(0, name.find_last_of('['));
+                uniformLocations[base] = glGetUniformLocation(ID, base.c_str());
+                for (int element = 0; element < size; element++) {
+                    std::string elementName = base + "[" + std::to_string(element) + "]";
+                    uniformLocations[elementName] = glGetUniformLocation(ID, elementName.c_str());
+                }
+            } else {
+                uniformLocations[name] = glGetUniformLocation(ID, name.c_str());
+            }
+        }
     }
 };
 
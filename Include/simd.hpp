@@ -0,0 +1,143 @@
+#ifndef simd_hpp
+#define simd_hpp
+
+// Minimal four-wide float helpers over SSE2 (x86-64) and NEON (Apple
+// silicon), with a scalar fallback for anything else. Only what the
+// batched CPU passes need; data is expected in structure-of-arrays form.
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+
+typedef __m128 Float4;
+
+inline Float4 load4(const float *p) {
+    return _mm_loadu_ps(p);
+}
+inline void store4(float *p, Float4 a) {
+    _mm_storeu_ps(p, a);
+}
+inline Float4 splat4(float v) {
+    return _mm_set1_ps(v);
+}
+inline Float4 add4(Float4 a, Float4 b) {
+    return _mm_add_ps(a, b);
+}
+inline Float4 sub4(Float4 a, Float4 b) {
+    return _mm_sub_ps(a, b);
+}
+inline Float4 mul4(Float4 a, Float4 b) {
+    return _mm_mul_ps(a, b);
+}
+inline Float4 div4(Float4 a, Float4 b) {
+    return _mm_div_ps(a, b);
+}
+// a * b + c
+inline Float4 madd4(Float4 a, Float4 b, Float4 c) {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+inline Float4 abs4(Float4 a) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+}
+// Bit i is set where lane i of a is less than lane i of b.
+inline unsigned int lessMask4(Float4 a, Float4 b) {
+    return (unsigned int)_mm_movemask_ps(_mm_cmplt_ps(a, b));
+}
+
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+
+typedef float32x4_t Float4;
+
+inline Float4 load4(const float *p) {
+    return vld1q_f32(p);
+}
+inline void store4(float *p, Float4 a) {
+    vst1q_f32(p, a);
+}
+inline Float4 splat4(float v) {
+    return vdupq_n_f32(v);
+}
+inline Float4 add4(Float4 a, Float4 b) {
+    return vaddq_f32(a, b);
+}
+inline Float4 sub4(Float4 a, Float4 b) {
+    return vsubq_f32(a, b);
+}
+inline Float4 mul4(Float4 a, Float4 b) {
+    return vmulq_f32(a, b);
+}
+inline Float4 div4(Float4 a, Float4 b) {
+#if defined(__aarch64__)
+    return vdivq_f32(a, b);
+#else
+    // 32-bit ARM has no vector divide: refine the reciprocal estimate twice
+    Float4 reciprocal = vrecpeq_f32(b);
+    reciprocal = vmulq_f32(vrecpsq_f32(b, reciprocal), reciprocal);
+    reciprocal = vmulq_f32(vrecpsq_f32(b, reciprocal), reciprocal);
+    return vmulq_f32(a, reciprocal);
+#endif
+}
+inline Float4 madd4(Float4 a, Float4 b, Float4 c) {
+    return vmlaq_f32(c, a, b);
+}
+inline Float4 abs4(Float4 a) {
+    return vabsq_f32(a);
+}
+inline unsigned int lessMask4(Float4 a, Float4 b) {
+    static const uint32_t bits[4] = {1, 2, 4, 8};
+    uint32x4_t masked = vandq_u32(vcltq_f32(a, b), vld1q_u32(bits));
+    // vaddvq_u32 is AArch64 only; pairwise adds also work on 32-bit ARM
+    uint32x2_t pairs = vpadd_u32(vget_low_u32(masked), vget_high_u32(masked));
+    return vget_lane_u32(vpadd_u32(pairs, pairs), 0);
+}
+
+#else
+
+struct Float4 {
+    float v[4];
+};
+
+inline Float4 load4(const float *p) {
+    Float4 r = {{p[0], p[1], p[2], p[3]}};
+    return r;
+}
+inline void store4(float *p, Float4 a) {
+    for (int i = 0; i < 4; i++) p[i] = a.v[i];
+}
+inline Float4 splat4(float v) {
+    Float4 r = {{v, v, v, v}};
+    return r;
+}
+inline Float4 add4(Float4 a, Float4 b) {
+    for (int i = 0; i < 4; i++) a.v[i] += b.v[i];
+    return a;
+}
+inline Float4 sub4(Float4 a, Float4 b) {
+    for (int i = 0; i < 4; i++) a.v[i] -= b.v[i];
+    return a;
+}
+inline Float4 mul4(Float4 a, Float4 b) {
+    for (int i = 0; i < 4; i++) a.v[i] *= b.v[i];
+    return a;
+}
+inline Float4 div4(Float4 a, Float4 b) {
+    for (int i = 0; i < 4; i++) a.v[i] /= b.v[i];
+    return a;
+}
+inline Float4 madd4(Float4 a, Float4 b, Float4 c) {
+    for (int i = 0; i < 4; i++) a.v[i] = a.v[i] * b.v[i] + c.v[i];
+    return a;
+}
+inline Float4 abs4(Float4 a) {
+    for (int i = 0; i < 4; i++) a.v[i] = a.v[i] < 0.0f ? -a.v[i] : a.v[i];
+    return a;
+}
+inline unsigned int lessMask4(Float4 a, Float4 b) {
+    unsigned int mask = 0;
+    for (int i = 0; i < 4; i++) mask |= a.v[i] < b.v[i] ? 1u << i : 0u;
+    return mask;
+}
+
+#endif
+
+#endif
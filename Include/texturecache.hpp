@@ -0,0 +1,285 @@
+#ifndef texturecache_hpp
+#define texturecache_hpp
+
+#include <climits>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <glad/glad.h>
+#include <glstate.hpp>
+
+// How an image file becomes a GL texture. Two loads of the same file only
+// share a texture if these match too.
+struct TextureOptions {
+    bool flip = false;
+    bool srgb = false;
+    bool mipmaps = true;
+    bool compress = false; // BC blocks from a baked .bctex file
+};
+
+// Absolute path with "." and ".." resolved, so different spellings of one
+// file (e.g. "./Meshes/a/../b/x.png" and "Meshes/b/x.png") give one key.
+// Falls back to the path as given if the file cannot be resolved.
+inline std::string canonicalTexturePath(const std::string &path) {
+#ifdef _WIN32
+    char resolved[_MAX_PATH];
+    if (_fullpath(resolved, path.c_str(), _MAX_PATH)) {
+        return resolved;
+    }
+#else
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved)) {
+        return resolved;
+    }
+#endif
+    return path;
+}
+
+// What one texture cost to load, for the deduplication report.
+struct TextureCost {
+    double decodeMs;
+    size_t bytes; // GPU memory, mips included
+};
+
+struct TextureCacheStats {
+    unsigned int textures;   // live GL textures
+    unsigned int references; // held by models
+    unsigned int loads;      // claims that had to decode and upload
+    unsigned int hits;       // claims answered by an existing texture
+    unsigned int aliases;    // files found byte-identical to a loaded one
+    double hashMs;           // spent hashing file contents
+    double decodeMsSaved;    // by aliases
+    size_t bytesSaved;       // by aliases
+};
+
+// Process-wide table of loaded textures, keyed by canonical path plus
+// options, so every Model referencing a file shares one decode and one
+// upload. Entries are reference counted: claim() takes a reference and
+// release() drops it; unreferenced textures are deleted by collect().
+//
+// claim() may run on loader threads. The first claim of a key has to decode
+// and upload the image itself and hand the id over with publish(); later
+// claims get it through whenReady(), which, like publish() and collect(),
+// only runs on the GL thread.
+//
+// Files with different paths can still hold the same bytes. Before decoding,
+// the first claimant hashes the file and calls claimContent(); if another
+// path already has that content, the key becomes an alias of it, and
+// resolveAlias() publishes it with the other path's texture.
+class TextureCache {
+public:
+    enum Claim {
+        CLAIM_LOAD,
+        CLAIM_SHARED
+    };
+    typedef std::function<void(unsigned int)> ReadyCallback;
+
+    static std::string key(const std::string &canonicalPath, const TextureOptions &options) {
+        std::string result = canonicalPath;
+        result += options.flip ? "|flip" : "|noflip";
+        result += options.srgb ? "|srgb" : "|linear";
+        result += options.mipmaps ? "|mips" : "|nomips";
+        result += options.compress ? "|bc" : "|raw";
+        return result;
+    }
+
+    Claim claim(const std::string &key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unordered_map<std::string, Entry>::iterator it = entries.find(key);
+        if (it != entries.end()) {
+            it->second.references++;
+            hits++;
+            return CLAIM_SHARED;
+        }
+        Entry &entry = entries[key];
+        entry.references = 1;
+        loads++;
+        return CLAIM_LOAD;
+    }
+
+    // contentKey is key() over the content hash instead of the path. Only
+    // for keys claimed with CLAIM_LOAD; CLAIM_SHARED means an alias was made
+    // and resolveAlias() has to be called on the GL thread.
+    Claim claimContent(const std::string &key, const std::string &contentKey, double hashMs) {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->hashMs += hashMs;
+        std::unordered_map<std::string, std::string>::iterator owner = contents.find(contentKey);
+        if (owner == contents.end()) {
+            contents[contentKey] = key;
+            entries[key].contentKey = contentKey;
+            return CLAIM_LOAD;
+        }
+        entries[owner->second].references++;
+        entries[key].aliasOf = owner->second;
+        return CLAIM_SHARED;
+    }
+
+    void resolveAlias(const std::string &key) {
+        std::string owner;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            owner = entries[key].aliasOf;
+        }
+        whenReady(owner, [this, key, owner](unsigned int id) {
+            TextureCost cost = {0.0, 0};
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::unordered_map<std::string, Entry>::iterator it = entries.find(owner);
+                if (it != entries.end()) {
+                    cost = it->second.cost;
+                }
+                aliases++;
+                decodeMsSaved += cost.decodeMs;
+                bytesSaved += cost.bytes;
+            }
+            publish(key, id, cost);
+        });
+    }
+
+    void publish(const std::string &key, unsigned int id, const TextureCost &cost = TextureCost()) {
+        std::vector<ReadyCallback> waiting;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Entry &entry = entries[key];
+            entry.id = id;
+            entry.cost = cost;
+            entry.ready = true;
+            waiting.swap(entry.waiters);
+            if (entry.references == 0) {
+                // Everyone who claimed it has let go, so the texture is
+                // deleted at the next collect(); nobody may bind it.
+                drop(key);
+                waiting.clear();
+            }
+        }
+        for (unsigned int i = 0; i < waiting.size(); i++) {
+            waiting[i](id);
+        }
+    }
+
+    // ready receives the texture id once it has been published; straight
+    // away if it already is.
+    void whenReady(const std::string &key, ReadyCallback ready) {
+        unsigned int id = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::unordered_map<std::string, Entry>::iterator it = entries.find(key);
+            if (it != entries.end() && !it->second.ready) {
+                it->second.waiters.push_back(std::move(ready));
+                return;
+            }
+            if (it != entries.end()) {
+                id = it->second.id;
+            }
+        }
+        ready(id);
+    }
+
+    // Non-blocking peek for GL thread callers that cannot wait: true with
+    // the id if the key has been published.
+    bool readyId(const std::string &key, unsigned int &id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unordered_map<std::string, Entry>::iterator it = entries.find(key);
+        if (it == entries.end() || !it->second.ready) {
+            return false;
+        }
+        id = it->second.id;
+        return true;
+    }
+
+    void release(const std::string &key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        releaseLocked(key);
+    }
+
+    // Replaces a published texture's cost once it is known, for textures
+    // published before they were loaded.
+    void setCost(const std::string &key, const TextureCost &cost) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unordered_map<std::string, Entry>::iterator it = entries.find(key);
+        if (it != entries.end()) {
+            it->second.cost = cost;
+        }
+    }
+
+    // Deletes the textures released since the last call and returns their
+    // names. Those can be handed out again, so glState() forgets what it had
+    // bound.
+    std::vector<unsigned int> collect() {
+        std::vector<unsigned int> deleting;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            deleting.swap(deletions);
+        }
+        if (!deleting.empty()) {
+            glDeleteTextures((GLsizei)deleting.size(), deleting.data());
+            glState().invalidate();
+        }
+        return deleting;
+    }
+
+    TextureCacheStats stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        TextureCacheStats result = {0, 0, loads, hits, aliases, hashMs, decodeMsSaved, bytesSaved};
+        for (std::unordered_map<std::string, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+            result.textures += it->second.ready && it->second.aliasOf.empty() ? 1 : 0;
+            result.references += it->second.references;
+        }
+        return result;
+    }
+private:
+    struct Entry {
+        unsigned int id = 0;
+        unsigned int references = 0;
+        bool ready = false;
+        TextureCost cost = {0.0, 0};
+        std::string contentKey; // set on the path that owns the content
+        std::string aliasOf;    // set on paths sharing another's texture
+        std::vector<ReadyCallback> waiters;
+    };
+    std::unordered_map<std::string, Entry> entries;
+    std::unordered_map<std::string, std::string> contents;
+    std::vector<unsigned int> deletions;
+    unsigned int loads = 0, hits = 0, aliases = 0;
+    double hashMs = 0.0, decodeMsSaved = 0.0;
+    size_t bytesSaved = 0;
+    std::mutex mutex;
+
+    void releaseLocked(const std::string &key) {
+        std::unordered_map<std::string, Entry>::iterator it = entries.find(key);
+        if (it == entries.end() || it->second.references == 0) {
+            return;
+        }
+        if (--it->second.references == 0 && it->second.ready) {
+            drop(key);
+        }
+    }
+    // An alias gives its reference on the owner back; an owner deletes the
+    // texture.
+    void drop(const std::string &key) {
+        Entry &entry = entries[key];
+        std::string owner = entry.aliasOf;
+        if (owner.empty()) {
+            deletions.push_back(entry.id);
+            if (!entry.contentKey.empty()) {
+                contents.erase(entry.contentKey);
+            }
+        }
+        entries.erase(key);
+        if (!owner.empty()) {
+            releaseLocked(owner);
+        }
+    }
+};
+
+// The one cache; see the class comment for which calls are thread-safe.
+inline TextureCache &textureCache() {
+    static TextureCache cache;
+    return cache;
+}
+
+#endif
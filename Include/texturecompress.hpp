@@ -0,0 +1,505 @@
+#ifndef texturecompress_hpp
+#define texturecompress_hpp
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+#include <meshcache.hpp>
+#include <mipmap.hpp>
+
+// CPU block compression for textures. Images are baked once into a
+// .bctex file next to the source, with every mip level already encoded, and
+// later loads hand the blocks to glCompressedTexImage2D as they are. Nothing
+// in here touches GL, so the encoder can be run and checked without a
+// context.
+
+// S3TC is what every desktop driver this runs on supports (GL 4.1 on macOS
+// has no BPTC). glad is generated without the extension, so its enums are
+// spelled out here.
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+enum Block_Format {
+    BLOCK_BC1, // RGB, 8 bytes per 4x4 block
+    BLOCK_BC3, // RGBA: a BC4 alpha block followed by a BC1 colour block
+    BLOCK_BC4  // one channel, 8 bytes per block (RGTC1, core since GL 3.0)
+};
+
+inline Block_Format blockFormatFor(int channels) {
+    if (channels == 1) {
+        return BLOCK_BC4;
+    }
+    return channels == 3 ? BLOCK_BC1 : BLOCK_BC3;
+}
+
+inline size_t blockSize(Block_Format format) {
+    return format == BLOCK_BC3 ? 16 : 8;
+}
+
+inline size_t compressedLevelSize(Block_Format format, uint32_t width, uint32_t height) {
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockSize(format);
+}
+
+// 5:6:5 endpoints, rounded from and expanded back to 8 bits per channel
+// the way decoders do.
+inline uint16_t packRgb565(const float color[3]) {
+    int r = (int)(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    int g = (int)(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+    int b = (int)(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+inline void unpackRgb565(uint16_t packed, float color[3]) {
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (float)((r << 3) | (r >> 2));
+    color[1] = (float)((g << 2) | (g >> 4));
+    color[2] = (float)((b << 3) | (b >> 2));
+}
+
+// Picks the nearest of the four palette entries for each pixel; returns
+// the summed squared error. Indices are 2 bits per pixel, first pixel in
+// the lowest bits.
+inline float assignColorIndices(const unsigned char *rgba, uint16_t color0, uint16_t color1, uint32_t &indices) {
+    float palette[4][3];
+    unpackRgb565(color0, palette[0]);
+    unpackRgb565(color1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+    float error = 0.0f;
+    indices = 0;
+    for (int i = 0; i < 16; i++) {
+        const unsigned char *pixel = rgba + i * 4;
+        float best = 1e30f;
+        uint32_t bestIndex = 0;
+        for (uint32_t p = 0; p < 4; p++) {
+            float dr = pixel[0] - palette[p][0], dg = pixel[1] - palette[p][1], db = pixel[2] - palette[p][2];
+            float distance = dr * dr + dg * dg + db * db;
+            if (distance < best) {
+                best = distance;
+                bestIndex = p;
+            }
+        }
+        indices |= bestIndex << (i * 2);
+        error += best;
+    }
+    return error;
+}
+
+// BC1 colour block from 16 RGBA pixels (alpha ignored). Endpoints start at
+// the extremes of the block along its principal axis and are then refitted
+// once by least squares against the chosen indices, keeping whichever pair
+// reconstructs the block better. Always uses four-colour mode, which is
+// also the only mode BC3 colour blocks have.
+inline void encodeColorBlock(const unsigned char *rgba, unsigned char *out) {
+    float mean[3] = {0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) {
+            mean[c] += rgba[i * 4 + c];
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        mean[c] /= 16.0f;
+    }
+    float covariance[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; i++) {
+        float r = rgba[i * 4] - mean[0], g = rgba[i * 4 + 1] - mean[1], b = rgba[i * 4 + 2] - mean[2];
+        covariance[0] += r * r;
+        covariance[1] += r * g;
+        covariance[2] += r * b;
+        covariance[3] += g * g;
+        covariance[4] += g * b;
+        covariance[5] += b * b;
+    }
+    // Power iteration; a handful of steps is plenty for 16 points.
+    float axis[3] = {1.0f, 1.0f, 1.0f};
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[3] = {
+            covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+            covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+            covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]
+        };
+        float largest = std::max(std::fabs(next[0]), std::max(std::fabs(next[1]), std::fabs(next[2])));
+        if (largest < 1e-6f) {
+            break;
+        }
+        for (int c = 0; c < 3; c++) {
+            axis[c] = next[c] / largest;
+        }
+    }
+    float length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    for (int c = 0; c < 3; c++) {
+        axis[c] /= length;
+    }
+    float lowest = 1e30f, highest = -1e30f;
+    for (int i = 0; i < 16; i++) {
+        float t = (rgba[i * 4] - mean[0]) * axis[0] + (rgba[i * 4 + 1] - mean[1]) * axis[1] + (rgba[i * 4 + 2] - mean[2]) * axis[2];
+        lowest = std::min(lowest, t);
+        highest = std::max(highest, t);
+    }
+    float end0[3], end1[3];
+    for (int c = 0; c < 3; c++) {
+        end0[c] = mean[c] + axis[c] * highest;
+        end1[c] = mean[c] + axis[c] * lowest;
+    }
+    uint16_t color0 = packRgb565(end0), color1 = packRgb565(end1);
+    uint32_t indices;
+    float error = assignColorIndices(rgba, color0, color1, indices);
+
+    // Index p weighs color0 by 1, 0, 2/3 and 1/3.
+    const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+    float alpha2 = 0.0f, beta2 = 0.0f, alphaBeta = 0.0f;
+    float alphaX[3] = {0.0f, 0.0f, 0.0f}, betaX[3] = {0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; i++) {
+        float a = weights[(indices >> (i * 2)) & 3], b = 1.0f - a;
+        alpha2 += a * a;
+        beta2 += b * b;
+        alphaBeta += a * b;
+        for (int c = 0; c < 3; c++) {
+            alphaX[c] += a * rgba[i * 4 + c];
+            betaX[c] += b * rgba[i * 4 + c];
+        }
+    }
+    float determinant = alpha2 * beta2 - alphaBeta * alphaBeta;
+    if (std::fabs(determinant) > 1e-6f) {
+        for (int c = 0; c < 3; c++) {
+            end0[c] = (alphaX[c] * beta2 - betaX[c] * alphaBeta) / determinant;
+            end1[c] = (betaX[c] * alpha2 - alphaX[c] * alphaBeta) / determinant;
+        }
+        uint16_t refined0 = packRgb565(end0), refined1 = packRgb565(end1);
+        uint32_t refinedIndices;
+        float refinedError = assignColorIndices(rgba, refined0, refined1, refinedIndices);
+        if (refinedError < error) {
+            color0 = refined0;
+            color1 = refined1;
+            indices = refinedIndices;
+        }
+    }
+
+    // Four-colour mode needs color0 > color1; swapping the endpoints swaps
+    // indices 0/1 and 2/3. Equal endpoints decode index 0 in either mode.
+    if (color0 < color1) {
+        std::swap(color0, color1);
+        indices ^= 0x55555555u;
+    } else if (color0 == color1) {
+        indices = 0;
+    }
+    out[0] = (unsigned char)(color0 & 0xFF);
+    out[1] = (unsigned char)(color0 >> 8);
+    out[2] = (unsigned char)(color1 & 0xFF);
+    out[3] = (unsigned char)(color1 >> 8);
+    std::memcpy(out + 4, &indices, 4);
+}
+
+// BC4 block from 16 values: the block's maximum and minimum as endpoints,
+// in the eight-value mode, and 3-bit indices to the nearest interpolant.
+inline void encodeValueBlock(const unsigned char *values, unsigned char *out) {
+    unsigned char lowest = 255, highest = 0;
+    for (int i = 0; i < 16; i++) {
+        lowest = std::min(lowest, values[i]);
+        highest = std::max(highest, values[i]);
+    }
+    out[0] = highest;
+    out[1] = lowest;
+    uint64_t indices = 0;
+    if (highest > lowest) {
+        float palette[8];
+        palette[0] = highest;
+        palette[1] = lowest;
+        for (int p = 2; p < 8; p++) {
+            palette[p] = ((8 - p) * highest + (p - 1) * lowest) / 7.0f;
+        }
+        for (int i = 0; i < 16; i++) {
+            float best = 1e30f;
+            uint64_t bestIndex = 0;
+            for (int p = 0; p < 8; p++) {
+                float distance = std::fabs(values[i] - palette[p]);
+                if (distance < best) {
+                    best = distance;
+                    bestIndex = (uint64_t)p;
+                }
+            }
+            indices |= bestIndex << (i * 3);
+        }
+    }
+    for (int b = 0; b < 6; b++) {
+        out[2 + b] = (unsigned char)(indices >> (b * 8));
+    }
+}
+
+// Encodes one image level, rows of blocks spread over threads (0: every
+// core). Pixels have 1 to 4 channels; 2-channel images are treated as grey
+// plus alpha. Partial blocks at the right and bottom edges repeat the last
+// row and column.
+inline void compressLevel(const unsigned char *pixels, uint32_t width, uint32_t height, int channels, Block_Format format, unsigned char *blocks, unsigned int threads = 0) {
+    uint32_t blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+    parallelFor(blocksHigh, 8, threads, [=](unsigned int firstRow, unsigned int lastRow) {
+        unsigned char rgba[64];
+        unsigned char values[16];
+        unsigned char *out = blocks + (size_t)firstRow * blocksWide * blockSize(format);
+        for (uint32_t by = firstRow * 4; by < lastRow * 4; by += 4) {
+            for (uint32_t bx = 0; bx < width; bx += 4) {
+                for (uint32_t y = 0; y < 4; y++) {
+                    for (uint32_t x = 0; x < 4; x++) {
+                        const unsigned char *pixel = pixels + ((size_t)std::min(by + y, height - 1) * width + std::min(bx + x, width - 1)) * channels;
+                        unsigned char *texel = rgba + (y * 4 + x) * 4;
+                        if (channels >= 3) {
+                            texel[0] = pixel[0];
+                            texel[1] = pixel[1];
+                            texel[2] = pixel[2];
+                            texel[3] = channels == 4 ? pixel[3] : 255;
+                        } else {
+                            texel[0] = texel[1] = texel[2] = pixel[0];
+                            texel[3] = channels == 2 ? pixel[1] : 255;
+                        }
+                    }
+                }
+                if (format == BLOCK_BC4) {
+                    for (int i = 0; i < 16; i++) {
+                        values[i] = rgba[i * 4];
+                    }
+                    encodeValueBlock(values, out);
+                } else if (format == BLOCK_BC3) {
+                    for (int i = 0; i < 16; i++) {
+                        values[i] = rgba[i * 4 + 3];
+                    }
+                    encodeValueBlock(values, out);
+                    encodeColorBlock(rgba, out + 8);
+                } else {
+                    encodeColorBlock(rgba, out);
+                }
+                out += blockSize(format);
+            }
+        }
+    });
+}
+
+struct BakedLevel {
+    uint32_t width;
+    uint32_t height;
+    uint32_t offset; // into the block data
+    uint32_t size;
+};
+
+// A compressed image and its mip chain, largest level first. The blocks
+// live either in storage (freshly baked) or in the mapped .bctex file.
+struct BakedTexture {
+    Block_Format format = BLOCK_BC1;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    int channels = 0; // of the source image
+    std::vector<BakedLevel> levels;
+    const unsigned char *blocks = NULL;
+    std::vector<unsigned char> storage;
+    std::unique_ptr<MappedFile> file;
+
+    bool valid() const {
+        return blocks != NULL && !levels.empty();
+    }
+    size_t bytes() const {
+        size_t total = 0;
+        for (size_t i = 0; i < levels.size(); i++) {
+            total += levels[i].size;
+        }
+        return total;
+    }
+};
+
+// Compresses an image and, if mipmaps is set, every level down to 1x1 as
+// built by buildMipChain().
+inline void bakeTexture(const unsigned char *pixels, uint32_t width, uint32_t height, int channels, bool mipmaps, BakedTexture &baked, const MipSettings &mipSettings = MipSettings()) {
+    baked = BakedTexture();
+    baked.format = blockFormatFor(channels);
+    baked.width = width;
+    baked.height = height;
+    baked.channels = channels;
+    uint32_t levelWidth = width, levelHeight = height, offset = 0;
+    while (true) {
+        BakedLevel level = {levelWidth, levelHeight, offset, (uint32_t)compressedLevelSize(baked.format, levelWidth, levelHeight)};
+        baked.levels.push_back(level);
+        offset += level.size;
+        if (!mipmaps || (levelWidth == 1 && levelHeight == 1)) {
+            break;
+        }
+        levelWidth = std::max(levelWidth / 2, 1u);
+        levelHeight = std::max(levelHeight / 2, 1u);
+    }
+    baked.storage.resize(offset);
+
+    MipChain chain;
+    if (mipmaps) {
+        buildMipChain(pixels, width, height, channels, mipSettings, chain);
+    }
+    for (size_t i = 0; i < baked.levels.size(); i++) {
+        const BakedLevel &level = baked.levels[i];
+        const unsigned char *source = i == 0 ? pixels : chain.level(i - 1);
+        compressLevel(source, level.width, level.height, channels, baked.format, baked.storage.data() + level.offset);
+    }
+    baked.blocks = baked.storage.data();
+}
+
+// Layout of a .bctex file, little endian: BakedTextureHeader,
+// BakedLevel[levelCount], then the blocks of every level back to back.
+// Bump the version whenever the encoder or the mip filter changes.
+const uint32_t BAKED_TEXTURE_VERSION = 2;
+
+// Decode-time choices the baked blocks depend on.
+const uint32_t BAKE_FLIPPED = 1u;
+const uint32_t BAKE_MIPMAPS = 2u;
+
+struct BakedTextureHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t sourceMtime;
+    uint32_t bakeFlags;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t levelCount;
+};
+
+// One file per set of bakeFlags, e.g. "wood.png.f1m1.bctex", so models
+// loading the same image flipped and unflipped do not rebake each other's.
+inline std::string bakedTexturePath(const std::string &sourcePath, uint32_t bakeFlags) {
+    std::string flags = ".f" + std::to_string(bakeFlags & BAKE_FLIPPED ? 1 : 0) + "m" + std::to_string(bakeFlags & BAKE_MIPMAPS ? 1 : 0);
+    return sourcePath + flags + ".bctex";
+}
+
+// A temporary name no other thread or process writes to, so loaders baking
+// the same image at once each rename a whole file into place.
+inline std::string uniqueTempPath(const std::string &path) {
+    static std::atomic<unsigned int> counter(0);
+    return path + "." + std::to_string((long long)getpid()) + "." + std::to_string(counter++) + ".tmp";
+}
+
+// Maps a .bctex file. Returns false if it is missing, truncated, or was
+// baked from a different revision of the source or with other bakeFlags.
+inline bool readBakedTexture(const std::string &sourcePath, uint32_t bakeFlags, BakedTexture &baked) {
+    std::unique_ptr<MappedFile> file(new MappedFile(bakedTexturePath(sourcePath, bakeFlags)));
+    if (!file->data || file->size < sizeof(BakedTextureHeader)) {
+        return false;
+    }
+    BakedTextureHeader header;
+    std::memcpy(&header, file->data, sizeof(header));
+    if (std::memcmp(header.magic, "LOGT", 4) != 0 ||
+        header.version != BAKED_TEXTURE_VERSION ||
+        header.bakeFlags != bakeFlags ||
+        header.format > BLOCK_BC4 ||
+        header.levelCount == 0 ||
+        header.sourceMtime != sourceModifiedTime(sourcePath)) {
+        return false;
+    }
+    size_t tableBytes = (size_t)header.levelCount * sizeof(BakedLevel);
+    if (sizeof(header) + tableBytes > file->size) {
+        return false;
+    }
+    std::vector<BakedLevel> levels(header.levelCount);
+    std::memcpy(levels.data(), file->data + sizeof(header), tableBytes);
+    size_t blockBytes = file->size - sizeof(header) - tableBytes;
+    for (size_t i = 0; i < levels.size(); i++) {
+        if (levels[i].size != compressedLevelSize((Block_Format)header.format, levels[i].width, levels[i].height) ||
+            (size_t)levels[i].offset + levels[i].size > blockBytes) {
+            return false;
+        }
+    }
+
+    baked = BakedTexture();
+    baked.format = (Block_Format)header.format;
+    baked.width = header.width;
+    baked.height = header.height;
+    baked.channels = (int)header.channels;
+    baked.levels.swap(levels);
+    baked.blocks = file->data + sizeof(header) + tableBytes;
+    baked.file = std::move(file);
+    return true;
+}
+
+// Writes through a temporary file and renames it into place, like the mesh
+// cache, so an interrupted bake is never picked up.
+inline bool writeBakedTexture(const std::string &sourcePath, uint32_t bakeFlags, const BakedTexture &baked) {
+    std::string path = bakedTexturePath(sourcePath, bakeFlags);
+    std::string tempPath = uniqueTempPath(path);
+    std::ofstream out(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cout << "ERROR::TEXTUREBAKE::COULD_NOT_WRITE " << path << std::endl;
+        return false;
+    }
+    BakedTextureHeader header;
+    std::memcpy(header.magic, "LOGT", 4);
+    header.version = BAKED_TEXTURE_VERSION;
+    header.sourceMtime = sourceModifiedTime(sourcePath);
+    header.bakeFlags = bakeFlags;
+    header.format = (uint32_t)baked.format;
+    header.width = baked.width;
+    header.height = baked.height;
+    header.channels = (uint32_t)baked.channels;
+    header.levelCount = (uint32_t)baked.levels.size();
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)baked.levels.data(), baked.levels.size() * sizeof(BakedLevel));
+    out.write((const char *)baked.blocks, baked.bytes());
+    out.close();
+    if (!out || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        std::cout << "ERROR::TEXTUREBAKE::COULD_NOT_WRITE " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+struct TextureBakeStats {
+    unsigned int baked;     // encoded this run
+    unsigned int reused;    // read back from .bctex files
+    double bakeMs;          // decoding and encoding the baked ones
+    size_t rawBytes;        // the same textures as 8-bit texels, mips included
+    size_t compressedBytes;
+};
+
+// Running totals for the UI; record() may be called from loader threads.
+class TextureBakeLog {
+public:
+    void record(bool baked, double ms, size_t rawBytes, size_t compressedBytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (baked) {
+            totals.baked++;
+            totals.bakeMs += ms;
+        } else {
+            totals.reused++;
+        }
+        totals.rawBytes += rawBytes;
+        totals.compressedBytes += compressedBytes;
+    }
+    TextureBakeStats stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return totals;
+    }
+private:
+    TextureBakeStats totals = {0, 0, 0.0, 0, 0};
+    std::mutex mutex;
+};
+
+inline TextureBakeLog &textureBakeLog() {
+    static TextureBakeLog log;
+    return log;
+}
+
+#endif
@@ -0,0 +1,326 @@
+#ifndef texturestreaming_hpp
+#define texturestreaming_hpp
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glad/glad.h>
+#include <glstate.hpp>
+#include <mipmap.hpp>
+#include <texturecompress.hpp>
+
+// One level of a streamed texture's CPU copy.
+struct StreamLevel {
+    uint32_t width;
+    uint32_t height;
+    uint32_t size;
+    const unsigned char *data;
+};
+
+// What the streamer can upload for one texture: every level, largest first,
+// plus whatever keeps their memory alive (a mapped .bctex file, or decoded
+// pixels and their mip chain).
+struct TextureSource {
+    bool compressed = false;
+    GLenum internalFormat = GL_RGBA;
+    GLenum format = GL_RGBA; // of uncompressed levels
+    std::vector<StreamLevel> levels;
+    BakedTexture baked;
+    MipChain mips;
+    std::shared_ptr<unsigned char> pixels;
+};
+
+struct StreamedTextureStats {
+    std::string name;
+    unsigned int levels;
+    unsigned int resident; // finest level on the GPU
+    unsigned int target;   // finest level the current view wants
+    uint32_t width, height; // of the resident level
+    size_t residentBytes;
+};
+
+struct TextureStreamingStats {
+    unsigned int textures;
+    size_t residentBytes;
+    unsigned int uploads;   // levels uploaded by the last update()
+    unsigned int evictions; // levels dropped by the last update()
+};
+
+// Keeps each streamed texture's finer mip levels on the GPU only while
+// they are worth it. A texture starts as a one-texel placeholder so models
+// can draw before it is decoded; add() then uploads its smallest levels
+// (the tail) and update() brings in finer ones, one level at a time and
+// within a per-frame upload budget, down to the level its on-screen size
+// asks for. When the resident levels exceed budgetBytes, the finest levels
+// of the least recently needed textures are dropped again; the tail always
+// stays.
+//
+// Levels come and go by moving GL_TEXTURE_BASE_LEVEL and re-specifying the
+// dropped level with an empty image, which works on GL 3.3 without
+// immutable storage. The texture name never changes, so meshes keep the id
+// they were given. Everything here runs on the GL thread.
+class TextureStreamer {
+public:
+    // Levels no larger than this are uploaded with the texture and never
+    // evicted.
+    static const uint32_t TAIL_SIZE = 64;
+    // Frames a texture may go unrequested before it counts as unneeded.
+    static const uint64_t KEEP_FRAMES = 60;
+
+    size_t budgetBytes = 256 * 1048576;
+    size_t uploadBytesPerFrame = 8 * 1048576;
+
+    unsigned int createPlaceholder() {
+        static const unsigned char grey[4] = {128, 128, 128, 255};
+        unsigned int id;
+        glGenTextures(1, &id);
+        glState().bindTexture(0, GL_TEXTURE_2D, id);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        return id;
+    }
+
+    // Replaces placeholder id's contents with the tail of source; the rest
+    // follows through update().
+    void add(unsigned int id, const std::string &name, TextureSource &&source) {
+        if (source.levels.empty()) {
+            return;
+        }
+        Entry &entry = entries[id];
+        entry.id = id;
+        entry.name = name;
+        entry.source = std::move(source);
+        unsigned int last = (unsigned int)entry.source.levels.size() - 1;
+        entry.tail = 0;
+        while (entry.tail < last && std::max(entry.source.levels[entry.tail].width, entry.source.levels[entry.tail].height) > TAIL_SIZE) {
+            entry.tail++;
+        }
+        entry.resident = entry.tail;
+        entry.target = entry.tail;
+
+        glState().bindTexture(0, GL_TEXTURE_2D, id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)last);
+        for (unsigned int level = last + 1; level-- > entry.tail;) {
+            specify(entry, level);
+            residentBytes += entry.source.levels[level].size;
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)entry.tail);
+        if (entry.tail > 0) {
+            // The placeholder's texel.
+            release(0);
+        }
+    }
+
+    // Called for every texture of each drawn mesh with the mesh's height on
+    // screen in pixels; the largest request of a frame decides the target.
+    void request(unsigned int id, float screenPixels) {
+        std::unordered_map<unsigned int, Entry>::iterator it = entries.find(id);
+        if (it == entries.end()) {
+            return;
+        }
+        Entry &entry = it->second;
+        if (entry.requestFrame != frame) {
+            entry.requestFrame = frame;
+            entry.requestedPixels = 0.0f;
+        }
+        entry.requestedPixels = std::max(entry.requestedPixels, screenPixels);
+        entry.lastNeeded = frame;
+    }
+
+    // Once per frame: retargets every texture from the requests made since
+    // the last call, evicts down to the budget and streams levels in.
+    void update() {
+        uploads = 0;
+        evictions = 0;
+        for (std::unordered_map<unsigned int, Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+            it->second.target = targetLevel(it->second);
+        }
+        while (residentBytes > budgetBytes && evictOne(NULL)) {
+        }
+
+        // Only textures drawn this frame stream in; the rest keep what they
+        // have until it is evicted.
+        std::vector<Entry *> wanting;
+        for (std::unordered_map<unsigned int, Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+            if (it->second.requestFrame == frame && it->second.resident > it->second.target) {
+                wanting.push_back(&it->second);
+            }
+        }
+        // Most recently needed first, then the furthest from its target.
+        std::sort(wanting.begin(), wanting.end(), [](const Entry *a, const Entry *b) {
+            if (a->lastNeeded != b->lastNeeded) {
+                return a->lastNeeded > b->lastNeeded;
+            }
+            return a->resident - a->target > b->resident - b->target;
+        });
+        size_t uploaded = 0;
+        bool progress = true;
+        while (progress && uploaded < uploadBytesPerFrame) {
+            progress = false;
+            for (unsigned int i = 0; i < wanting.size() && uploaded < uploadBytesPerFrame; i++) {
+                Entry &entry = *wanting[i];
+                if (entry.resident <= entry.target) {
+                    continue;
+                }
+                uint32_t size = entry.source.levels[entry.resident - 1].size;
+                // At least one level per frame, however large.
+                if (uploads > 0 && uploaded + size > uploadBytesPerFrame) {
+                    continue;
+                }
+                while (residentBytes + size > budgetBytes && evictOne(&entry)) {
+                }
+                if (residentBytes + size > budgetBytes) {
+                    continue;
+                }
+                glState().bindTexture(0, GL_TEXTURE_2D, entry.id);
+                specify(entry, entry.resident - 1);
+                entry.resident--;
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)entry.resident);
+                residentBytes += size;
+                uploaded += size;
+                uploads++;
+                progress = true;
+            }
+        }
+        frame++;
+    }
+
+    // For textures the cache has deleted.
+    void remove(unsigned int id) {
+        std::unordered_map<unsigned int, Entry>::iterator it = entries.find(id);
+        if (it == entries.end()) {
+            return;
+        }
+        for (unsigned int level = it->second.resident; level < it->second.source.levels.size(); level++) {
+            residentBytes -= it->second.source.levels[level].size;
+        }
+        entries.erase(it);
+    }
+
+    TextureStreamingStats stats() const {
+        TextureStreamingStats result = {(unsigned int)entries.size(), residentBytes, uploads, evictions};
+        return result;
+    }
+    std::vector<StreamedTextureStats> textureStats() const {
+        std::vector<StreamedTextureStats> result;
+        for (std::unordered_map<unsigned int, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+            const Entry &entry = it->second;
+            StreamedTextureStats texture;
+            texture.name = entry.name;
+            texture.levels = (unsigned int)entry.source.levels.size();
+            texture.resident = entry.resident;
+            texture.target = entry.target;
+            texture.width = entry.source.levels[entry.resident].width;
+            texture.height = entry.source.levels[entry.resident].height;
+            texture.residentBytes = 0;
+            for (unsigned int level = entry.resident; level < entry.source.levels.size(); level++) {
+                texture.residentBytes += entry.source.levels[level].size;
+            }
+            result.push_back(texture);
+        }
+        std::sort(result.begin(), result.end(), [](const StreamedTextureStats &a, const StreamedTextureStats &b) {
+            return a.name < b.name;
+        });
+        return result;
+    }
+private:
+    struct Entry {
+        unsigned int id = 0;
+        std::string name;
+        TextureSource source;
+        unsigned int tail = 0;
+        unsigned int resident = 0;
+        unsigned int target = 0;
+        float requestedPixels = 0.0f;
+        uint64_t requestFrame = UINT64_MAX;
+        uint64_t lastNeeded = 0;
+    };
+    std::unordered_map<unsigned int, Entry> entries;
+    uint64_t frame = 1;
+    size_t residentBytes = 0;
+    unsigned int uploads = 0, evictions = 0;
+
+    // The finest level worth having: about one texel per pixel of the mesh's
+    // screen height, assuming its UVs cover the texture once. Textures not
+    // requested lately only want their tail.
+    unsigned int targetLevel(const Entry &entry) const {
+        if (entry.lastNeeded + KEEP_FRAMES < frame) {
+            return entry.tail;
+        }
+        if (entry.requestFrame != frame) {
+            return entry.target;
+        }
+        const StreamLevel &base = entry.source.levels[0];
+        float texels = (float)std::max(base.width, base.height);
+        float ratio = texels / std::max(entry.requestedPixels, 1.0f);
+        unsigned int level = ratio > 1.0f ? (unsigned int)std::floor(std::log2(ratio)) : 0;
+        return std::min(level, entry.tail);
+    }
+
+    // Drops the finest resident level of one texture other than requester.
+    // Levels finer than their own target go first; after that, only
+    // textures needed less recently than the requester (any texture without
+    // one) give up levels, the least recently needed first.
+    bool evictOne(const Entry *requester) {
+        Entry *victim = NULL;
+        bool victimUnwanted = false;
+        for (std::unordered_map<unsigned int, Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+            Entry &entry = it->second;
+            if (&entry == requester || entry.resident >= entry.tail) {
+                continue;
+            }
+            bool unwanted = entry.resident < entry.target;
+            if (!unwanted && requester && entry.lastNeeded >= requester->lastNeeded) {
+                continue;
+            }
+            if (!victim || (unwanted && !victimUnwanted) || (unwanted == victimUnwanted && entry.lastNeeded < victim->lastNeeded)) {
+                victim = &entry;
+                victimUnwanted = unwanted;
+            }
+        }
+        if (!victim) {
+            return false;
+        }
+        unsigned int level = victim->resident;
+        glState().bindTexture(0, GL_TEXTURE_2D, victim->id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)level + 1);
+        release(level);
+        victim->resident++;
+        residentBytes -= victim->source.levels[level].size;
+        evictions++;
+        return true;
+    }
+
+    // Uploads one level to the bound texture.
+    void specify(const Entry &entry, unsigned int level) {
+        const StreamLevel &data = entry.source.levels[level];
+        if (entry.source.compressed) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, entry.source.internalFormat, data.width, data.height, 0, data.size, data.data);
+        } else {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D, level, entry.source.internalFormat, data.width, data.height, 0, entry.source.format, GL_UNSIGNED_BYTE, data.data);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        }
+    }
+    // Frees one level of the bound texture; it lies outside the base/max
+    // range by now, so its format no longer matters.
+    void release(unsigned int level) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+};
+
+// The one streamer; GL thread only.
+inline TextureStreamer &textureStreamer() {
+    static TextureStreamer streamer;
+    return streamer;
+}
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef uniformbuffer_hpp
+#define uniformbuffer_hpp
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <iostream>
+#include <glstate.hpp>
+
+// Must match MAX_POINT_LIGHTS in the FrameData block of every shader.
+const int MAX_POINT_LIGHTS = 32;
+
+enum UniformBinding {
+    FRAME_BINDING = 0,
+    MATERIAL_BINDING = 1
+};
+
+// The structs below mirror the std140 blocks declared in the shaders, padding
+// included, so they can be copied into the buffer without any repacking.
+struct PointLightData {
+    glm::vec3 position;
+    float linear;
+    float quadratic;
+    float pad[3];
+};
+
+struct SpotLightData {
+    glm::vec3 position;
+    float pad0;
+    glm::vec3 direction;
+    float linear;
+    float quadratic;
+    float cutOff;
+    float outerCutOff;
+    float pad1;
+};
+
+struct FrameData {
+    glm::mat4 viewMatrix;
+    glm::mat4 perspectiveMatrix;
+    glm::vec3 cameraPosition;
+    float time;
+    glm::vec3 direction_light;
+    int nrPointLights;
+    glm::vec3 sunColor;
+    float pad;
+    SpotLightData spotLight;
+    PointLightData pointLights[MAX_POINT_LIGHTS];
+};
+
+struct MaterialData {
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+    float shininess;
+    float reflectiveness;
+    float refractiveness;
+    float pad;
+};
+
+static_assert(sizeof(PointLightData) == 32, "PointLightData must follow std140");
+static_assert(sizeof(SpotLightData) == 48, "SpotLightData must follow std140");
+static_assert(offsetof(FrameData, cameraPosition) == 128, "FrameData must follow std140");
+static_assert(offsetof(FrameData, spotLight) == 176, "FrameData must follow std140");
+static_assert(offsetof(FrameData, pointLights) == 224, "FrameData must follow std140");
+static_assert(sizeof(MaterialData) == 48, "MaterialData must follow std140");
+
+// One uniform buffer split into a slot per frame in flight. Everything pushed
+// during a frame is staged on the CPU, written into the current slot with a
+// single unsynchronized map, and then handed out with glBindBufferRange. A
+// fence per slot keeps the CPU from overwriting data the GPU still reads.
+class UniformRing {
+public:
+    unsigned int ID;
+
+    UniformRing(unsigned int bytesPerFrame, unsigned int framesInFlight = 3) {
+        int alignment = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        this->alignment = alignment > 0 ? alignment : 256;
+        this->frames = framesInFlight;
+        this->slotSize = align(bytesPerFrame);
+        this->fences.assign(frames, (GLsync)0);
+
+        glGenBuffers(1, &ID);
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferData(GL_UNIFORM_BUFFER, slotSize * frames, NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void beginFrame() {
+        slot = (slot + 1) % frames;
+        if (fences[slot]) {
+            glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            glDeleteSync(fences[slot]);
+            fences[slot] = 0;
+        }
+        staging.clear();
+    }
+
+    // Returns the offset of the data within this frame's slot.
+    template <typename T>
+    unsigned int push(const T &data) {
+        unsigned int offset = align((unsigned int)staging.size());
+        staging.resize(offset + sizeof(T));
+        std::memcpy(&staging[offset], &data, sizeof(T));
+        return offset;
+    }
+
+    void upload() {
+        if (staging.empty()) {
+            return;
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        if (staging.size() > slotSize) {
+            grow((unsigned int)staging.size());
+        }
+        void *dst = glMapBufferRange(GL_UNIFORM_BUFFER, slot * slotSize, staging.size(),
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (dst) {
+            std::memcpy(dst, &staging[0], staging.size());
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+        } else {
+            std::cout << "ERROR::UNIFORMRING::MAP_FAILED" << std::endl;
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // Returns false if that exact range was already bound.
+    bool bind(unsigned int binding, unsigned int offset, unsigned int size) const {
+        return glState().bindUniformBufferRange(binding, ID, slot * slotSize + offset, size);
+    }
+
+    void endFrame() {
+        fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+private:
+    unsigned int alignment;
+    unsigned int frames;
+    unsigned int slotSize;
+    unsigned int slot = 0;
+    std::vector<GLsync> fences;
+    std::vector<unsigned char> staging;
+
+    unsigned int align(unsigned int offset) const {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    // Orphans the old storage, so no fence needs to be waited on.
+    void grow(unsigned int bytesPerFrame) {
+        slotSize = align(bytesPerFrame);
+        glBufferData(GL_UNIFORM_BUFFER, slotSize * frames, NULL, GL_DYNAMIC_DRAW);
+        for (unsigned int i = 0; i < frames; i++) {
+            if (fences[i]) {
+                glDeleteSync(fences[i]);
+                fences[i] = 0;
+            }
+        }
+    }
+};
+
+#endif
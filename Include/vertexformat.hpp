@@ -0,0 +1,187 @@
+#ifndef vertexformat_hpp
+#define vertexformat_hpp
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+struct Vertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texCoord;
+};
+
+// GPU vertex layouts a Mesh can be uploaded with. The compact layouts are
+// 16 bytes: position as unorm16 against the mesh bounds, normal octahedral
+// encoded in two snorm16, and UVs either as half floats or as unorm16
+// against the mesh's UV bounds.
+enum Vertex_Format {
+    VERTEX_FLOAT,
+    VERTEX_COMPACT_HALF_UV,
+    VERTEX_COMPACT_UNORM_UV
+};
+
+struct CompactVertex {
+    uint16_t position[4];
+    int16_t normal[2];
+    uint16_t texCoord[2];
+};
+
+static_assert(sizeof(CompactVertex) == 16, "CompactVertex must stay 16 bytes");
+
+// Affine transforms vertex.vert applies to undo the quantization. Identity
+// for VERTEX_FLOAT.
+struct VertexQuantization {
+    glm::vec3 positionOffset;
+    glm::vec3 positionScale;
+    glm::vec2 uvOffset;
+    glm::vec2 uvScale;
+    bool octahedralNormals;
+};
+
+// Largest reconstruction error allowed before a mesh falls back to floats:
+// position relative to the bounds diagonal, normal as 1 - cos(angle), UV in
+// absolute texture coordinates.
+const float MAX_POSITION_ERROR = 1e-4f;
+const float MAX_NORMAL_ERROR = 1e-4f;
+const float MAX_TEXCOORD_ERROR = 1e-3f;
+
+struct QuantizationError {
+    float position;
+    float normal;
+    float texCoord;
+};
+
+inline int16_t packSnorm16(float v) {
+    return (int16_t)std::lround(std::min(std::max(v, -1.0f), 1.0f) * 32767.0f);
+}
+inline float unpackSnorm16(int16_t v) {
+    return std::max(v / 32767.0f, -1.0f);
+}
+inline uint16_t packUnorm16(float v) {
+    return (uint16_t)std::lround(std::min(std::max(v, 0.0f), 1.0f) * 65535.0f);
+}
+inline float unpackUnorm16(uint16_t v) {
+    return v / 65535.0f;
+}
+
+// Octahedral mapping; signs of zero count as positive on both the CPU and
+// the shader side so the two decoders agree exactly.
+inline glm::vec2 encodeOctahedral(glm::vec3 n) {
+    n /= (std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z));
+    glm::vec2 e(n.x, n.y);
+    if (n.z < 0.0f) {
+        e = glm::vec2((1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                      (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+    }
+    return e;
+}
+inline glm::vec3 decodeOctahedral(glm::vec2 e) {
+    glm::vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+    if (n.z < 0.0f) {
+        n = glm::vec3((1.0f - std::fabs(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f),
+                      (1.0f - std::fabs(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f),
+                      n.z);
+    }
+    return glm::normalize(n);
+}
+
+inline VertexQuantization identityQuantization() {
+    VertexQuantization q;
+    q.positionOffset = glm::vec3(0.0f);
+    q.positionScale = glm::vec3(1.0f);
+    q.uvOffset = glm::vec2(0.0f);
+    q.uvScale = glm::vec2(1.0f);
+    q.octahedralNormals = false;
+    return q;
+}
+
+// Same math as the dequantization in vertex.vert.
+inline Vertex decodeCompactVertex(const CompactVertex &c, Vertex_Format format, const VertexQuantization &q) {
+    Vertex v;
+    v.position = q.positionOffset + q.positionScale * glm::vec3(unpackUnorm16(c.position[0]), unpackUnorm16(c.position[1]), unpackUnorm16(c.position[2]));
+    v.normal = decodeOctahedral(glm::vec2(unpackSnorm16(c.normal[0]), unpackSnorm16(c.normal[1])));
+    if (format == VERTEX_COMPACT_HALF_UV) {
+        v.texCoord = glm::vec2(glm::unpackHalf1x16(c.texCoord[0]), glm::unpackHalf1x16(c.texCoord[1]));
+    } else {
+        v.texCoord = q.uvOffset + q.uvScale * glm::vec2(unpackUnorm16(c.texCoord[0]), unpackUnorm16(c.texCoord[1]));
+    }
+    return v;
+}
+
+// Encodes vertices into one of the compact layouts and measures the worst
+// reconstruction error, so callers can check it against the MAX_*_ERROR
+// tolerances before committing to the compact buffer.
+inline QuantizationError quantizeVertices(const Vertex *vertices, unsigned int count, Vertex_Format format, std::vector<CompactVertex> &out, VertexQuantization &q) {
+    QuantizationError error = {0.0f, 0.0f, 0.0f};
+    q = identityQuantization();
+    out.resize(count);
+    if (count == 0) {
+        return error;
+    }
+
+    glm::vec3 minPosition = vertices[0].position, maxPosition = vertices[0].position;
+    glm::vec2 minUV = vertices[0].texCoord, maxUV = vertices[0].texCoord;
+    for (unsigned int i = 1; i < count; i++) {
+        minPosition = glm::min(minPosition, vertices[i].position);
+        maxPosition = glm::max(maxPosition, vertices[i].position);
+        minUV = glm::min(minUV, vertices[i].texCoord);
+        maxUV = glm::max(maxUV, vertices[i].texCoord);
+    }
+    q.positionOffset = minPosition;
+    q.positionScale = maxPosition - minPosition;
+    q.octahedralNormals = true;
+    if (format == VERTEX_COMPACT_UNORM_UV) {
+        q.uvOffset = minUV;
+        q.uvScale = maxUV - minUV;
+    }
+    glm::vec3 inversePositionScale(q.positionScale.x > 0.0f ? 1.0f / q.positionScale.x : 0.0f,
+                                   q.positionScale.y > 0.0f ? 1.0f / q.positionScale.y : 0.0f,
+                                   q.positionScale.z > 0.0f ? 1.0f / q.positionScale.z : 0.0f);
+    glm::vec2 inverseUVScale(q.uvScale.x > 0.0f ? 1.0f / q.uvScale.x : 0.0f,
+                             q.uvScale.y > 0.0f ? 1.0f / q.uvScale.y : 0.0f);
+    float diagonal = glm::length(q.positionScale);
+
+    for (unsigned int i = 0; i < count; i++) {
+        const Vertex &v = vertices[i];
+        CompactVertex &c = out[i];
+        glm::vec3 p = (v.position - q.positionOffset) * inversePositionScale;
+        c.position[0] = packUnorm16(p.x);
+        c.position[1] = packUnorm16(p.y);
+        c.position[2] = packUnorm16(p.z);
+        c.position[3] = 0;
+
+        float length = glm::length(v.normal);
+        glm::vec2 e = encodeOctahedral(length > 0.0f ? v.normal / length : glm::vec3(0.0f, 0.0f, 1.0f));
+        c.normal[0] = packSnorm16(e.x);
+        c.normal[1] = packSnorm16(e.y);
+
+        if (format == VERTEX_COMPACT_HALF_UV) {
+            c.texCoord[0] = glm::packHalf1x16(v.texCoord.x);
+            c.texCoord[1] = glm::packHalf1x16(v.texCoord.y);
+        } else {
+            glm::vec2 uv = (v.texCoord - q.uvOffset) * inverseUVScale;
+            c.texCoord[0] = packUnorm16(uv.x);
+            c.texCoord[1] = packUnorm16(uv.y);
+        }
+
+        Vertex decoded = decodeCompactVertex(c, format, q);
+        if (diagonal > 0.0f) {
+            error.position = std::max(error.position, glm::length(decoded.position - v.position) / diagonal);
+        }
+        if (length > 0.0f) {
+            error.normal = std::max(error.normal, 1.0f - glm::dot(decoded.normal, v.normal / length));
+        }
+        error.texCoord = std::max(error.texCoord, std::max(std::fabs(decoded.texCoord.x - v.texCoord.x), std::fabs(decoded.texCoord.y - v.texCoord.y)));
+    }
+    return error;
+}
+
+inline bool withinTolerance(const QuantizationError &error) {
+    return error.position <= MAX_POSITION_ERROR && error.normal <= MAX_NORMAL_ERROR && error.texCoord <= MAX_TEXCOORD_ERROR;
+}
+
+#endif
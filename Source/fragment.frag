@@ -13,26 +13,12 @@ uniform sampler2D texture_specular2;
 
 uniform samplerCube skybox;
 
-uniform vec3 cameraPosition;
-uniform vec3 sunColor;
-
-const int nrPointLights = 4;
-struct Material {
-    vec4 diffuse;
-    vec4 specular;
-    float shininess;
-    float reflectiveness;
-    float refractiveness;
-};
-uniform Material material;
-
+const int MAX_POINT_LIGHTS = 32;
 struct PointLight {
     vec3 position;
     float linear;
     float quadratic;
 };
-uniform PointLight pointLights[nrPointLights];
-
 struct SpotLight {
     vec3 position;
     vec3 direction;
@@ -41,9 +27,25 @@ struct SpotLight {
     float cutOff;
     float outerCutOff;
 };
-uniform SpotLight spotLight;
+layout (std140) uniform FrameData {
+    mat4 viewMatrix;
+    mat4 perspectiveMatrix;
+    vec3 cameraPosition;
+    float time;
+    vec3 direction_light;
+    int nrPointLights;
+    vec3 sunColor;
+    SpotLight spotLight;
+    PointLight pointLights[MAX_POINT_LIGHTS];
+};
 
-uniform vec3 direction_light;
+layout (std140) uniform MaterialData {
+    vec4 diffuse;
+    vec4 specular;
+    float shininess;
+    float reflectiveness;
+    float refractiveness;
+} material;
 
 vec4 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir) {
     vec3 lightDir = normalize(light.position - fragPos);
@@ -91,7 +93,7 @@ void main()
     
     vec4 col = vec4(0.0);
     vec3 viewDir = normalize(cameraPosition - fPosition);
-    for(int i = 0; i < nrPointLights; i++) {
+    for(int i = 0; i < min(nrPointLights, MAX_POINT_LIGHTS); i++) {
         col += CalcPointLight(pointLights[i], fNormal, fPosition, viewDir);
     }
     col += CalcSpotLight(spotLight, fNormal, fPosition, viewDir);
@@ -6,6 +6,7 @@
 // Implemented features:
 //  [X] Renderer: User texture binding. Use 'GLuint' OpenGL texture identifier as void*/ImTextureID. Read the FAQ about ImTextureID!
 //  [x] Renderer: Desktop GL only: Support for large meshes (64k+ vertices) with 16-bit indices.
+//  [x] Renderer: Desktop GL 3.2+ only: Optional ring buffer uploading every draw list of a frame at once. See ImGui_ImplOpenGL3_SetBufferRing().
 
 // You can copy and use unmodified imgui_impl_* files in your project. See examples/ folder for examples of using this.
 // If you are new to Dear ImGui, read documentation from the docs/ folder + read the top of imgui.cpp.
@@ -143,6 +144,16 @@ using namespace gl;
 #define IMGUI_IMPL_OPENGL_MAY_HAVE_PRIMITIVE_RESTART
 #endif
 
+// Desktop GL 3.2+ has fences, and glDrawElementsBaseVertex() lets every draw list share one buffer: the buffer ring needs both.
+#if defined(IMGUI_IMPL_OPENGL_MAY_HAVE_VTX_OFFSET)
+#define IMGUI_IMPL_OPENGL_MAY_HAVE_BUFFER_RING
+#endif
+
+// Desktop GL 4.4+ has glBufferStorage(), which lets the buffer ring stay mapped
+#if defined(IMGUI_IMPL_OPENGL_MAY_HAVE_BUFFER_RING) && defined(GL_VERSION_4_4)
+#define IMGUI_IMPL_OPENGL_MAY_HAVE_BUFFER_STORAGE
+#endif
+
 // OpenGL Data
 static GLuint       g_GlVersion = 0;                // Extracted at runtime using GL_MAJOR_VERSION, GL_MINOR_VERSION queries (e.g. 320 for GL 3.2)
 static char         g_GlslVersionString[32] = "";   // Specified by user or detected based on compile time GL settings.
@@ -151,6 +162,37 @@ static GLuint       g_ShaderHandle = 0, g_VertHandle = 0, g_FragHandle = 0;
 static GLint        g_AttribLocationTex = 0, g_AttribLocationProjMtx = 0;                                // Uniforms location
 static GLuint       g_AttribLocationVtxPos = 0, g_AttribLocationVtxUV = 0, g_AttribLocationVtxColor = 0; // Vertex attributes location
 static unsigned int g_VboHandle = 0, g_ElementsHandle = 0;
+static ImGui_ImplOpenGL3_RenderStats g_RenderStats = {};
+
+// Buffer ring: one vertex and one index buffer, each split into a region per frame in flight.
+// A frame writes all of its draw lists into the next region, after waiting on the fence placed when that region was last drawn from.
+#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_BUFFER_RING
+static const int    g_RingFrames = 3;
+static bool         g_RingEnabled = false;
+static bool         g_RingPersistent = false;       // Mapped once with glBufferStorage() instead of glMapBufferRange() every frame
+static int          g_RingSlot = 0;
+static int          g_RingVtxCapacity = 0, g_RingIdxCapacity = 0;   // Per region, in vertices and indices
+static unsigned int g_RingVboHandle = 0, g_RingElementsHandle = 0;
+static ImDrawVert*  g_RingVtxMapped = NULL;
+static ImDrawIdx*   g_RingIdxMapped = NULL;
+static GLsync       g_RingFences[g_RingFrames] = {};
+
+// Command merging: the frame's draws after merging, and the indices they use, packed and rebased
+struct ImGui_ImplOpenGL3_MergedCmd
+{
+    GLint               Scissor[4];     // As passed to glScissor()
+    ImTextureID         TextureId;
+    int                 BaseVertex;     // From the start of the frame's ring region
+    int                 IdxOffset;      // Into g_MergedIdx
+    int                 ElemCount;
+    const ImDrawList*   CmdList;        // Set for user callbacks, which get their original command
+    const ImDrawCmd*    Callback;
+};
+static bool         g_MergeEnabled = false;
+static ImVector<ImGui_ImplOpenGL3_MergedCmd> g_MergedCmds;
+static ImVector<ImDrawIdx> g_MergedIdx;
+static ImVector<ImVec4> g_MergedClipped;    // Geometry bounds and own box of each command in the last draw that its box cuts
+#endif
 
 // Functions
 bool    ImGui_ImplOpenGL3_Init(const char* glsl_version)
@@ -244,7 +286,283 @@ void    ImGui_ImplOpenGL3_NewFrame()
         ImGui_ImplOpenGL3_CreateDeviceObjects();
 }
 
-static void ImGui_ImplOpenGL3_SetupRenderState(ImDrawData* draw_data, int fb_width, int fb_height, GLuint vertex_array_object)
+void    ImGui_ImplOpenGL3_SetBufferRing(bool enabled)
+{
+#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_BUFFER_RING
+    g_RingEnabled = enabled;
+#else
+    IM_UNUSED(enabled);
+#endif
+}
+
+void    ImGui_ImplOpenGL3_SetMergeCommands(bool enabled)
+{
+#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_BUFFER_RING
+    g_MergeEnabled = enabled;
+#else
+    IM_UNUSED(enabled);
+#endif
+}
+
+ImGui_ImplOpenGL3_RenderStats ImGui_ImplOpenGL3_GetRenderStats()
+{
+    return g_RenderStats;
+}
+
+#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_BUFFER_RING
+static void ImGui_ImplOpenGL3_DestroyBufferRing()
+{
+    for (int i = 0; i < g_RingFrames; i++)
+        if (g_RingFences[i]) { glDeleteSync(g_RingFences[i]); g_RingFences[i] = 0; }
+    // Deleting a buffer unmaps it
+    if (g_RingVboHandle)        { glDeleteBuffers(1, &g_RingVboHandle); g_RingVboHandle = 0; }
+    if (g_RingElementsHandle)   { glDeleteBuffers(1, &g_RingElementsHandle); g_RingElementsHandle = 0; }
+    g_RingVtxMapped = NULL;
+    g_RingIdxMapped = NULL;
+    g_RingVtxCapacity = g_RingIdxCapacity = 0;
+    g_RingPersistent = false;
+}
+
+// Regions get half again what the frame needs, so a UI that keeps growing by a few vertices doesn't reallocate every frame.
+// Buffers are created and mapped through GL_COPY_WRITE_BUFFER, which leaves the array and VAO bindings alone.
+static void ImGui_ImplOpenGL3_CreateBufferRing(int vtx_count, int idx_count)
+{
+    ImGui_ImplOpenGL3_DestroyBufferRing();
+    g_RingVtxCapacity = vtx_count + vtx_count / 2 > 16384 ? vtx_count + vtx_count / 2 : 16384;
+    g_RingIdxCapacity = idx_count + idx_count / 2 > 32768 ? idx_count + idx_count / 2 : 32768;
+    GLsizeiptr vtx_size = (GLsizeiptr)g_RingVtxCapacity * g_RingFrames * (int)sizeof(ImDrawVert);
+    GLsizeiptr idx_size = (GLsizeiptr)g_RingIdxCapacity * g_RingFrames * (int)sizeof(ImDrawIdx);
+    glGenBuffers(1, &g_RingVboHandle);
+    glGenBuffers(1, &g_RingElementsHandle);
+#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_BUFFER_STORAGE
+    if (g_GlVersion >= 440)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, g_RingVboHandle);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, vtx_size, NULL, flags);
+        g_RingVtxMapped = (ImDrawVert*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, vtx_size, flags);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, g_RingElementsHandle);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, idx_size, NULL, flags);
+        g_RingIdxMapped = (ImDrawIdx*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, idx_size, flags);
+        g_RingPersistent = g_RingVtxMapped != NULL && g_RingIdxMapped != NULL;
+        if (!g_RingPersistent)
+        {
+            // The storage also allows ordinary maps, so carry on mapping every frame
+            fprintf(stderr, "ERROR: ImGui_ImplOpenGL3_CreateBufferRing: failed to map persistently!\n");
+            if (g_RingVtxMapped) { glBindBuffer(GL_COPY_WRITE_BUFFER, g_RingVboHandle); glUnmapBuffer(GL_COPY_WRITE_BUFFER); }
+            if (g_RingIdxMapped) { glBindBuffer(GL_COPY_WRITE_BUFFER, g_RingElementsHandle); glUnmapBuffer(GL_COPY_WRITE_BUFFER); }
+            g_RingVtxMapped = NULL;
+            g_RingIdxMapped = NULL;
+        }
+    }
+    else
+#endif
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, g_RingVboHandle);
+        glBufferData(GL_COPY_WRITE_BUFFER, vtx_size, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, g_RingElementsHandle);
+        glBufferData(GL_COPY_WRITE_BUFFER, idx_size, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+// Writes every draw list of the frame back to back into the next region of the ring, or the vertices and packed_idx when merging.
+// Without persistent storage the region is mapped unsynchronized: its fence already guarantees the GPU is done with it.
+static bool ImGui_ImplOpenGL3_UploadBufferRing(ImDrawData* draw_data, const ImVector<ImDrawIdx>* packed_idx)
+{
+    if (draw_data->TotalVtxCount > g_RingVtxCapacity || draw_data->TotalIdxCount > g_RingIdxCapacity)
+        ImGui_ImplOpenGL3_CreateBufferRing(draw_data->TotalVtxCount, draw_data->TotalIdxCount);
+    g_RingSlot = (g_RingSlot + 1) % g_RingFrames;
+    if (g_RingFences[g_RingSlot])
+    {
+        if (glClientWaitSync(g_RingFences[g_RingSlot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) != GL_ALREADY_SIGNALED)
+            g_RenderStats.FenceWaits++;
+        glDeleteSync(g_RingFences[g_RingSlot]);
+        g_RingFences[g_RingSlot] = 0;
+    }
+    const int idx_count = packed_idx ? packed_idx->Size : draw_data->TotalIdxCount;
+    if (draw_data->TotalVtxCount == 0 || idx_count == 0)
+        return true;
+
+    ImDrawVert* vtx_dst = g_RingVtxMapped;
+    ImDrawIdx* idx_dst = g_RingIdxMapped;
+    const GLbitfield map_flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+    if (g_RingPersistent)
+        vtx_dst += g_RingSlot * g_RingVtxCapacity;
+    else
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, g_RingVboHandle);
+        vtx_dst = (ImDrawVert*)glMapBufferRange(GL_COPY_WRITE_BUFFER, (GLintptr)g_RingSlot * g_RingVtxCapacity * (int)sizeof(ImDrawVert), (GLsizeiptr)draw_data->TotalVtxCount * (int)sizeof(ImDrawVert), map_flags);
+        g_RenderStats.BufferCalls++;
+    }
+    if (vtx_dst == NULL)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return false;
+    }
+    for (int n = 0; n < draw_data->CmdListsCount; n++)
+    {
+        const ImDrawList* cmd_list = draw_data->CmdLists[n];
+        memcpy(vtx_dst, cmd_list->VtxBuffer.Data, (size_t)cmd_list->VtxBuffer.Size * sizeof(ImDrawVert));
+        vtx_dst += cmd_list->VtxBuffer.Size;
+    }
+
+    if (g_RingPersistent)
+        idx_dst += g_RingSlot * g_RingIdxCapacity;
+    else
+    {
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, g_RingElementsHandle);
+        idx_dst = (ImDrawIdx*)glMapBufferRange(GL_COPY_WRITE_BUFFER, (GLintptr)g_RingSlot * g_RingIdxCapacity * (int)sizeof(ImDrawIdx), (GLsizeiptr)idx_count * (int)sizeof(ImDrawIdx), map_flags);
+        g_RenderStats.BufferCalls++;
+    }
+    if (idx_dst == NULL)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return false;
+    }
+    if (packed_idx)
+        memcpy(idx_dst, packed_idx->Data, (size_t)idx_count * sizeof(ImDrawIdx));
+    else
+        for (int n = 0; n < draw_data->CmdListsCount; n++)
+        {
+            const ImDrawList* cmd_list = draw_data->CmdLists[n];
+            memcpy(idx_dst, cmd_list->IdxBuffer.Data, (size_t)cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx));
+            idx_dst += cmd_list->IdxBuffer.Size;
+        }
+    if (!g_RingPersistent)
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return true;
+}
+
+// Rectangles below are (x0, y0, x1, y1) in framebuffer pixels, y up like glScissor().
+// True if drawing with scissor instead of box adds no pixels: all of bounds that scissor lets through, box lets through too.
+static bool ImGui_ImplOpenGL3_ClipsAlike(const ImVec4& bounds, const ImVec4& box, const ImVec4& scissor)
+{
+    ImVec4 inside(bounds.x > scissor.x ? bounds.x : scissor.x, bounds.y > scissor.y ? bounds.y : scissor.y,
+                  bounds.z < scissor.z ? bounds.z : scissor.z, bounds.w < scissor.w ? bounds.w : scissor.w);
+    if (inside.x >= inside.z || inside.y >= inside.w)
+        return true;
+    return inside.x >= box.x && inside.y >= box.y && inside.z <= box.z && inside.w <= box.w;
+}
+
+// Builds g_MergedCmds and g_MergedIdx for the frame. Consecutive commands with one texture and base vertex become one draw
+// scissored by the union of their boxes, as long as that union lets no more of any of them through than its own box did.
+// Boxes are the integer rectangles glScissor() receives, so merging never changes what is drawn.
+// Commands outside the framebuffer are dropped here, which lets their neighbours merge across them.
+static void ImGui_ImplOpenGL3_MergeDrawCommands(ImDrawData* draw_data, int fb_width, int fb_height)
+{
+    ImVec2 clip_off = draw_data->DisplayPos;
+    ImVec2 clip_scale = draw_data->FramebufferScale;
+    const unsigned int max_index = sizeof(ImDrawIdx) == 2 ? 0xFFFF : 0xFFFFFFFF;
+    const int max_clipped = 32;     // Bounds the checks each merge makes
+    g_MergedCmds.resize(0);
+    g_MergedIdx.resize(draw_data->TotalIdxCount);
+    int idx_count = 0;
+    int list_vtx_offset = 0;    // First vertex of the list in the packed vertices
+    int base_vertex = 0;        // What the packed indices are relative to; moves on when 16-bit indices would overflow
+    bool can_merge = false;     // The last command is a draw that may take the next one
+    for (int n = 0; n < draw_data->CmdListsCount; n++)
+    {
+        const ImDrawList* cmd_list = draw_data->CmdLists[n];
+        for (int cmd_i = 0; cmd_i < cmd_list->CmdBuffer.Size; cmd_i++)
+        {
+            const ImDrawCmd* pcmd = &cmd_list->CmdBuffer[cmd_i];
+            if (pcmd->UserCallback != NULL)
+            {
+                ImGui_ImplOpenGL3_MergedCmd callback = {};
+                callback.CmdList = cmd_list;
+                callback.Callback = pcmd;
+                g_MergedCmds.push_back(callback);
+                can_merge = false;
+                continue;
+            }
+
+            ImVec4 clip_rect;
+            clip_rect.x = (pcmd->ClipRect.x - clip_off.x) * clip_scale.x;
+            clip_rect.y = (pcmd->ClipRect.y - clip_off.y) * clip_scale.y;
+            clip_rect.z = (pcmd->ClipRect.z - clip_off.x) * clip_scale.x;
+            clip_rect.w = (pcmd->ClipRect.w - clip_off.y) * clip_scale.y;
+            if (!(clip_rect.x < fb_width && clip_rect.y < fb_height && clip_rect.z >= 0.0f && clip_rect.w >= 0.0f))
+                continue;
+            GLint scissor[4] = { (int)clip_rect.x, (int)(fb_height - clip_rect.w), (int)(clip_rect.z - clip_rect.x), (int)(clip_rect.w - clip_rect.y) };
+            ImVec4 box((float)scissor[0], (float)scissor[1], (float)(scissor[0] + scissor[2]), (float)(scissor[1] + scissor[3]));
+
+            // Bounds of the command's geometry, and the largest index it uses
+            const ImDrawIdx* idx_src = cmd_list->IdxBuffer.Data + pcmd->IdxOffset;
+            const ImDrawVert* vtx_src = cmd_list->VtxBuffer.Data + pcmd->VtxOffset;
+            unsigned int largest = 0;
+            ImVec2 bb_min(FLT_MAX, FLT_MAX), bb_max(-FLT_MAX, -FLT_MAX);
+            for (unsigned int i = 0; i < pcmd->ElemCount; i++)
+            {
+                unsigned int idx = idx_src[i];
+                const ImVec2& pos = vtx_src[idx].pos;
+                if (idx > largest) largest = idx;
+                if (pos.x < bb_min.x) bb_min.x = pos.x;
+                if (pos.y < bb_min.y) bb_min.y = pos.y;
+                if (pos.x > bb_max.x) bb_max.x = pos.x;
+                if (pos.y > bb_max.y) bb_max.y = pos.y;
+            }
+            ImVec4 bounds((bb_min.x - clip_off.x) * clip_scale.x, fb_height - (bb_max.y - clip_off.y) * clip_scale.y,
+                          (bb_max.x - clip_off.x) * clip_scale.x, fb_height - (bb_min.y - clip_off.y) * clip_scale.y);
+            bool clipped = bounds.x < box.x || bounds.y < box.y || bounds.z > box.z || bounds.w > box.w;
+
+            int first_vertex = list_vtx_offset + (int)pcmd->VtxOffset;
+            if ((unsigned int)(first_vertex - base_vertex) > max_index - largest)
+                base_vertex = first_vertex;
+            ImDrawIdx delta = (ImDrawIdx)(first_vertex - base_vertex);
+            ImDrawIdx* idx_dst = g_MergedIdx.Data + idx_count;
+            for (unsigned int i = 0; i < pcmd->ElemCount; i++)
+                idx_dst[i] = (ImDrawIdx)(idx_src[i] + delta);
+
+            ImGui_ImplOpenGL3_MergedCmd* last = can_merge ? &g_MergedCmds.back() : NULL;
+            bool merge = last && last->TextureId == pcmd->TextureId && last->BaseVertex == base_vertex && g_MergedClipped.Size < max_clipped * 2;
+            ImVec4 merged_box;
+            if (merge)
+            {
+                merged_box.x = last->Scissor[0] < box.x ? (float)last->Scissor[0] : box.x;
+                merged_box.y = last->Scissor[1] < box.y ? (float)last->Scissor[1] : box.y;
+                merged_box.z = last->Scissor[0] + last->Scissor[2] > box.z ? (float)(last->Scissor[0] + last->Scissor[2]) : box.z;
+                merged_box.w = last->Scissor[1] + last->Scissor[3] > box.w ? (float)(last->Scissor[1] + last->Scissor[3]) : box.w;
+                merge = !clipped || ImGui_ImplOpenGL3_ClipsAlike(bounds, box, merged_box);
+                for (int i = 0; merge && i < g_MergedClipped.Size; i += 2)
+                    merge = ImGui_ImplOpenGL3_ClipsAlike(g_MergedClipped[i], g_MergedClipped[i + 1], merged_box);
+            }
+            if (merge)
+            {
+                last->Scissor[0] = (GLint)merged_box.x;
+                last->Scissor[1] = (GLint)merged_box.y;
+                last->Scissor[2] = (GLint)(merged_box.z - merged_box.x);
+                last->Scissor[3] = (GLint)(merged_box.w - merged_box.y);
+                last->ElemCount += (int)pcmd->ElemCount;
+            }
+            else
+            {
+                ImGui_ImplOpenGL3_MergedCmd draw = {};
+                memcpy(draw.Scissor, scissor, sizeof(scissor));
+                draw.TextureId = pcmd->TextureId;
+                draw.BaseVertex = base_vertex;
+                draw.IdxOffset = idx_count;
+                draw.ElemCount = (int)pcmd->ElemCount;
+                g_MergedCmds.push_back(draw);
+                g_MergedClipped.resize(0);
+            }
+            if (clipped)
+            {
+                g_MergedClipped.push_back(bounds);
+                g_MergedClipped.push_back(box);
+            }
+            can_merge = true;
+            idx_count += (int)pcmd->ElemCount;
+        }
+        list_vtx_offset += cmd_list->VtxBuffer.Size;
+    }
+    g_MergedIdx.resize(idx_count);
+}
+#endif
+
+static void ImGui_ImplOpenGL3_SetupRenderState(ImDrawData* draw_data, int fb_width, int fb_height, GLuint vertex_array_object, GLuint vertex_buffer, GLuint index_buffer)
 {
     // Setup render state: alpha-blending enabled, no face culling, no depth testing, scissor enabled, polygon fill
     glEnable(GL_BLEND);
@@ -305,8 +623,8 @@ static void ImGui_ImplOpenGL3_SetupRenderState(ImDrawData* draw_data, int fb_wid
 #endif
 
     // Bind vertex/index buffers and setup attributes for ImDrawVert
-    glBindBuffer(GL_ARRAY_BUFFER, g_VboHandle);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_ElementsHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
     glEnableVertexAttribArray(g_AttribLocationVtxPos);
     glEnableVertexAttribArray(g_AttribLocationVtxUV);
     glEnableVertexAttribArray(g_AttribLocationVtxColor);
@@ -365,20 +683,76 @@ void    ImGui_ImplOpenGL3_RenderDrawData(ImDrawData* draw_data)
 #ifndef IMGUI_IMPL_OPENGL_ES2
     glGenVertexArrays(1, &vertex_array_object);
 #endif
-    ImGui_ImplOpenGL3_SetupRenderState(draw_data, fb_width, fb_height, vertex_array_object);
+
+    // Upload vertex/index buffers: all lists at once through the ring, or each list on its own below
+    g_RenderStats.Lists = draw_data->CmdListsCount;
+    g_RenderStats.Commands = 0;
+    for (int n = 0; n < draw_data->CmdListsCount; n++)
+        g_RenderStats.Commands += draw_data->CmdLists[n]->CmdBuffer.Size;
+    g_RenderStats.DrawCalls = 0;
+    g_RenderStats.BufferCalls = 0;
+    g_RenderStats.VtxBytes = draw_data->TotalVtxCount * (int)sizeof(ImDrawVert);
+    g_RenderStats.IdxBytes = draw_data->TotalIdxCount * (int)sizeof(ImDrawIdx);
+    bool use_ring = false, use_merge = false;
+    GLuint vertex_buffer = g_VboHandle, index_buffer = g_ElementsHandle;
+    int global_vtx_offset = 0, global_idx_offset = 0;
+#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_BUFFER_RING
+    if (g_RingEnabled && g_GlVersion >= 320)
+    {
+        if (g_MergeEnabled)
+            ImGui_ImplOpenGL3_MergeDrawCommands(draw_data, fb_width, fb_height);
+        use_ring = ImGui_ImplOpenGL3_UploadBufferRing(draw_data, g_MergeEnabled ? &g_MergedIdx : NULL);
+        use_merge = use_ring && g_MergeEnabled;
+    }
+    if (use_ring)
+    {
+        vertex_buffer = g_RingVboHandle;
+        index_buffer = g_RingElementsHandle;
+        global_vtx_offset = g_RingSlot * g_RingVtxCapacity;
+        global_idx_offset = g_RingSlot * g_RingIdxCapacity;
+    }
+    g_RenderStats.Persistent = use_ring && g_RingPersistent;
+#endif
+    g_RenderStats.Ring = use_ring;
+    g_RenderStats.Merged = use_merge;
+    ImGui_ImplOpenGL3_SetupRenderState(draw_data, fb_width, fb_height, vertex_array_object, vertex_buffer, index_buffer);
 
     // Will project scissor/clipping rectangles into framebuffer space
     ImVec2 clip_off = draw_data->DisplayPos;         // (0,0) unless using multi-viewports
     ImVec2 clip_scale = draw_data->FramebufferScale; // (1,1) unless using retina display which are often (2,2)
 
+#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_BUFFER_RING
+    // Render merged commands
+    for (int cmd_i = 0; use_merge && cmd_i < g_MergedCmds.Size; cmd_i++)
+    {
+        const ImGui_ImplOpenGL3_MergedCmd* mcmd = &g_MergedCmds[cmd_i];
+        if (mcmd->Callback != NULL)
+        {
+            if (mcmd->Callback->UserCallback == ImDrawCallback_ResetRenderState)
+                ImGui_ImplOpenGL3_SetupRenderState(draw_data, fb_width, fb_height, vertex_array_object, vertex_buffer, index_buffer);
+            else
+                mcmd->Callback->UserCallback(mcmd->CmdList, mcmd->Callback);
+            continue;
+        }
+        glScissor(mcmd->Scissor[0], mcmd->Scissor[1], mcmd->Scissor[2], mcmd->Scissor[3]);
+        glBindTexture(GL_TEXTURE_2D, (GLuint)(intptr_t)mcmd->TextureId);
+        glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)mcmd->ElemCount, sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (void*)(intptr_t)((mcmd->IdxOffset + global_idx_offset) * sizeof(ImDrawIdx)), (GLint)(mcmd->BaseVertex + global_vtx_offset));
+        g_RenderStats.DrawCalls++;
+    }
+#endif
+
     // Render command lists
-    for (int n = 0; n < draw_data->CmdListsCount; n++)
+    for (int n = 0; !use_merge && n < draw_data->CmdListsCount; n++)
     {
         const ImDrawList* cmd_list = draw_data->CmdLists[n];
 
         // Upload vertex/index buffers
-        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)cmd_list->VtxBuffer.Size * (int)sizeof(ImDrawVert), (const GLvoid*)cmd_list->VtxBuffer.Data, GL_STREAM_DRAW);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)cmd_list->IdxBuffer.Size * (int)sizeof(ImDrawIdx), (const GLvoid*)cmd_list->IdxBuffer.Data, GL_STREAM_DRAW);
+        if (!use_ring)
+        {
+            glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)cmd_list->VtxBuffer.Size * (int)sizeof(ImDrawVert), (const GLvoid*)cmd_list->VtxBuffer.Data, GL_STREAM_DRAW);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)cmd_list->IdxBuffer.Size * (int)sizeof(ImDrawIdx), (const GLvoid*)cmd_list->IdxBuffer.Data, GL_STREAM_DRAW);
+            g_RenderStats.BufferCalls += 2;
+        }
 
         for (int cmd_i = 0; cmd_i < cmd_list->CmdBuffer.Size; cmd_i++)
         {
@@ -388,7 +762,7 @@ void    ImGui_ImplOpenGL3_RenderDrawData(ImDrawData* draw_data)
                 // User callback, registered via ImDrawList::AddCallback()
                 // (ImDrawCallback_ResetRenderState is a special callback value used by the user to request the renderer to reset render state.)
                 if (pcmd->UserCallback == ImDrawCallback_ResetRenderState)
-                    ImGui_ImplOpenGL3_SetupRenderState(draw_data, fb_width, fb_height, vertex_array_object);
+                    ImGui_ImplOpenGL3_SetupRenderState(draw_data, fb_width, fb_height, vertex_array_object, vertex_buffer, index_buffer);
                 else
                     pcmd->UserCallback(cmd_list, pcmd);
             }
@@ -410,14 +784,24 @@ void    ImGui_ImplOpenGL3_RenderDrawData(ImDrawData* draw_data)
                     glBindTexture(GL_TEXTURE_2D, (GLuint)(intptr_t)pcmd->TextureId);
 #ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_VTX_OFFSET
                     if (g_GlVersion >= 320)
-                        glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (void*)(intptr_t)(pcmd->IdxOffset * sizeof(ImDrawIdx)), (GLint)pcmd->VtxOffset);
+                        glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (void*)(intptr_t)((pcmd->IdxOffset + global_idx_offset) * sizeof(ImDrawIdx)), (GLint)(pcmd->VtxOffset + global_vtx_offset));
                     else
 #endif
                     glDrawElements(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (void*)(intptr_t)(pcmd->IdxOffset * sizeof(ImDrawIdx)));
+                    g_RenderStats.DrawCalls++;
                 }
             }
         }
+        if (use_ring)
+        {
+            global_vtx_offset += cmd_list->VtxBuffer.Size;
+            global_idx_offset += cmd_list->IdxBuffer.Size;
+        }
     }
+#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_BUFFER_RING
+    if (use_ring)
+        g_RingFences[g_RingSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+#endif
 
     // Destroy the temporary VAO
 #ifndef IMGUI_IMPL_OPENGL_ES2
@@ -714,6 +1098,9 @@ void    ImGui_ImplOpenGL3_DestroyDeviceObjects()
 {
     if (g_VboHandle)        { glDeleteBuffers(1, &g_VboHandle); g_VboHandle = 0; }
     if (g_ElementsHandle)   { glDeleteBuffers(1, &g_ElementsHandle); g_ElementsHandle = 0; }
+#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_BUFFER_RING
+    ImGui_ImplOpenGL3_DestroyBufferRing();
+#endif
     if (g_ShaderHandle && g_VertHandle) { glDetachShader(g_ShaderHandle, g_VertHandle); }
     if (g_ShaderHandle && g_FragHandle) { glDetachShader(g_ShaderHandle, g_FragHandle); }
     if (g_VertHandle)       { glDeleteShader(g_VertHandle); g_VertHandle = 0; }
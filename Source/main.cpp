@@ -12,6 +12,22 @@
 #include <model.hpp>
 #include <stb_image.h>
 #include <mesh.hpp>
+#include <uniformbuffer.hpp>
+#include <jobsystem.hpp>
+#include <culling.hpp>
+#include <renderqueue.hpp>
+#include <glstate.hpp>
+#include <instancing.hpp>
+#include <normalmatrix.hpp>
+#include <gputimer.hpp>
+#include <geometryarena.hpp>
+#include <texturecache.hpp>
+#include <texturestreaming.hpp>
+#include <mipmap.hpp>
+#include <drawcounter.hpp>
+#include <headless.hpp>
+#include <framecapture.hpp>
+#include <vector>
 
 int windowWidth = 800, windowHeight = 600;
 bool firstMouse = true;
@@ -20,6 +36,16 @@ float previousMouseX = windowWidth/2, previousMouseY = windowHeight/2;
 float deltaTime = 0.0f, lastFrame = 0.0f;
 Camera camera(glm::vec3(0.0f, 0.0f, 5.0f));
 unsigned int framebuffer, renderbuffer, textureColorbuffer;
+//where the post process and UI go; the window's, except in headless runs
+unsigned int outputFramebuffer = 0, outputRenderbuffer;
+
+//ImGui backend cost per frame on the demo window content
+struct ImGuiBenchmark {
+    int commands;
+    int drawCalls;
+    double cpuMs;
+    double gpuMs;
+};
 
 void processInput(GLFWwindow* window) {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
@@ -73,50 +99,81 @@ void mouse_button_callback(GLFWwindow* window,int button, int action, int mods)
 }
 
 void callResizeEvent(GLFWwindow* window, int width, int height);
-unsigned int loadCubemap(std::vector<std::string> faces);
+void resizeFramebuffers();
+unsigned int loadCubemap(std::vector<std::string> faces, bool compress);
+void benchmarkMips(const std::vector<std::string> &faces, MipBenchmark results[2]);
+void benchmarkImGui(ImGuiBenchmark results[2]);
 
-int main() {
-    glfwInit();
-    
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-     
-    #ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_COCOA_RETINA_FRAMEBUFFER, GLFW_TRUE);
-    #endif
-    
-    
-    GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "LearnOpenGL", NULL, NULL);
-    if (window == NULL) {
-        glfwTerminate();
+int main(int argc, char **argv) {
+    HeadlessSettings headless;
+    if (!parseHeadlessArgs(argc, argv, headless)) {
         return -1;
     }
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, callResizeEvent);
-    glfwSetMouseButtonCallback(window, mouse_button_callback);
-    glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
-    glfwSetCursorPosCallback(window, mouse_pos_callback);
-    
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-        glfwTerminate();
-        return -1;
+    //headless runs render offscreen at a fixed size without a window; where
+    //there is no surfaceless EGL they fall back to a hidden one
+    HeadlessContext headlessContext;
+    GLFWwindow* window = NULL;
+    if (headless.enabled) {
+        windowWidth = headless.width;
+        windowHeight = headless.height;
+    }
+    if (headless.enabled && headlessContext.create(3, 3)) {
+        if (!headlessContext.loadGL()) {
+            headlessContext.destroy();
+            return -1;
+        }
+    } else {
+        glfwInit();
+        
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, headless.enabled ? GLFW_FALSE : GLFW_TRUE);
+         
+        #ifdef __APPLE__
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_COCOA_RETINA_FRAMEBUFFER, GLFW_TRUE);
+        #endif
+        
+        
+        window = glfwCreateWindow(windowWidth, windowHeight, "LearnOpenGL", NULL, NULL);
+        if (window == NULL) {
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+        if (!headless.enabled) {
+            glfwSetFramebufferSizeCallback(window, callResizeEvent);
+            glfwSetMouseButtonCallback(window, mouse_button_callback);
+            glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+            glfwSetCursorPosCallback(window, mouse_pos_callback);
+        }
+        
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+            glfwTerminate();
+            return -1;
+        }
     }
+    DrawCallCounter::install();
     
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_CULL_FACE);
+    glState().setEnabled(GL_DEPTH_TEST, true);
+    glState().setEnabled(GL_BLEND, true);
+    glState().setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glState().setEnabled(GL_CULL_FACE, true);
+    //filter the skybox's mip levels across face edges
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
     
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
     ImGuiIO& io = ImGui::GetIO(); (void)io;
     io.IniFilename = NULL;
     ImGui::StyleColorsDark();
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
+    if (!headless.enabled) {
+        ImGui_ImplGlfw_InitForOpenGL(window, true);
+    }
     ImGui_ImplOpenGL3_Init((char *)glGetString(GL_NUM_SHADING_LANGUAGE_VERSIONS));
     
+    int nrPointLights = 4;
     glm::vec3 pointLightPositions[] = {
         glm::vec3( 0.7f,  0.2f,  2.0f),
         glm::vec3( 2.3f, -3.3f, -4.0f),
@@ -125,7 +182,9 @@ int main() {
     };
     
     //Shader definitions
-    Shader mainShader("./Source/vertex.vert", "./Source/fragment.frag");
+    Shader mainShader("./Source/vertex.vert", "./Source/fragment.frag", {"PRECOMPUTED_NORMAL_MATRIX"});
+    //same program with the normal matrix inverted per vertex, for comparison
+    Shader referenceShader("./Source/vertex.vert", "./Source/fragment.frag");
     Shader postProcessQuad("./Source/postprocess.vert", "./Source/postprocess.frag");
     Shader skyboxShader("./Source/skybox.vert", "./Source/skybox.frag");
     
@@ -135,13 +194,32 @@ int main() {
     float cutOff = 12.5f;
     float outerCutOff = 13.5f;
     float sunColor[] = {1.0, 1.0, 1.0};
+    float fieldOfView = 45.0f;
+    float farPlane = 100.0f;
+    LodThresholds lodThresholds;
+    bool precomputedNormals = true;
+    //instancing stress scene, a grid of copies above the main scene
+    bool stressScene = headless.stressInstances > 0;
+    bool stressInstanced = true;
+    int stressInstances = headless.stressInstances > 0 ? headless.stressInstances : 10000;
+    int stressModel = 0;
+    //CPU mip builder timings on the skybox faces, box then Kaiser
+    MipBenchmark mipBenchmarks[2];
+    bool mipBenchmarkRun = false;
+    //ImGui vertex/index uploads through one fenced ring instead of a buffer per window
+    bool imguiBufferRing = true;
+    bool imguiMergeCommands = true;
+    double imguiRenderMs = 0.0;
+    //backend timings without and with command merging
+    ImGuiBenchmark imguiBenchmarks[2];
+    bool imguiBenchmarkRun = false;
     
     //post process framebufffer
     glGenFramebuffers(1, &framebuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glState().bindFramebuffer(framebuffer);
 
     glGenTextures(1, &textureColorbuffer);
-    glBindTexture(GL_TEXTURE_2D, textureColorbuffer);
+    glState().bindTexture(0, GL_TEXTURE_2D, textureColorbuffer);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, windowWidth, windowHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -154,7 +232,20 @@ int main() {
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
         std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glState().bindFramebuffer(0);
+    
+    if (headless.enabled) {
+        glGenFramebuffers(1, &outputFramebuffer);
+        glState().bindFramebuffer(outputFramebuffer);
+        glGenRenderbuffers(1, &outputRenderbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, outputRenderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, windowWidth, windowHeight);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, outputRenderbuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "ERROR::FRAMEBUFFER:: Output framebuffer is not complete!" << std::endl;
+        }
+        glState().bindFramebuffer(0);
+    }
     
     float quadVertices[] = { // vertex attributes for a quad that fills the entire screen in Normalized Device Coordinates.
             // positions   // texCoords
@@ -170,7 +261,7 @@ int main() {
         unsigned int quadVAO, quadVBO;
         glGenVertexArrays(1, &quadVAO);
         glGenBuffers(1, &quadVBO);
-        glBindVertexArray(quadVAO);
+        glState().bindVertexArray(quadVAO);
         glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
         glEnableVertexAttribArray(0);
@@ -232,7 +323,7 @@ int main() {
     unsigned int skyboxVAO, skyboxVBO;
     glGenVertexArrays(1, &skyboxVAO);
     glGenBuffers(1, &skyboxVBO);
-    glBindVertexArray(skyboxVAO);
+    glState().bindVertexArray(skyboxVAO);
     glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
@@ -247,172 +338,552 @@ int main() {
         "./Decals/skybox/back.jpg"
     };
     
-    unsigned int cubemapTexture = loadCubemap(faces);
+    //textures are baked to BC blocks where the driver takes them
+    bool compressTextures = CompressedTexturesSupported();
+    if (!compressTextures) {
+        std::cout << "TEXTURE: no S3TC support, loading textures uncompressed" << std::endl;
+    }
+    unsigned int cubemapTexture = loadCubemap(faces, compressTextures);
     skyboxShader.use();
-    skyboxShader.setUniformInt("skybox", 6);
+    skyboxShader.setUniformInt("skybox", SKYBOX_TEXTURE_UNIT);
     mainShader.use();
-    mainShader.setUniformInt("skybox", 6);
+    mainShader.setUniformInt("skybox", SKYBOX_TEXTURE_UNIT);
+    referenceShader.use();
+    referenceShader.setUniformInt("skybox", SKYBOX_TEXTURE_UNIT);
+    
+    //per-frame and per-material data shared by every program through uniform blocks
+    mainShader.bindBlock("FrameData", FRAME_BINDING);
+    mainShader.bindBlock("MaterialData", MATERIAL_BINDING);
+    referenceShader.bindBlock("FrameData", FRAME_BINDING);
+    referenceShader.bindBlock("MaterialData", MATERIAL_BINDING);
+    skyboxShader.bindBlock("FrameData", FRAME_BINDING);
+    UniformRing uniformRing(16 * 1024);
+    FrameData frameData = {};
+    MaterialData defaultMaterial = {glm::vec4(1.0), glm::vec4(1.0), 32.0f, 0.0f, 0.0f, 0.0f};
+    MaterialData glassMaterial = {glm::vec4(1.0), glm::vec4(1.0), 32.0f, 1.0f, 1.3f, 0.0f};
+    MaterialData mirrorMaterial = {glm::vec4(1.0), glm::vec4(1.0), 32.0f, 1.0f, 0.0f, 0.0f};
+    MaterialData foliageMaterial = {glm::vec4(1.0), glm::vec4(0.0), 32.0f, 0.0f, 0.0f, 0.0f};
+    
+    //uniform handles, resolved once so the render loop never builds names
+    int postProcessResolution = postProcessQuad.uniform("resolution");
+    int postProcessTime = postProcessQuad.uniform("time");
+    int mainModelMatrix = mainShader.uniform("modelMatrix");
+    int mainNormalMatrix = mainShader.uniform("normalMatrix");
+    int referenceModelMatrix = referenceShader.uniform("modelMatrix");
     
-    //model buffer loaders
-    Model character("./Meshes/CoderHusk/robloxOriginal.obj", false, cubemapTexture);
-    Model backpack("./Meshes/backpack/backpack.obj", true, cubemapTexture);
-    Model bunny("./Meshes/stanford-bunny-obj/stanford-bunny.obj", true, cubemapTexture);
-    Model plane("./Meshes/Plane/plane.obj", true, cubemapTexture);
-    Model tree("./Meshes/Tree/tree.obj", false, cubemapTexture);
-    Model sphere("./Meshes/Sphere/sphere.obj", true, cubemapTexture);
+    //model buffer loaders, parsed and decoded in the background; each model
+    //starts drawing once its uploads have gone through
+    JobSystem loaderJobs;
+    float uploadBudgetMs = 2.0f;
+    CullingPass culling;
+    RenderQueue renderQueue;
+    InstanceBuffer instanceBuffer;
+    std::vector<glm::mat4> visibleTrees;
+    std::vector<glm::mat4> stressMatrices;
+    std::vector<unsigned int> stressBounds;
+    std::vector<glm::mat4> stressLods[MAX_MESH_LODS];
+    std::vector<glm::mat3> stressNormals;
+    GpuTimer sceneTimer;
+    ModelSettings defaultSettings;
+    defaultSettings.compressTextures = compressTextures;
+    defaultSettings.streamTextures = true;
+    ModelSettings compactSettings = defaultSettings;
+    compactSettings.vertexFormat = VERTEX_COMPACT_UNORM_UV;
+    compactSettings.splitForShortIndices = true;
+    compactSettings.generateLods = true;
+    ModelSettings lodSettings = defaultSettings;
+    lodSettings.generateLods = true;
+    Model character("./Meshes/CoderHusk/robloxOriginal.obj", false, cubemapTexture, loaderJobs, compactSettings);
+    Model backpack("./Meshes/backpack/backpack.obj", true, cubemapTexture, loaderJobs, lodSettings);
+    Model bunny("./Meshes/stanford-bunny-obj/stanford-bunny.obj", true, cubemapTexture, loaderJobs, compactSettings);
+    Model plane("./Meshes/Plane/plane.obj", true, cubemapTexture, loaderJobs, defaultSettings);
+    Model tree("./Meshes/Tree/tree.obj", false, cubemapTexture, loaderJobs, defaultSettings);
+    Model sphere("./Meshes/Sphere/sphere.obj", true, cubemapTexture, loaderJobs, compactSettings);
+    Model *models[] = {&character, &backpack, &bunny, &plane, &tree, &sphere};
+    
+    //settings a capture records with the camera, so replays render the same
+    //scene; recordings only replay with the same values in the same order
+    CaptureValues captureValues;
+    captureValues.track(&linearAtt);
+    captureValues.track(&quadraticAtt);
+    captureValues.track(&cutOff);
+    captureValues.track(&outerCutOff);
+    for (unsigned int channel = 0; channel < 3; channel++) {
+        captureValues.track(&sunColor[channel]);
+    }
+    for (unsigned int lod = 0; lod < MAX_MESH_LODS - 1; lod++) {
+        captureValues.track(&lodThresholds.below[lod]);
+    }
+    captureValues.track(&precomputedNormals);
+    captureValues.track(&renderQueue.useMultiDraw);
+    captureValues.track(&imguiBufferRing);
+    captureValues.track(&imguiMergeCommands);
+    captureValues.track(&stressScene);
+    captureValues.track(&stressInstanced);
+    captureValues.track(&stressInstances);
+    captureValues.track(&stressModel);
+    FrameRecorder recorder;
+    FrameReplay replay;
+    if (!headless.recordFile.empty()) {
+        recorder.open(headless.recordFile, captureValues);
+    }
+    if (!headless.replayFile.empty()) {
+        if (!replay.load(headless.replayFile, captureValues)) {
+            return -1;
+        }
+        headless.frames = (int)replay.frames.size();
+    }
+    FrameStages stages, lastStages;
+    lastStages.begin();
+    
+    //headless runs measure rendering, not loading: every model is uploaded
+    //before the first frame, and the camera follows a scripted path
+    CameraPath cameraPath = CameraPath::orbit();
+    GpuFrameTimer frameTimer;
+    std::vector<HeadlessFrame> headlessFrames;
+    unsigned int headlessFrame = 0;
+    unsigned int headlessTotal = headless.warmupFrames + headless.frames;
+    if (headless.enabled) {
+        if (!headless.pathFile.empty() && !cameraPath.load(headless.pathFile)) {
+            cameraPath = CameraPath::orbit();
+        }
+        while (!loaderJobs.idle()) {
+            loaderJobs.waitForJobs();
+            loaderJobs.processUploads(1000.0);
+        }
+        lastFrame = -HEADLESS_TIMESTEP;
+        std::cout << "HEADLESS: " << glGetString(GL_RENDERER) << ", " << windowWidth << "x" << windowHeight << ", " << headless.warmupFrames << " warmup + " << headless.frames << " frames" << (replay.frames.empty() ? "" : " replayed from " + headless.replayFile) << std::endl;
+    }
+    DrawCallCounts drawCalls = {0, 0};
     
     //Render Loop
-    while (!glfwWindowShouldClose(window)) {
-        glfwGetFramebufferSize(window, &windowWidth,&windowHeight);
+    while (headless.enabled ? headlessFrame < headlessTotal : !glfwWindowShouldClose(window)) {
+        double frameStart = monotonicSeconds();
+        if (headless.enabled) {
+            frameTimer.begin(headlessFrame);
+        } else {
+            glfwGetFramebufferSize(window, &windowWidth,&windowHeight);
+        }
+        stages.begin();
         glViewport(0,0,windowWidth, windowHeight);
         
-        glfwPollEvents();
+        if (!headless.enabled) {
+            glfwPollEvents();
+        }
         ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
+        if (headless.enabled) {
+            io.DisplaySize = ImVec2((float)windowWidth, (float)windowHeight);
+            io.DeltaTime = HEADLESS_TIMESTEP;
+        } else {
+            ImGui_ImplGlfw_NewFrame();
+        }
         ImGui::NewFrame();
         ImGui::Text("Camera Position: %f, %f, %f", camera.position.x, camera.position.y, camera.position.z);
         ImGui::Text("Camera Look Vector: %f, %f, %f", camera.front.x, camera.front.y, camera.front.z);
         ImGui::Text("FPS: %d", (int)(1.0/deltaTime));
+        GLStateCounters glCalls = glState().frameCounters();
+        glState().resetCounters();
+        ImGui::Text("GL state calls: %u issued, %u elided", glCalls.issued, glCalls.elided);
+        ImGui::Text("Draw calls: %u (%u draws)", drawCalls.calls, drawCalls.commands);
+        ImGui::Text("CPU stages (ms):");
+        for (unsigned int stage = 0; stage < FRAME_STAGE_COUNT; stage++) {
+            ImGui::SameLine();
+            ImGui::Text("%s %.2f", frameStageName(stage), lastStages.ms[stage]);
+        }
+        if (ImGui::Button(recorder.recording() ? "Stop recording" : "Record capture")) {
+            if (recorder.recording()) {
+                recorder.close();
+            } else {
+                recorder.open(headless.recordFile.empty() ? "capture.fcap" : headless.recordFile, captureValues);
+            }
+        }
+        if (recorder.recording()) {
+            ImGui::SameLine();
+            ImGui::Text("%u frames to %s", recorder.frameCount(), recorder.name().c_str());
+        }
         ImGui::SliderFloat("Linear Attenuation", &linearAtt, 0.0f, 0.1f);
         ImGui::SliderFloat("Quadratic Attenuation", &quadraticAtt, 0.0f, 0.1f);
         ImGui::SliderFloat("Cut off", &cutOff, 0.0f, 180.0f);
         ImGui::SliderFloat("Outer off", &outerCutOff, 0.0f, 180.0f);
         ImGui::ColorEdit3("Sun Color", sunColor);
+        ModelMemory geometryMemory = {0, 0, 0};
+        for (Model *loaded : models) {
+            ModelMemory memory = loaded->memoryUsage();
+            geometryMemory.gpuBytes += memory.gpuBytes;
+            geometryMemory.cpuBytes += memory.cpuBytes;
+            geometryMemory.releasedBytes += memory.releasedBytes;
+        }
+        ImGui::Text("Geometry: %.1f MB GPU, %.1f MB CPU (%.1f MB released)", geometryMemory.gpuBytes / 1048576.0, geometryMemory.cpuBytes / 1048576.0, geometryMemory.releasedBytes / 1048576.0);
+        TextureCacheStats textureStats = textureCache().stats();
+        ImGui::Text("Texture cache: %u textures, %u references, %u loads, %u shared", textureStats.textures, textureStats.references, textureStats.loads, textureStats.hits);
+        ImGui::Text("Texture dedup: %u identical files, saved %.1f ms decode and %.1f MB VRAM (%.2f ms hashing)", textureStats.aliases, textureStats.decodeMsSaved, textureStats.bytesSaved / 1048576.0, textureStats.hashMs);
+        TextureBakeStats bakeStats = textureBakeLog().stats();
+        if (compressTextures) {
+            ImGui::Text("Texture baking: %u baked (%.0f ms), %u from .bctex, %.1f MB compressed vs %.1f MB raw", bakeStats.baked, bakeStats.bakeMs, bakeStats.reused, bakeStats.compressedBytes / 1048576.0, bakeStats.rawBytes / 1048576.0);
+        }
+        if (ImGui::Button("Benchmark skybox mips")) {
+            benchmarkMips(faces, mipBenchmarks);
+            mipBenchmarkRun = true;
+        }
+        if (mipBenchmarkRun) {
+            for (int filter = 0; filter < 2; filter++) {
+                ImGui::Text("Mips (%s): scalar %.0f ms, SIMD %.0f ms, threaded %.0f ms, max diff %d", filter == 0 ? "box" : "Kaiser", mipBenchmarks[filter].scalarMs, mipBenchmarks[filter].simdMs, mipBenchmarks[filter].threadedMs, mipBenchmarks[filter].maxError);
+            }
+        }
+        int textureBudgetMB = (int)(textureStreamer().budgetBytes / 1048576);
+        if (ImGui::SliderInt("Texture budget (MB)", &textureBudgetMB, 8, 1024)) {
+            textureStreamer().budgetBytes = (size_t)textureBudgetMB * 1048576;
+        }
+        TextureStreamingStats streamingStats = textureStreamer().stats();
+        ImGui::Text("Streaming: %u textures, %.1f MB resident, %u levels uploaded, %u evicted", streamingStats.textures, streamingStats.residentBytes / 1048576.0, streamingStats.uploads, streamingStats.evictions);
+        if (ImGui::CollapsingHeader("Streamed textures")) {
+            for (const StreamedTextureStats &texture : textureStreamer().textureStats()) {
+                ImGui::Text("%s: mip %u of %u resident (%ux%u), target %u, %.2f MB", texture.name.c_str(), texture.resident, texture.levels, texture.width, texture.height, texture.target, texture.residentBytes / 1048576.0);
+            }
+        }
+        GeometryArenaStats arenaStats = geometryArena().stats();
+        ImGui::Text("Arena: %.1f of %.1f MB vertices, %.1f of %.1f MB indices", arenaStats.vertexBytes / 1048576.0, arenaStats.vertexCapacityBytes / 1048576.0, arenaStats.indexBytes / 1048576.0, arenaStats.indexCapacityBytes / 1048576.0);
+        if (GLAD_GL_VERSION_4_3) {
+            ImGui::Checkbox("Multi-draw indirect", &renderQueue.useMultiDraw);
+        } else {
+            ImGui::Text("Multi-draw indirect: needs GL 4.3, drawing per mesh");
+        }
+        for (unsigned int lod = 0; lod < MAX_MESH_LODS - 1; lod++) {
+            std::string label = "LOD " + std::to_string(lod + 1) + " below";
+            ImGui::SliderFloat(label.c_str(), &lodThresholds.below[lod], 0.0f, 1.0f, "%.2f of screen");
+        }
+        ImGui::Checkbox("Precomputed normal matrices", &precomputedNormals);
+        ImGui::Text("Scene GPU time: %.2f ms", sceneTimer.lastMs());
+        ImGui::Checkbox("ImGui buffer ring", &imguiBufferRing);
+        ImGui::Checkbox("Merge ImGui draw commands (needs the ring)", &imguiMergeCommands);
+        ImGui_ImplOpenGL3_RenderStats imguiUploads = ImGui_ImplOpenGL3_GetRenderStats();
+        ImGui::Text("ImGui: %d lists, %d buffer calls, %.1f KB (%s), %d fence waits, %.2f ms CPU", imguiUploads.Lists, imguiUploads.BufferCalls, (imguiUploads.VtxBytes + imguiUploads.IdxBytes) / 1024.0, imguiUploads.Persistent ? "persistent ring" : imguiUploads.Ring ? "mapped ring" : "per list", imguiUploads.FenceWaits, imguiRenderMs);
+        ImGui::Text("       %d commands in %d draws", imguiUploads.Commands, imguiUploads.DrawCalls);
+        if (ImGui::Button("Benchmark ImGui merging")) {
+            benchmarkImGui(imguiBenchmarks);
+            imguiBenchmarkRun = true;
+        }
+        if (imguiBenchmarkRun) {
+            for (int merged = 0; merged < 2; merged++) {
+                ImGui::Text("ImGui demo (%s): %d commands in %d draws, %.2f ms CPU, %.2f ms GPU", merged ? "merged" : "unmerged", imguiBenchmarks[merged].commands, imguiBenchmarks[merged].drawCalls, imguiBenchmarks[merged].cpuMs, imguiBenchmarks[merged].gpuMs);
+            }
+        }
+        ImGui::Checkbox("Instancing stress scene", &stressScene);
+        if (stressScene) {
+            ImGui::Combo("Stress model", &stressModel, "Sphere\0Bunny\0");
+            ImGui::SliderInt("Instances", &stressInstances, 1, 10000);
+            ImGui::Checkbox("Draw instanced", &stressInstanced);
+        }
+        
+        stages.lap(STAGE_UI);
+        
+        loaderJobs.processUploads(uploadBudgetMs);
+        for (unsigned int deleted : textureCache().collect()) {
+            textureStreamer().remove(deleted);
+        }
+        textureStreamer().update();
+        stages.lap(STAGE_UPLOADS);
         
-        float currentFrame = glfwGetTime();
+        float currentFrame = headless.enabled ? headlessFrame * HEADLESS_TIMESTEP : (float)glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
-        processInput(window);
+        if (headless.enabled && !replay.frames.empty()) {
+            //warmup frames hold the first captured frame
+            unsigned int replayed = headlessFrame < (unsigned int)headless.warmupFrames ? 0 : headlessFrame - headless.warmupFrames;
+            replay.apply(replayed, camera, captureValues);
+            const CapturedFrame &captured = replay.frames[replayed];
+            if (captured.width > 0 && captured.height > 0 && (captured.width != windowWidth || captured.height != windowHeight)) {
+                windowWidth = captured.width;
+                windowHeight = captured.height;
+                resizeFramebuffers();
+                glViewport(0, 0, windowWidth, windowHeight);
+            }
+        } else if (headless.enabled) {
+            //the reported frames go once around the path
+            CameraPose pose = cameraPath.sample(((float)headlessFrame - headless.warmupFrames) / headless.frames);
+            camera.setPose(pose.position, pose.yaw, pose.pitch);
+        } else {
+            processInput(window);
+            recorder.record(camera, windowWidth, windowHeight, captureValues);
+        }
         
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glState().bindFramebuffer(framebuffer);
         glClearColor(0.0f, 0.0f, 1.0f, 1.0f);
+        glState().setDepthMask(true);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glEnable(GL_DEPTH_TEST);
+        glState().setEnabled(GL_DEPTH_TEST, true);
         
-        glm::mat4 viewMatrix = glm::mat4(1.0f);
         glm::mat4 perspectiveMatrix = glm::mat4(1.0f);
-        perspectiveMatrix = glm::perspective(glm::radians(45.0f), (float)(windowWidth)/(float)(windowHeight), 0.1f, 100.0f);
+        perspectiveMatrix = glm::perspective(glm::radians(fieldOfView), (float)(windowWidth)/(float)(windowHeight), 0.1f, farPlane);
         
-        glDepthMask(GL_FALSE);
-        skyboxShader.use();
-        viewMatrix = glm::mat4(glm::mat3(camera.GetViewMatrix()));
-        skyboxShader.setUniformMat4("viewMatrix", glm::value_ptr(viewMatrix));
-        skyboxShader.setUniformMat4("perspectiveMatrix", glm::value_ptr(perspectiveMatrix));
-        glBindVertexArray(skyboxVAO);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glDepthMask(GL_TRUE);
-        
-        mainShader.use();
-        viewMatrix = glm::mat4(1.0f);
-        viewMatrix = camera.GetViewMatrix();
-        mainShader.setUniformVec3("direction_light", -glm::vec3(-.56, -.54, .62));
-        mainShader.setUniformVec4("material.diffuse", glm::vec4(1.0));
-        mainShader.setUniformVec4("material.specular", glm::vec4(1.0));
-        mainShader.setUniformFloat("material.shininess", 32.0f);
-        mainShader.setUniformMat4("viewMatrix", glm::value_ptr(viewMatrix));
-        mainShader.setUniformMat4("perspectiveMatrix", glm::value_ptr(perspectiveMatrix));
-        mainShader.setUniformVec3("sunColor", glm::vec3(sunColor[0], sunColor[1], sunColor[2]));
-        
-        mainShader.setUniformVec3("cameraPosition", camera.position);
-        
-        for (int pointLight = 0; pointLight<4; pointLight++) {
-            mainShader.setUniformVec3("pointLights[" + std::to_string(pointLight) + "].position", pointLightPositions[pointLight]);
-            mainShader.setUniformFloat("pointLights[" + std::to_string(pointLight) + "].linear", linearAtt);
-            mainShader.setUniformFloat("pointLights[" + std::to_string(pointLight) + "].quadratic", quadraticAtt);
+        frameData.viewMatrix = camera.GetViewMatrix();
+        frameData.perspectiveMatrix = perspectiveMatrix;
+        frameData.cameraPosition = camera.position;
+        frameData.time = currentFrame;
+        frameData.direction_light = -glm::vec3(-.56, -.54, .62);
+        frameData.sunColor = glm::vec3(sunColor[0], sunColor[1], sunColor[2]);
+        frameData.nrPointLights = nrPointLights;
+        for (int pointLight = 0; pointLight<nrPointLights; pointLight++) {
+            frameData.pointLights[pointLight].position = pointLightPositions[pointLight];
+            frameData.pointLights[pointLight].linear = linearAtt;
+            frameData.pointLights[pointLight].quadratic = quadraticAtt;
         }
+        frameData.spotLight.position = camera.position;
+        frameData.spotLight.direction = camera.front;
+        frameData.spotLight.linear = linearAtt;
+        frameData.spotLight.quadratic = quadraticAtt;
+        frameData.spotLight.cutOff = glm::cos(glm::radians(cutOff));
+        frameData.spotLight.outerCutOff = glm::cos(glm::radians(outerCutOff));
         
-        mainShader.setUniformVec3("spotLight.position", camera.position);
-        mainShader.setUniformVec3("spotLight.direction", camera.front);
-        mainShader.setUniformFloat("spotLight.linear", linearAtt);
-        mainShader.setUniformFloat("spotLight.quadratic", quadraticAtt);
-        mainShader.setUniformFloat("spotLight.cutOff", glm::cos(glm::radians(cutOff)));
-        mainShader.setUniformFloat("spotLight.outerCutOff", glm::cos(glm::radians(outerCutOff)));
+        uniformRing.beginFrame();
+        unsigned int frameOffset = uniformRing.push(frameData);
+        unsigned int defaultMaterialOffset = uniformRing.push(defaultMaterial);
+        unsigned int glassMaterialOffset = uniformRing.push(glassMaterial);
+        unsigned int mirrorMaterialOffset = uniformRing.push(mirrorMaterial);
+        unsigned int foliageMaterialOffset = uniformRing.push(foliageMaterial);
+        uniformRing.upload();
+        uniformRing.bind(FRAME_BINDING, frameOffset, sizeof(FrameData));
         
-        mainShader.setUniformFloat("time", (float)glfwGetTime());
-        
-        mainShader.setUniformFloat("material.reflectiveness", 0.0);
-        mainShader.setUniformFloat("material.refractiveness", 0.0);
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-1.5f, 0.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));
-        model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0.0, 1.0, 0.0));
-        mainShader.setUniformMat4("modelMatrix", glm::value_ptr(model));
-        character.Draw(mainShader);
+        glState().setDepthMask(false);
+        skyboxShader.use();
+        glState().bindVertexArray(skyboxVAO);
+        glState().bindTexture(SKYBOX_TEXTURE_UNIT, GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glState().setDepthMask(true);
         
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(2.0f, 0.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));
-        mainShader.setUniformMat4("modelMatrix", glm::value_ptr(model));
-        backpack.Draw(mainShader);
+        //object transforms
+        glm::mat4 characterMatrix = glm::mat4(1.0f);
+        characterMatrix = glm::translate(characterMatrix, glm::vec3(-1.5f, 0.0f, 0.0f));
+        characterMatrix = glm::scale(characterMatrix, glm::vec3(1.0f, 1.0f, 1.0f));
+        characterMatrix = glm::rotate(characterMatrix, glm::radians(180.0f), glm::vec3(0.0, 1.0, 0.0));
+        glm::mat4 backpackMatrix = glm::mat4(1.0f);
+        backpackMatrix = glm::translate(backpackMatrix, glm::vec3(2.0f, 0.0f, 0.0f));
+        backpackMatrix = glm::scale(backpackMatrix, glm::vec3(1.0f, 1.0f, 1.0f));
+        glm::mat4 bunnyMatrix = glm::mat4(1.0f);
+        bunnyMatrix = glm::translate(bunnyMatrix, glm::vec3(0.0f, 0.0f, 2.0f));
+        bunnyMatrix = glm::scale(bunnyMatrix, glm::vec3(20.0f));
+        glm::mat4 sphereMatrix = glm::mat4(1.0f);
+        sphereMatrix = glm::translate(sphereMatrix, glm::vec3(-7.0f, -1.0f, 7.0f));
+        sphereMatrix = glm::scale(sphereMatrix, glm::vec3(1.0f));
+        glm::mat4 planeMatrix = glm::mat4(1.0f);
+        planeMatrix = glm::translate(planeMatrix, glm::vec3(0.0f, -2.0f, 0.0f));
+        planeMatrix = glm::scale(planeMatrix, glm::vec3(20.0f));
+        glm::mat4 treeMatrices[2];
+        float treeAngles[2] = {210.0f, 30.0f};
+        for (unsigned int i = 0; i < 2; i++) {
+            treeMatrices[i] = glm::mat4(1.0f);
+            treeMatrices[i] = glm::translate(treeMatrices[i], glm::vec3(cos(glm::radians(treeAngles[i]))*6.0f, 2.0f, sin(glm::radians(treeAngles[i]))*6.0f));
+            treeMatrices[i] = glm::scale(treeMatrices[i], glm::vec3(4.0f));
+        }
+        stressMatrices.clear();
+        if (stressScene) {
+            unsigned int side = (unsigned int)std::ceil(std::sqrt((float)stressInstances));
+            for (int i = 0; i < stressInstances; i++) {
+                glm::vec3 position(((float)(i % side) - side * 0.5f) * 2.5f, 8.0f, ((float)(i / side) - side * 0.5f) * 2.5f);
+                glm::mat4 stressMatrix = glm::translate(glm::mat4(1.0f), position);
+                stressMatrices.push_back(glm::scale(stressMatrix, glm::vec3(stressModel == 0 ? 0.5f : 10.0f)));
+            }
+        }
         
-        mainShader.setUniformFloat("material.reflectiveness", 1.0);
-        mainShader.setUniformFloat("material.refractiveness", 1.3);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 0.0f, 2.0f));
-        model = glm::scale(model, glm::vec3(20.0f));
-        mainShader.setUniformMat4("modelMatrix", glm::value_ptr(model));
-        bunny.Draw(mainShader);
+        //frustum culling, every mesh of every object in one batch
+        stages.lap(STAGE_SETUP);
+        culling.begin(perspectiveMatrix, frameData.viewMatrix);
+        unsigned int characterBounds = character.addBounds(culling, characterMatrix);
+        unsigned int backpackBounds = backpack.addBounds(culling, backpackMatrix);
+        unsigned int bunnyBounds = bunny.addBounds(culling, bunnyMatrix);
+        unsigned int sphereBounds = sphere.addBounds(culling, sphereMatrix);
+        unsigned int planeBounds = plane.addBounds(culling, planeMatrix);
+        unsigned int treeBounds[2];
+        for (unsigned int i = 0; i < 2; i++) {
+            treeBounds[i] = tree.addBounds(culling, treeMatrices[i]);
+        }
+        Model &stressCopy = stressModel == 0 ? sphere : bunny;
+        stressBounds.resize(stressMatrices.size());
+        for (unsigned int i = 0; i < stressMatrices.size(); i++) {
+            stressBounds[i] = stressCopy.addBounds(culling, stressMatrices[i]);
+        }
+        culling.run();
+        stages.lap(STAGE_CULLING);
         
-        mainShader.setUniformFloat("material.refractiveness", 0.0);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-7.0f, -1.0f, 7.0f));
-        model = glm::scale(model, glm::vec3(1.0f));
-        mainShader.setUniformMat4("modelMatrix", glm::value_ptr(model));
-        sphere.Draw(mainShader);
+        //every model picks its level of detail from its projected size and
+        //queues its visible meshes; the queue sorts them to save state changes
+        DrawMaterial defaultDraw = {0, defaultMaterialOffset, false};
+        DrawMaterial glassDraw = {1, glassMaterialOffset, false};
+        DrawMaterial mirrorDraw = {2, mirrorMaterialOffset, false};
+        DrawMaterial foliageDraw = {3, foliageMaterialOffset, true};
+        unsigned int trianglesDrawn = 0, trianglesFull = 0;
+        Shader &sceneShader = precomputedNormals ? mainShader : referenceShader;
+        sceneTimer.begin();
+        renderQueue.clear();
+        auto submitModel = [&](const char *name, Model &drawn, const glm::mat4 &model, const DrawMaterial &material, unsigned int firstBound) {
+            float size = drawn.projectedSize(model, camera.position, glm::radians(fieldOfView));
+            unsigned int lod = drawn.selectLod(size, lodThresholds);
+            glm::vec3 center = glm::vec3(model * glm::vec4(drawn.getBoundingSphere().center, 1.0f));
+            float depth = glm::length(center - camera.position) / farPlane;
+            unsigned int triangles = drawn.submit(renderQueue, sceneShader, lod, material, model, depth, culling, firstBound);
+            if (triangles > 0) {
+                drawn.requestTextures(size * windowHeight);
+            }
+            trianglesDrawn += triangles;
+            trianglesFull += drawn.triangleCount(0);
+            ImGui::Text("%s: LOD %u, %.2f of screen, %u triangles", name, lod, size, triangles);
+        };
         
-        mainShader.setUniformFloat("material.reflectiveness", 0.0);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, -2.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(20.0f));
-        mainShader.setUniformMat4("modelMatrix", glm::value_ptr(model));
-        plane.Draw(mainShader);
+        submitModel("Character", character, characterMatrix, defaultDraw, characterBounds);
+        submitModel("Backpack", backpack, backpackMatrix, defaultDraw, backpackBounds);
+        submitModel("Bunny", bunny, bunnyMatrix, glassDraw, bunnyBounds);
+        submitModel("Sphere", sphere, sphereMatrix, mirrorDraw, sphereBounds);
+        submitModel("Plane", plane, planeMatrix, defaultDraw, planeBounds);
+        renderQueue.execute(uniformRing);
+        const RenderQueueStats &queueStats = renderQueue.lastStats();
         
-        glDisable(GL_CULL_FACE);
-        mainShader.setUniformVec4("material.specular", glm::vec4(0.0));
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(cos(glm::radians(210.0f))*6.0f, 2.0f, sin(glm::radians(210.0f))*6.0f));
-        model = glm::scale(model, glm::vec3(4.0f));
-        mainShader.setUniformMat4("modelMatrix", glm::value_ptr(model));
-        tree.Draw(mainShader);
+        //repeated models: every visible copy in one instanced draw per mesh
+        //and level of detail
+        visibleTrees.clear();
+        for (unsigned int i = 0; i < 2; i++) {
+            if (tree.anyVisible(culling, treeBounds[i])) {
+                visibleTrees.push_back(treeMatrices[i]);
+                tree.requestTextures(tree.projectedSize(treeMatrices[i], camera.position, glm::radians(fieldOfView)) * windowHeight);
+            }
+        }
+        sceneShader.use();
+        uniformRing.bind(MATERIAL_BINDING, foliageDraw.uniformOffset, sizeof(MaterialData));
+        glState().setEnabled(GL_CULL_FACE, false);
+        unsigned int treeTriangles = tree.DrawInstanced(sceneShader, instanceBuffer, visibleTrees.data(), (unsigned int)visibleTrees.size());
+        glState().setEnabled(GL_CULL_FACE, true);
+        trianglesDrawn += treeTriangles;
+        trianglesFull += tree.triangleCount(0) * 2;
+        ImGui::Text("Tree: %u of 2 instances, %u triangles", (unsigned int)visibleTrees.size(), treeTriangles);
         
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(cos(glm::radians(30.0f))*6.0f, 2.0f, sin(glm::radians(30.0f))*6.0f));
-        model = glm::scale(model, glm::vec3(4.0f));
-        mainShader.setUniformMat4("modelMatrix", glm::value_ptr(model));
-        tree.Draw(mainShader);
-        glEnable(GL_CULL_FACE);
+        if (stressScene) {
+            double stressStart = monotonicSeconds();
+            unsigned int stressDraws = 0, stressTriangles = 0, stressVisible = 0;
+            float stressLargest = 0.0f;
+            uniformRing.bind(MATERIAL_BINDING, mirrorDraw.uniformOffset, sizeof(MaterialData));
+            for (unsigned int lod = 0; lod < MAX_MESH_LODS; lod++) {
+                stressLods[lod].clear();
+            }
+            for (unsigned int i = 0; i < stressMatrices.size(); i++) {
+                if (stressCopy.anyVisible(culling, stressBounds[i])) {
+                    float size = stressCopy.projectedSize(stressMatrices[i], camera.position, glm::radians(fieldOfView));
+                    stressLods[stressCopy.selectLod(size, lodThresholds)].push_back(stressMatrices[i]);
+                    stressLargest = std::max(stressLargest, size);
+                    stressVisible++;
+                }
+            }
+            if (stressVisible > 0) {
+                stressCopy.requestTextures(stressLargest * windowHeight);
+            }
+            for (unsigned int lod = 0; lod < MAX_MESH_LODS; lod++) {
+                if (stressLods[lod].empty()) {
+                    continue;
+                }
+                if (stressInstanced) {
+                    stressTriangles += stressCopy.DrawInstanced(sceneShader, instanceBuffer, stressLods[lod].data(), (unsigned int)stressLods[lod].size(), lod);
+                    stressDraws++;
+                } else {
+                    stressNormals.resize(stressLods[lod].size());
+                    normalMatrices(stressLods[lod].data(), (unsigned int)stressLods[lod].size(), stressNormals.data());
+                    for (unsigned int i = 0; i < stressLods[lod].size(); i++) {
+                        sceneShader.set(precomputedNormals ? mainModelMatrix : referenceModelMatrix, stressLods[lod][i]);
+                        if (precomputedNormals) {
+                            mainShader.set(mainNormalMatrix, stressNormals[i]);
+                        }
+                        stressTriangles += stressCopy.Draw(sceneShader, lod);
+                        stressDraws++;
+                    }
+                }
+            }
+            trianglesDrawn += stressTriangles;
+            ImGui::Text("Stress: %u of %u instances, %u draws, %u triangles, %.2f ms CPU", stressVisible, (unsigned int)stressMatrices.size(), stressDraws, stressTriangles, (monotonicSeconds() - stressStart) * 1000.0);
+        }
+        sceneTimer.end();
+        stages.lap(STAGE_SCENE);
+        ImGui::Text("Triangles: %u drawn, %u at full detail", trianglesDrawn, trianglesFull);
+        ImGui::Text("Culling: %u of %u meshes drawn, %u culled", culling.testedCount() - culling.culledCount(), culling.testedCount(), culling.culledCount());
+        ImGui::Text("Queue: %u draws (%u in %u multi-draws), %u programs (%u saved), %u materials (%u saved)", queueStats.draws, queueStats.batchedDraws, queueStats.batches, queueStats.programSwitches, queueStats.programSwitchesSaved, queueStats.materialBinds, queueStats.materialBindsSaved);
+        ImGui::Text("       %u textures (%u saved), %u VAOs (%u saved), %u cull toggles (%u saved)", queueStats.textureBinds, queueStats.textureBindsSaved, queueStats.vertexArrayBinds, queueStats.vertexArrayBindsSaved, queueStats.cullToggles, queueStats.cullTogglesSaved);
         
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glDisable(GL_DEPTH_TEST);
+        glState().bindFramebuffer(outputFramebuffer);
+        glState().setEnabled(GL_DEPTH_TEST, false);
         glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
 
         postProcessQuad.use();
-        postProcessQuad.setUniformVec2("resolution", glm::vec2((float)windowWidth, (float)windowHeight));
-        postProcessQuad.setUniformFloat("time", glfwGetTime());
-        glBindVertexArray(quadVAO);
-        glBindTexture(GL_TEXTURE_2D, textureColorbuffer);
+        postProcessQuad.set(postProcessResolution, glm::vec2((float)windowWidth, (float)windowHeight));
+        postProcessQuad.set(postProcessTime, currentFrame);
+        glState().bindVertexArray(quadVAO);
+        glState().bindTexture(0, GL_TEXTURE_2D, textureColorbuffer);
         glDrawArrays(GL_TRIANGLES, 0, 6);
+        stages.lap(STAGE_POSTPROCESS);
         
         ImGui::Render();
+        ImGui_ImplOpenGL3_SetBufferRing(imguiBufferRing);
+        ImGui_ImplOpenGL3_SetMergeCommands(imguiMergeCommands);
+        double imguiStart = monotonicSeconds();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        glfwSwapBuffers(window);
+        imguiRenderMs = (monotonicSeconds() - imguiStart) * 1000.0;
+        uniformRing.endFrame();
+        stages.lap(STAGE_IMGUI);
+        lastStages = stages;
+        drawCalls = DrawCallCounter::take();
+        if (headless.enabled) {
+            frameTimer.end();
+            glFlush();
+            if (headlessFrame >= (unsigned int)headless.warmupFrames) {
+                HeadlessFrame frame = {headlessFrame - headless.warmupFrames, (monotonicSeconds() - frameStart) * 1000.0, 0.0f, drawCalls.calls, drawCalls.commands, trianglesDrawn, {}};
+                for (unsigned int stage = 0; stage < FRAME_STAGE_COUNT; stage++) {
+                    frame.stageMs[stage] = stages.ms[stage];
+                }
+                headlessFrames.push_back(frame);
+            }
+            headlessFrame++;
+        } else {
+            glfwSwapBuffers(window);
+        }
+    }
+    if (headless.enabled) {
+        const std::vector<GpuFrameTime> &gpuTimes = frameTimer.finish();
+        for (const GpuFrameTime &gpuTime : gpuTimes) {
+            if (gpuTime.frame >= (unsigned int)headless.warmupFrames) {
+                headlessFrames[gpuTime.frame - headless.warmupFrames].gpuMs = gpuTime.ms;
+            }
+        }
+        std::vector<FrameTimeSummary> summaries = summarizeHeadlessFrames(headlessFrames);
+        std::cout << "HEADLESS: frame time p50 " << summaries[0].p50 << " ms, p95 " << summaries[0].p95 << " ms, p99 " << summaries[0].p99 << " ms, GPU p50 " << summaries[1].p50 << " ms" << std::endl;
+        for (unsigned int stage = 0; stage < FRAME_STAGE_COUNT; stage++) {
+            std::cout << "HEADLESS:   " << frameStageName(stage) << " p50 " << summaries[2 + stage].p50 << " ms, p95 " << summaries[2 + stage].p95 << " ms, p99 " << summaries[2 + stage].p99 << " ms" << std::endl;
+        }
+        if (writeHeadlessReport(headless, headlessFrames)) {
+            std::cout << "HEADLESS: report written to " << headless.reportFile << std::endl;
+        }
     }
+    recorder.close();
+    loaderJobs.waitForJobs();
     ImGui_ImplOpenGL3_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
+    if (!headless.enabled) {
+        ImGui_ImplGlfw_Shutdown();
+    }
     ImGui::DestroyContext();
-    glfwTerminate();
+    if (window != NULL) {
+        glfwTerminate();
+    } else {
+        headlessContext.destroy();
+    }
     return 0;
 }
 
 
 void callResizeEvent(GLFWwindow* window, int width, int height) {
     glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+    resizeFramebuffers();
+}
+
+//resizes the offscreen targets to windowWidth x windowHeight
+void resizeFramebuffers() {
+    glState().bindFramebuffer(framebuffer);
     
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-    
-    glBindTexture(GL_TEXTURE_2D, textureColorbuffer);
+    glState().bindTexture(0, GL_TEXTURE_2D, textureColorbuffer);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, windowWidth, windowHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -424,33 +895,70 @@ void callResizeEvent(GLFWwindow* window, int width, int height) {
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
         std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (outputFramebuffer != 0) {
+        glBindRenderbuffer(GL_RENDERBUFFER, outputRenderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, windowWidth, windowHeight);
+    }
+    glState().bindFramebuffer(0);
 }
 
-unsigned int loadCubemap(std::vector<std::string> faces)
+unsigned int loadCubemap(std::vector<std::string> faces, bool compress)
 {
     unsigned int textureID;
     glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, textureID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-    int width, height, nrChannels;
+    TextureOptions options;
+    options.compress = compress;
+    GLint levels = 0;
+    std::vector<unsigned int> decoded;
+    std::vector<MipSource> sources;
     for (unsigned int i = 0; i < faces.size(); i++)
     {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
+        BakedTexture baked;
+        if (compress && BakedTextureFromFile(faces[i], options, baked))
+        {
+            for (unsigned int level = 0; level < baked.levels.size(); level++) {
+                const BakedLevel &data = baked.levels[level];
+                glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+                                       level, CompressedInternalFormat(baked.format, false), data.width, data.height, 0, data.size, baked.blocks + data.offset
+                );
+            }
+            levels = (GLint)baked.levels.size();
+            continue;
+        }
+        int width, height, nrChannels;
+        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 3);
         if (data)
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-                         0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
-            );
-            stbi_image_free(data);
+            MipSource source = {data, (uint32_t)width, (uint32_t)height, 3};
+            decoded.push_back(i);
+            sources.push_back(source);
         }
         else
         {
             std::cout << "Cubemap tex failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
         }
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    //the uncompressed faces get their mips built together, rows of all six
+    //spread over the cores
+    std::vector<MipChain> chains(sources.size());
+    buildMipChains(sources.data(), (unsigned int)sources.size(), MipSettings(), chains.data());
+    for (unsigned int f = 0; f < decoded.size(); f++)
+    {
+        GLenum target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + decoded[f];
+        glTexImage2D(target, 0, GL_RGB, sources[f].width, sources[f].height, 0, GL_RGB, GL_UNSIGNED_BYTE, sources[f].pixels);
+        for (unsigned int level = 0; level < chains[f].levels.size(); level++) {
+            const MipLevel &mip = chains[f].levels[level];
+            glTexImage2D(target, level + 1, GL_RGB, mip.width, mip.height, 0, GL_RGB, GL_UNSIGNED_BYTE, chains[f].level(level));
+        }
+        levels = (GLint)chains[f].levels.size() + 1;
+        stbi_image_free((void *)sources[f].pixels);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, std::max(levels - 1, 0));
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -458,3 +966,92 @@ unsigned int loadCubemap(std::vector<std::string> faces)
 
     return textureID;
 }
+
+// Times the SIMD, multithreaded mip builder against the scalar reference on
+// the skybox faces, for both filters.
+void benchmarkMips(const std::vector<std::string> &faces, MipBenchmark results[2])
+{
+    std::vector<MipSource> sources;
+    for (unsigned int i = 0; i < faces.size(); i++) {
+        int width, height, nrChannels;
+        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 3);
+        if (data) {
+            MipSource source = {data, (uint32_t)width, (uint32_t)height, 3};
+            sources.push_back(source);
+        }
+    }
+    const char *names[2] = {"box", "Kaiser"};
+    for (int filter = 0; filter < 2; filter++) {
+        MipSettings settings;
+        settings.filter = filter == 0 ? MIP_BOX : MIP_KAISER;
+        results[filter] = benchmarkMipChains(sources.data(), (unsigned int)sources.size(), settings);
+        std::cout << "MIPS: " << names[filter] << " over " << sources.size() << " faces: scalar " << results[filter].scalarMs << " ms, SIMD " << results[filter].simdMs << " ms, SIMD on " << std::thread::hardware_concurrency() << " threads " << results[filter].threadedMs << " ms, max difference " << results[filter].maxError << std::endl;
+    }
+    for (unsigned int i = 0; i < sources.size(); i++) {
+        stbi_image_free((void *)sources[i].pixels);
+    }
+}
+
+// Renders the ImGui demo window, metrics, style editor and a few hundred tool
+// panels in a second ImGui context sharing the font atlas, through the buffer
+// ring without and then with command merging, and times the backend.
+void benchmarkImGui(ImGuiBenchmark results[2])
+{
+    const int frames = 120, warmupFrames = 3, panels = 200;
+    ImGuiBackendFlags backendFlags = ImGui::GetIO().BackendFlags;
+    ImGuiContext *mainContext = ImGui::GetCurrentContext();
+    ImGuiContext *benchmarkContext = ImGui::CreateContext(ImGui::GetIO().Fonts);
+    ImGui::SetCurrentContext(benchmarkContext);
+    ImGuiIO &io = ImGui::GetIO();
+    io.IniFilename = NULL;
+    io.BackendFlags = backendFlags;
+    io.DisplaySize = ImVec2((float)windowWidth, (float)windowHeight);
+    io.DeltaTime = 1.0f / 60.0f;
+    std::vector<float> values(panels, 0.5f);
+    unsigned int query;
+    glGenQueries(1, &query);
+    ImGui_ImplOpenGL3_SetBufferRing(true);
+    for (int merged = 0; merged < 2; merged++) {
+        ImGui_ImplOpenGL3_SetMergeCommands(merged == 1);
+        double cpuSeconds = 0.0;
+        for (int frame = -warmupFrames; frame < frames; frame++) {
+            ImGui::NewFrame();
+            ImGui::ShowDemoWindow();
+            ImGui::ShowMetricsWindow();
+            ImGui::Begin("Style Editor");
+            ImGui::ShowStyleEditor();
+            ImGui::End();
+            for (int i = 0; i < panels; i++) {
+                std::string name = "Panel " + std::to_string(i);
+                ImGui::SetNextWindowPos(ImVec2((float)(i % 20) * 40.0f, (float)(i / 20) * 60.0f), ImGuiCond_FirstUseEver);
+                ImGui::Begin(name.c_str(), NULL, ImGuiWindowFlags_AlwaysAutoResize);
+                ImGui::Text("Frame %d", frame);
+                ImGui::SetNextItemWidth(120.0f);
+                ImGui::SliderFloat("Value", &values[i], 0.0f, 1.0f);
+                ImGui::ProgressBar(values[i], ImVec2(120.0f, 0.0f));
+                ImGui::End();
+            }
+            ImGui::Render();
+            if (frame == 0) {
+                glBeginQuery(GL_TIME_ELAPSED, query);
+            }
+            double start = glfwGetTime();
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            if (frame >= 0) {
+                cpuSeconds += glfwGetTime() - start;
+            }
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        ImGui_ImplOpenGL3_RenderStats stats = ImGui_ImplOpenGL3_GetRenderStats();
+        results[merged].commands = stats.Commands;
+        results[merged].drawCalls = stats.DrawCalls;
+        results[merged].cpuMs = cpuSeconds * 1000.0 / frames;
+        results[merged].gpuMs = elapsed / 1.0e6 / frames;
+        std::cout << "IMGUI: " << (merged ? "merged" : "unmerged") << " over " << frames << " frames: " << stats.Commands << " commands in " << stats.DrawCalls << " draws, " << results[merged].cpuMs << " ms CPU, " << results[merged].gpuMs << " ms GPU" << std::endl;
+    }
+    glDeleteQueries(1, &query);
+    ImGui::DestroyContext(benchmarkContext);
+    ImGui::SetCurrentContext(mainContext);
+}
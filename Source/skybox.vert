@@ -3,11 +3,34 @@ layout (location = 0) in vec3 aPos;
 
 out vec3 TexCoords;
 
-uniform mat4 viewMatrix;
-uniform mat4 perspectiveMatrix;
+const int MAX_POINT_LIGHTS = 32;
+struct PointLight {
+    vec3 position;
+    float linear;
+    float quadratic;
+};
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float linear;
+    float quadratic;
+    float cutOff;
+    float outerCutOff;
+};
+layout (std140) uniform FrameData {
+    mat4 viewMatrix;
+    mat4 perspectiveMatrix;
+    vec3 cameraPosition;
+    float time;
+    vec3 direction_light;
+    int nrPointLights;
+    vec3 sunColor;
+    SpotLight spotLight;
+    PointLight pointLights[MAX_POINT_LIGHTS];
+};
 
 void main()
 {
     TexCoords = aPos;
-    gl_Position = (perspectiveMatrix * viewMatrix * vec4(aPos, 1.0)).xyzw;
+    gl_Position = (perspectiveMatrix * mat4(mat3(viewMatrix)) * vec4(aPos, 1.0)).xyzw;
 }
@@ -2,6 +2,11 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoord;
+// Only fed by instanced draws, which take the model matrix from here.
+layout (location = 3) in mat4 instanceMatrix;
+#ifdef PRECOMPUTED_NORMAL_MATRIX
+layout (location = 7) in mat3 instanceNormalMatrix;
+#endif
 
 out vec2 TexCoord;
 out vec3 fPosition;
@@ -9,13 +14,66 @@ out vec3 fNormal;
 
 
 uniform mat4 modelMatrix;
-uniform mat4 viewMatrix;
-uniform mat4 perspectiveMatrix;
+uniform bool instanced;
+#ifdef PRECOMPUTED_NORMAL_MATRIX
+// transpose(inverse(mat3(modelMatrix))), computed once per object on the CPU.
+uniform mat3 normalMatrix;
+#endif
+
+// Undo the quantization of compact vertex formats; identity for float meshes.
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+uniform vec2 uvOffset;
+uniform vec2 uvScale;
+uniform bool octahedralNormals;
+
+const int MAX_POINT_LIGHTS = 32;
+struct PointLight {
+    vec3 position;
+    float linear;
+    float quadratic;
+};
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float linear;
+    float quadratic;
+    float cutOff;
+    float outerCutOff;
+};
+layout (std140) uniform FrameData {
+    mat4 viewMatrix;
+    mat4 perspectiveMatrix;
+    vec3 cameraPosition;
+    float time;
+    vec3 direction_light;
+    int nrPointLights;
+    vec3 sunColor;
+    SpotLight spotLight;
+    PointLight pointLights[MAX_POINT_LIGHTS];
+};
+
+vec3 decodeOctahedral(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        vec2 signs = mix(vec2(-1.0), vec2(1.0), greaterThanEqual(e, vec2(0.0)));
+        n.xy = (1.0 - abs(e.yx)) * signs;
+    }
+    return normalize(n);
+}
 
 void main()
 {
-    fPosition = vec3(modelMatrix * vec4(aPos, 1.0));
-    fNormal = normalize(transpose(inverse(mat3(modelMatrix))) * aNormal);
-    gl_Position = perspectiveMatrix * viewMatrix * modelMatrix * vec4(aPos, 1.0);
-    TexCoord = aTexCoord;
+    vec3 position = positionOffset + positionScale * aPos;
+    vec3 normal = octahedralNormals ? decodeOctahedral(aNormal.xy) : aNormal;
+    mat4 model = instanced ? instanceMatrix : modelMatrix;
+    fPosition = vec3(model * vec4(position, 1.0));
+#ifdef PRECOMPUTED_NORMAL_MATRIX
+    mat3 normalTransform = instanced ? instanceNormalMatrix : normalMatrix;
+#else
+    mat3 normalTransform = transpose(inverse(mat3(model)));
+#endif
+    fNormal = normalize(normalTransform * normal);
+    gl_Position = perspectiveMatrix * viewMatrix * vec4(fPosition, 1.0);
+    TexCoord = uvOffset + uvScale * aTexCoord;
 }